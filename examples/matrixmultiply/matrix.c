@@ -44,15 +44,12 @@ void* compute_row(void* args){
     for (int j = 0; j < argument.N; j++) {
       double C_i_j = 0;
 
+      // Shared memory can be accessed directly, pages are fetched on the first access
       for (int k = 0; k < argument.N; k++) {
-        double A_i_k, B_j_k;
-        cdt_memcpy(&A_i_k, argument.A + i * argument.N + k, sizeof(double));
-        cdt_memcpy(&B_j_k, argument.B + j * argument.N + k, sizeof(double));
-
-        C_i_j += A_i_k * B_j_k;
+        C_i_j += argument.A[i * argument.N + k] * argument.B[j * argument.N + k];
       }
       
-      cdt_memcpy(argument.C + i * argument.N + j, &C_i_j, sizeof(double));
+      argument.C[i * argument.N + j] = C_i_j;
     }
   }
 
@@ -86,6 +83,9 @@ int multiply(int N, double *A, double *B, double *C, int num_threads) {
   transpose(N, B);
   // print_matrix(N, B);
 
+  // every thread reads all of B, so give each machine its copy up front
+  cdt_broadcast(B, N * N * sizeof(double));
+
   sleep(1);
 
   // if the number of matrix row is smaller than the total number of thread
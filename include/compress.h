@@ -0,0 +1,22 @@
+#ifndef COORDINATE_COMPRESS_H
+#define COORDINATE_COMPRESS_H
+
+#include <stddef.h>
+
+/**
+ * Compress size bytes from src into dst with a fast LZ77 codec, writing at most capacity bytes. The
+ * codec finds repeats of at least four bytes within the last 64 KB, which makes it cheap enough to
+ * run on every page sent while still shrinking pages of small integers and sparse data several times.
+ *
+ * Returns the number of bytes written to dst, or 0 if the compressed data does not fit in capacity.
+ */
+size_t cdt_compress(const void *src, size_t size, void *dst, size_t capacity);
+
+/**
+ * Decompress size bytes from src, created by cdt_compress, into dst, writing at most capacity bytes.
+ *
+ * Returns the number of bytes written to dst, or -1 if the data is malformed or does not fit in capacity.
+ */
+int cdt_decompress(const void *src, size_t size, void *dst, size_t capacity);
+
+#endif
@@ -1,8 +1,20 @@
 #ifndef COORDINATE_CONNECTION_H
 #define COORDINATE_CONNECTION_H
 #include <arpa/inet.h>
+#include <pthread.h>
+#include "packet.h"
 
-typedef struct cdt_packet_t cdt_packet_t;
+/**
+ * Compression modes for the packets sent by this machine. Packets are always accepted compressed or not,
+ * so the mode only needs to be chosen by the manager, which hands it to every peer when they join.
+ */
+#define CDT_CONNECTION_COMPRESS_NONE 0
+#define CDT_CONNECTION_COMPRESS_LZ 1
+
+/* Packets smaller than this are sent as they are. */
+#define CDT_CONNECTION_COMPRESS_MIN_SIZE 256
+/* After a packet that did not compress, this many large packets on the connection are sent as they are. */
+#define CDT_CONNECTION_COMPRESS_BYPASS 16
 
 /**
  * An object that represents a coodinate connection.
@@ -11,6 +23,14 @@ typedef struct cdt_connection_t {
   int fd;
   int port;
   char address[INET6_ADDRSTRLEN];
+  /* Held while a packet is being sent so that packets from different threads are not interleaved. */
+  pthread_mutex_t send_lock;
+  /* Number of large packets left to send without trying to compress them. Protected by send_lock. */
+  int compress_skip;
+  /* Holds the compressed data of the packet being sent. Protected by send_lock. */
+  char send_buffer[CDT_PACKET_DATA_SIZE];
+  /* Holds the compressed data of the packet being received, which only the receiving thread uses. */
+  char receive_buffer[CDT_PACKET_DATA_SIZE];
 } cdt_connection_t;
 
 /**
@@ -27,6 +47,18 @@ int cdt_connection_create(cdt_connection_t *connection, int fd, struct sockaddr_
  */
 int cdt_connection_connect(cdt_connection_t *connection, const char *address, const char *port);
 
+/**
+ * Set the compression mode used for the packets this machine sends, one of the CDT_CONNECTION_COMPRESS_*
+ * values. Packets carrying at least CDT_CONNECTION_COMPRESS_MIN_SIZE bytes are compressed, and are sent
+ * as they are if that would not save an eighth of their size.
+ */
+void cdt_connection_set_compression(int mode);
+
+/**
+ * Get the compression mode used for the packets this machine sends.
+ */
+int cdt_connection_get_compression();
+
 /**
  * Close the connection.
  */
@@ -37,13 +69,13 @@ void cdt_connection_close(cdt_connection_t *connection);
  * 
  * Returns 0 on success, or -1 on error.
  */
-int cdt_connection_receive(const cdt_connection_t *connection, cdt_packet_t *packet);
+int cdt_connection_receive(cdt_connection_t *connection, cdt_packet_t *packet);
 
 /**
  * Send a packet along this connection. This operation will block until the packet is completely sent, or an error occurs.
  * 
  * Returns 0 on success, or -1 on error.
  */
-int cdt_connection_send(const cdt_connection_t *connection, const cdt_packet_t *packet);
+int cdt_connection_send(cdt_connection_t *connection, const cdt_packet_t *packet);
 
 #endif
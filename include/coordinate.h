@@ -9,6 +9,10 @@ extern "C" {
 
 #include "init.h"
 #include "thread.h"
+#include "lock.h"
+#include "object.h"
+#include "halo.h"
+#include "epoch.h"
 
 /**
  * Gets the number of cores available to this process.
@@ -18,11 +22,71 @@ extern "C" {
  */
 int cdt_get_cores(int fallback);
 
+/**
+ * Flags that can be passed to cdt_malloc_flags.
+ *
+ * CDT_MALLOC_MULTIPLE_WRITER allows several machines to write to the same page at once. Each writer
+ * keeps a twin of the page, and only the words it changed are merged into the manager's copy at the
+ * next synchronization point (cdt_sync, or the creation or completion of a thread). Writes by other
+ * machines are not guaranteed to be visible before then.
+ */
+#define CDT_MALLOC_MULTIPLE_WRITER 0x1
+
+/**
+ * CDT_MALLOC_RELEASE_CONSISTENT makes multiple-writer memory release consistent. Writes are published
+ * by cdt_release, but other machines keep using their copies until their next cdt_acquire, which is
+ * when stale copies are discarded. Write access is also granted without contacting the manager when
+ * this machine already holds a copy. Implies CDT_MALLOC_MULTIPLE_WRITER.
+ */
+#define CDT_MALLOC_RELEASE_CONSISTENT 0x2
+
+/**
+ * CDT_MALLOC_WRITE_UPDATE suits pages written by a producer and polled by consumers. At each
+ * synchronization point, the words a writer changed are pushed to every machine holding a copy of the
+ * page instead of invalidating it, so readers keep their copies and never fault on the page again.
+ * Implies CDT_MALLOC_MULTIPLE_WRITER.
+ */
+#define CDT_MALLOC_WRITE_UPDATE 0x4
+
+/**
+ * CDT_MALLOC_LEASE grants read copies of the page for a bounded time instead of until they are
+ * invalidated. A machine drops its copy by itself when the lease runs out, and a writer waits for the
+ * outstanding leases to expire instead of asking every reader to give up its copy, so writes to pages
+ * with many readers take at most one lease period rather than a message to and from every reader.
+ * Cannot be combined with multiple-writer memory.
+ */
+#define CDT_MALLOC_LEASE 0x8
+
+/**
+ * CDT_MALLOC_HALO is for grids split into partitions that only share their boundaries, as in stencil
+ * codes. The memory is never kept coherent: each machine starts out with a zeroed copy of its own, and
+ * data only moves between machines when it is sent with cdt_halo_exchange. Cannot be combined with any
+ * other flag.
+ */
+#define CDT_MALLOC_HALO 0x10
+
+/**
+ * CDT_MALLOC_BLOCK_PAGES(shift) makes blocks of 2^shift pages, rather than single pages, the unit of
+ * coherence for the allocation. A fault on any page of a block brings in the whole block, and every
+ * page of a block has the same home, so large arrays that are streamed through fault far less often.
+ * shift may be at most CDT_MALLOC_MAX_BLOCK_SHIFT, and the allocation starts on a block boundary.
+ */
+#define CDT_MALLOC_BLOCK_PAGES(shift) ((shift) << 8)
+#define CDT_MALLOC_MAX_BLOCK_SHIFT 9
+#define CDT_MALLOC_BLOCK_16K CDT_MALLOC_BLOCK_PAGES(2)
+#define CDT_MALLOC_BLOCK_64K CDT_MALLOC_BLOCK_PAGES(4)
+#define CDT_MALLOC_BLOCK_2M CDT_MALLOC_BLOCK_PAGES(9)
+
 /**
  * Allocates size bytes of shared memory and returns a pointer to the allocated memory.
  */
 void* cdt_malloc(size_t size);
 
+/**
+ * Allocates size bytes of shared memory like cdt_malloc, using the coherence options given by flags.
+ */
+void* cdt_malloc_flags(size_t size, int flags);
+
 /**
  * Do we want to support this?
  */
@@ -35,6 +99,54 @@ void cdt_free(void *ptr);
  */
 void* cdt_memcpy(void *dest, const void *src, size_t n);
 
+/**
+ * Copies n bytes from local memory src to shared memory dest like cdt_memcpy, for initializing large
+ * arrays. The pages dest covers completely are taken without fetching their old contents, and are
+ * written with non-temporal stores that bypass the cache.
+ */
+void* cdt_stream_write(void *dest, const void *src, size_t n);
+
+/**
+ * Makes every page of the size bytes of single-writer shared memory starting at addr immutable on every
+ * machine. Copies of frozen pages are kept until the program exits and are read without any locking,
+ * and writing to them afterwards is an error that crashes the writer.
+ *
+ * The memory MUST no longer be written by any machine. Returns 0 on success, or -1 if any of it is not
+ * single-writer memory, in which case some of the range may still have been frozen.
+ */
+int cdt_freeze(void *addr, size_t size);
+
+/**
+ * Gives every machine a read-only copy of each page of the len bytes of shared memory starting at addr,
+ * such as the input of a parallel phase that all of them are about to read. Each home sends its pages
+ * down a tree that every machine passes them on through, so no machine sends a page more than a couple
+ * of times, and the copies are in place before this returns. Multiple-writer and leased pages are left
+ * to be fetched as they are read.
+ *
+ * The memory should not be written by any machine while it is broadcast. Returns 0 on success, -1 on error.
+ */
+int cdt_broadcast(void *addr, size_t len);
+
+/**
+ * Publishes the writes this machine has made to multiple-writer memory since the last synchronization
+ * point, and discards any copies of multiple-writer pages that may have been made stale by other writers.
+ * 
+ * This is equivalent to cdt_release followed by cdt_acquire.
+ */
+void cdt_sync();
+
+/**
+ * Discards this machine's copies of release-consistent pages that other machines have published writes
+ * to, so that every write released before this call is visible after it.
+ */
+void cdt_acquire();
+
+/**
+ * Publishes the writes this machine has made to multiple-writer memory since the last synchronization
+ * point. Machines holding copies of release-consistent pages are not notified until their next acquire.
+ */
+void cdt_release();
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,28 @@
+#ifndef COORDINATE_DIFF_H
+#define COORDINATE_DIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "util.h"
+
+/* Diffs are computed and applied at the granularity of a word of this many bytes. */
+#define CDT_DIFF_WORD_SIZE sizeof(uint32_t)
+#define CDT_DIFF_PAGE_WORDS (PAGESIZE / CDT_DIFF_WORD_SIZE)
+
+/**
+ * Encode the words of page that differ from twin into diff as a series of runs, using at most size bytes.
+ * Encoding starts at word index *word, and *word is advanced past the last word that was examined. Once
+ * the whole page has been encoded, *word will be CDT_DIFF_PAGE_WORDS.
+ * 
+ * Returns the number of bytes written to diff.
+ */
+size_t cdt_diff_encode(const void *page, const void *twin, void *diff, size_t size, uint32_t *word);
+
+/**
+ * Apply a diff of size bytes created by cdt_diff_encode to page.
+ * 
+ * Returns 0 on success, -1 if the diff is malformed.
+ */
+int cdt_diff_apply(void *page, const void *diff, size_t size);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef COORDINATE_EPOCH_H
+#define COORDINATE_EPOCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "object.h"
+
+/**
+ * A double-buffered shared array for iterative codes that read one generation of their data while
+ * writing the next. During each epoch every thread reads the generation written in the previous epoch
+ * and writes the current one, and cdt_epoch_advance moves every thread on to the next epoch together.
+ * The generation that was just written is handed to every machine as the epoch advances, so reading it
+ * never faults, and nothing is read from the generation being written, so its writers are never asked
+ * to give up their pages before the epoch ends.
+ *
+ * Each copy of a cdt_epoch_array_t keeps track of the epoch its threads are in, so a thread may take its
+ * own copy, including through shared memory from another machine, as long as it is taken in the epoch
+ * the thread starts out in.
+ */
+typedef struct cdt_epoch_array_t {
+  /* The two generations, each of size bytes of shared memory. Epoch e writes buffers[e % 2]. */
+  void *buffers[2];
+  size_t size;
+  /* The number of threads that take part in every advance */
+  uint32_t participants;
+  /* Counts every thread's arrival at an advance, and one more for the end of each advance */
+  cdt_object_t arrivals;
+  /* The epoch the threads using this copy are in, which only cdt_epoch_advance changes */
+  int64_t epoch;
+} cdt_epoch_array_t;
+
+/**
+ * Initialize an array of two generations of size bytes each, both zeroed, for participants threads that
+ * all call cdt_epoch_advance at the end of every epoch. The array starts out at epoch 0.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_epoch_init(cdt_epoch_array_t *array, size_t size, uint32_t participants);
+
+/**
+ * Get the epoch the calling thread is in, which is the number of advances it has completed. This is
+ * kept in array, so no other machine is asked.
+ */
+int64_t cdt_epoch_current(const cdt_epoch_array_t *array);
+
+/**
+ * Get the generation written in the previous epoch, which MUST NOT be written.
+ */
+const void* cdt_epoch_read(const cdt_epoch_array_t *array);
+
+/**
+ * Get the generation being written in the current epoch, which MUST NOT be read before the next
+ * advance other than by the thread that wrote each part of it.
+ */
+void* cdt_epoch_write(const cdt_epoch_array_t *array);
+
+/**
+ * Wait for every participant to finish the current epoch, then start the next one, in which the
+ * generation written in this one is read. Every machine is given a read-only copy of that generation
+ * before any participant returns, and the copies are read in place without locking until the epoch
+ * ends. Waiting participants sleep until the last one arrives.
+ *
+ * Returns 0 on success, -1 on error, including if the generation could not be handed to every machine,
+ * in which case the next epoch has still started and its reads fault in what is missing.
+ */
+int cdt_epoch_advance(cdt_epoch_array_t *array);
+
+#endif
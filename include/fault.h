@@ -0,0 +1,148 @@
+#ifndef COORDINATE_FAULT_H
+#define COORDINATE_FAULT_H
+
+#include <stdint.h>
+
+typedef struct cdt_host_t cdt_host_t;
+typedef struct cdt_page_range_t cdt_page_range_t;
+
+/**
+ * Install the SIGSEGV handler that resolves loads and stores to shared pages this machine
+ * does not hold with sufficient access. This allows shared memory to be accessed directly
+ * instead of through cdt_memcpy. The handler itself only hands each fault to a fault thread started
+ * here, which does the locking, allocation and messaging needed to resolve it.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_fault_init();
+
+/**
+ * Lock or unlock the fault lock, which a thread other than the fault thread MUST hold while it sends
+ * requests for pages, so that its responses and the fault thread's are never waited on at the same
+ * time. It is taken before any PTE lock.
+ */
+void cdt_fault_lock(cdt_host_t *host);
+void cdt_fault_unlock(cdt_host_t *host);
+
+/**
+ * Make sure this machine has read access to the shared page with index idx, requesting a copy
+ * of the page from its home if necessary. On success the page is mapped and can be read in place.
+ *
+ * The PTE for idx MUST be locked before calling this.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_fault_read(cdt_host_t *host, int idx);
+
+/**
+ * Fetch the copies of the shared pages from start to start + num_pages that this machine is missing,
+ * asking each home for all of its pages in one request. Pages that cannot be sent right away, such
+ * as those held by another writer, are left to cdt_fault_read.
+ *
+ * The PTEs for every page in the range MUST be locked before calling this.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_fault_read_range(cdt_host_t *host, int start, int num_pages);
+
+/**
+ * Take R/W access to the shared pages from start to start + num_pages that this machine does not
+ * already hold, asking each home for all of its pages in one request. Pages that cannot be handed
+ * over right away, such as those held by another writer, are left to cdt_fault_write.
+ *
+ * The PTEs for every page in the range MUST be locked before calling this.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_fault_write_range(cdt_host_t *host, int start, int num_pages);
+
+/**
+ * Take R/W access to every shared page from start to start + num_pages that this machine does not
+ * already hold. The pages this machine is the home for are recalled from all of their writers and
+ * readers at once, with one invalidation for each machine holding copies, and each other home is asked
+ * for all of its pages in one request. Pages that cannot be handed over right away are left to
+ * cdt_fault_write. If overwrite is nonzero, every byte of the range MUST be written before the PTEs
+ * are unlocked, and the other homes hand over single-writer pages without sending their contents.
+ *
+ * The PTEs for every page in the range MUST be locked before calling this.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_fault_own_range(cdt_host_t *host, int start, int num_pages, int overwrite);
+
+/**
+ * Make sure this machine has read/write access to the shared page with index idx, requesting
+ * ownership of the page if necessary.
+ *
+ * The PTE for idx MUST be locked before calling this.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_fault_write(cdt_host_t *host, int idx);
+
+/**
+ * Make sure this machine has read access, or read/write access if write is nonzero, to every page of
+ * the coherence block of num_pages pages starting at index start.
+ *
+ * The PTEs for every page in the block MUST be locked before calling this.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_fault_block(cdt_host_t *host, int start, int num_pages, int write);
+
+/**
+ * Map this machine's own copy of the halo page with index idx, zero filled, if it has not been mapped yet.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_fault_halo(cdt_host_t *host, int idx);
+
+/**
+ * Check whether this machine holds a copy of the frozen page with index idx, which can be read without
+ * locking its PTE since it never changes or goes away.
+ *
+ * Returns 1 if it does, 0 otherwise.
+ */
+int cdt_fault_frozen_copy(cdt_host_t *host, int idx);
+
+/**
+ * Mark this machine's copies of the shared pages from start to start + num_pages as frozen on this machine
+ * alone, or clear the mark if frozen is zero, without telling their homes or any other machine. Marked
+ * copies are read in place as those of frozen pages are, without locking their PTEs, but are otherwise
+ * kept like any other copy. The pages this machine is the home for are never marked, since their homes
+ * still keep track of every copy. No machine may write any of the pages from before they are marked until
+ * after the mark is cleared.
+ */
+void cdt_fault_mark_frozen(cdt_host_t *host, int start, int num_pages, int frozen);
+
+/**
+ * Publish the changes this machine has made to the multiple-writer page with index idx since the
+ * last synchronization point. Does nothing for pages this machine has not written to.
+ *
+ * The PTE for idx MUST be locked before calling this.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_fault_release(cdt_host_t *host, int idx);
+
+/**
+ * Discard this machine's copies of the pages in the given ranges that other machines have published
+ * changes to since this machine last fetched them.
+ *
+ * No PTE locks may be held when calling this.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_fault_acquire(cdt_host_t *host, const cdt_page_range_t *ranges, uint32_t num_ranges);
+
+/**
+ * Discard this machine's copy of the shared page with index idx, first publishing any changes made
+ * to it. Only valid on machines other than the page's home.
+ *
+ * The PTE for idx MUST be locked before calling this.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_fault_invalidate(cdt_host_t *host, int idx);
+
+#endif
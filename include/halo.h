@@ -0,0 +1,45 @@
+#ifndef COORDINATE_HALO_H
+#define COORDINATE_HALO_H
+
+#include <stddef.h>
+#include "thread.h"
+
+/* The most slices a machine can send, and the most it can receive, at each exchange */
+#define CDT_MAX_HALO_SLICES 32
+
+/**
+ * Declare that the len bytes of halo memory starting at addr, such as the boundary rows of the calling
+ * thread's partition of a grid, are read by the thread reader. Every cdt_halo_exchange from then on
+ * replaces reader's copy of them with ours.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_halo_send(void *addr, size_t len, const cdt_thread_t *reader);
+
+/**
+ * Declare that the len bytes of halo memory starting at addr are sent by the thread writer, which MUST
+ * declare the same slice with cdt_halo_send. Two threads must declare the slices they exchange in the
+ * same order.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_halo_receive(void *addr, size_t len, const cdt_thread_t *writer);
+
+/**
+ * Send every slice declared with cdt_halo_send, with a single message to each reader unless there is
+ * more than a page of them, then wait for every slice declared with cdt_halo_receive and copy it into
+ * place. Slices only change when this is called, so a partition can keep reading its copies of its
+ * neighbours' boundaries while they write the next ones.
+ *
+ * Under local mode halo memory is ordinary memory, and this does nothing.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_halo_exchange();
+
+/**
+ * Forget every slice declared by the calling thread.
+ */
+void cdt_halo_clear();
+
+#endif
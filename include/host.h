@@ -2,6 +2,9 @@
 #define COORDINATE_HOST_H
 
 #include "peer.h"
+#include "packet.h"
+#include "object.h"
+#include "halo.h"
 
 typedef struct cdt_server_t cdt_server_t;
 
@@ -12,8 +15,22 @@ typedef struct cdt_server_t cdt_server_t;
 #define INVALID_PAGE 0
 #define READ_ONLY_PAGE 1
 #define READ_WRITE_PAGE 2
+#define IS_SHARED_VA(va) ((uint64_t)(va) >= CDT_SHARED_VA_START && (uint64_t)(va) < CDT_SHARED_VA_END)
 #define SHARED_VA_TO_IDX(va) (((uint64_t)(va) - CDT_SHARED_VA_START) / PAGESIZE)
 #define PGROUNDDOWN(a) ((uint64_t)(a) & ~(PAGESIZE-1))
+#define CDT_MAX_LOCKS 1024
+#define CDT_MAX_LOCK_RANGES 16
+#define CDT_MAX_OBJECTS 4096
+/* The number of times a machine must take ownership of a single-writer page, more often than any other
+   machine, before the page's home moves to it */
+#define CDT_HOME_MIGRATE_WRITES 4
+/* The log2 of the number of pages in each coherence block of an allocation made with the given flags */
+#define CDT_BLOCK_SHIFT(flags) (((flags) >> 8) & 0xf)
+/* How long, in milliseconds, a read copy of a leased page may be used after it was asked for */
+#define CDT_LEASE_MS 100
+/* How much earlier than its home a reader gives up a leased copy, which covers the time it takes the
+   lease thread to notice the lease has run out */
+#define CDT_LEASE_SLACK_MS 10
 
 extern const char* const cdt_task_queue_names[CDT_MAX_MACHINES];
 
@@ -25,13 +42,37 @@ typedef struct cdt_host_pte_t {
   uint64_t shared_va;
   /* access is one of READ_ONLY, READ_WRITE, and INVALID */
   int access;
-  /* if access = INVALID then page = NULL */
+  /* if access = INVALID then page = NULL, otherwise page = shared_va */
   void * page;
+  /* The cdt_malloc_flags the page was allocated with */
+  int flags;
+  /* A copy of the page taken when write access was granted, only used for multiple-writer pages */
+  void * twin;
+  /* A copy of a single-writer page as the home granted it, kept while the home holds the same contents so
+     that only the words this machine changed are sent back when the page is recalled. NULL otherwise. */
+  void * base;
   pthread_mutex_t lock;
+  /* Set while the thread holding lock waits for the manager to send a copy of the page.
+     fetching and fetch_invalidated are protected by fetch_lock rather than lock. */
+  int fetching;
+  /* Set if the page was invalidated while it was being fetched, in which case a read-only copy that
+     arrives may already be stale */
+  int fetch_invalidated;
+  pthread_mutex_t fetch_lock;
+  /* The time, as given by cdt_host_now, at which a read-only copy of a leased page must be dropped,
+     or 0 if the copy is not leased. Read without the lock by the lease thread. */
+  uint64_t lease_expiry;
+  /* The version of the read-only copy the home last handed us, which stays in place when the copy is
+     invalidated or its lease runs out, so the home can tell us to keep using it. 0 if the contents are
+     not a copy the home knows the version of. */
+  uint32_t version;
+  /* Set when the home handed us ownership of a migratory page on a read. The page is mapped read-only
+     until our first write, which takes R/W access without asking the home. */
+  int exclusive;
 } cdt_host_pte_t;
 
-/* Pagetable entry for a single page in the manager's page table. 
-   The PTE must be locked before being accessed in any way. */
+/* Pagetable entry for a single page in the page table of the page's home, which keeps track of every
+   machine's access to the page. The PTE must be locked before being accessed in any way. */
 typedef struct cdt_manager_pte_t {
   int in_use;
   /* shared_va should never be changed after init */
@@ -42,27 +83,230 @@ typedef struct cdt_manager_pte_t {
   /* The machine ID with R/W access. If this is -1, there is no writer. 
      If this is >=0 then read_set must be all zeros */
   int writer;
-  /* Pointer to the page itself which is only valid when the page is in R/O mode */
+  /* The cdt_malloc_flags the page was allocated with */
+  int flags;
+  /* The set of machines writing to a multiple-writer page, whose changes have not yet been merged.
+     Multiple-writer pages never have a writer, and writers are also in read_set. */
+  int write_set[CDT_MAX_MACHINES];
+  /* Set when the manager has written to a multiple-writer page since its last synchronization point */
+  int dirty;
+  /* The set of machines whose copy of a release-consistent page has been made stale by another writer.
+     Each such machine discards its copy at its next acquire. */
+  int stale_set[CDT_MAX_MACHINES];
+  /* The number of times each machine has taken ownership of a single-writer page since it moved here */
+  uint32_t write_counts[CDT_MAX_MACHINES];
+  /* A copy of a write-update page taken when the home first wrote to it since its last synchronization
+     point, so that only the home's own changes are pushed to readers */
+  void * twin;
+  /* Stamps the contents of a single-writer page, and changes whenever a machine is given ownership of
+     it. Versions end in the id of the home that made them and keep growing across the home's tenures,
+     so a page that moves never reuses one. */
+  uint32_t version;
+  /* The machine that last took ownership of a single-writer page, or -1 if none has */
+  int last_writer;
+  /* Set while a single-writer page is migratory, with each machine reading it and then writing it in
+     turn, in which case readers are given ownership of it straight away */
+  int migratory;
+  /* The machine to consider first when picking which copy of a read-only page serves the next reader */
+  uint32_t next_replica;
+  /* The time, as given by cdt_host_now, until which each machine in read_set may use its copy of a
+     leased page. Writers wait for these to pass instead of invalidating the readers. */
+  uint64_t lease_expiry[CDT_MAX_MACHINES];
+  /* The time until which the leases taken away from readers by the last writer may still be in use.
+     Requests for the page are parked until then. */
+  uint64_t lease_wait;
+  /* Pointer to the page itself which is only valid when the page is in R/O mode or the manager is the writer.
+     When valid, this is always shared_va. */
   void * page;
   pthread_mutex_t lock;
 } cdt_manager_pte_t;
 
+/* A set of shared page indices kept in the order they were added, so that synchronization points only
+   visit the pages that need work instead of scanning the whole pagetable.
+   The list must be locked before being accessed in any way. */
+typedef struct cdt_host_page_list_t {
+  uint32_t pages[CDT_MAX_SHARED_PAGES];
+  uint32_t num_pages;
+  /* Set for each page that is in pages, so that no page is added twice */
+  uint8_t listed[CDT_MAX_SHARED_PAGES];
+  pthread_mutex_t lock;
+} cdt_host_page_list_t;
+
+/* A range of shared pages, such as those bound to a lock. */
+typedef struct cdt_page_range_t {
+  /* The index of the first page in the range */
+  uint32_t start;
+  uint32_t num_pages;
+} cdt_page_range_t;
+
+/* Entry for a single lock in the manager's lock table.
+   The entry must be locked before being accessed in any way. */
+typedef struct cdt_manager_lock_t {
+  int in_use;
+  /* The machine ID holding the lock. If this is -1, the lock is free. */
+  int holder;
+  /* The machines waiting to acquire the lock, in the order they will be granted it */
+  uint32_t waiters[CDT_MAX_MACHINES];
+  int num_waiters;
+  cdt_page_range_t ranges[CDT_MAX_LOCK_RANGES];
+  int num_ranges;
+  pthread_mutex_t lock;
+} cdt_manager_lock_t;
+
+/* The ranges bound to a lock held by this machine, as they were when the lock was acquired. */
+typedef struct cdt_host_lock_t {
+  cdt_page_range_t ranges[CDT_MAX_LOCK_RANGES];
+  int num_ranges;
+} cdt_host_lock_t;
+
+/* Entry for a shared object in the object directory of its home, which is the machine that created it.
+   The entry must be locked before being accessed in any way. */
+typedef struct cdt_manager_object_t {
+  int in_use;
+  uint32_t size;
+  uint8_t data[CDT_MAX_OBJECT_SIZE];
+  /* The set of machines caching a copy of the object */
+  int read_set[CDT_MAX_MACHINES];
+  /* The set of machines waiting in cdt_object_wait for the object to reach the value in wait_targets */
+  int wait_set[CDT_MAX_MACHINES];
+  int64_t wait_targets[CDT_MAX_MACHINES];
+  pthread_mutex_t lock;
+} cdt_manager_object_t;
+
+/* This machine's cached copy of a shared object homed on another machine.
+   The entry must be locked before being accessed in any way. */
+typedef struct cdt_host_object_t {
+  /* Set while data holds the current contents of the object */
+  int valid;
+  uint8_t data[CDT_MAX_OBJECT_SIZE];
+  /* Set while a copy of the object is being fetched, which is done without holding lock */
+  int fetching;
+  /* Set if the object was invalidated while it was being fetched, so the copy that arrives is not kept */
+  int fetch_invalidated;
+  pthread_mutex_t lock;
+} cdt_host_object_t;
+
+/* A slice of halo memory that this machine sends to or receives from another one at each exchange. */
+typedef struct cdt_halo_slice_t {
+  uint64_t addr;
+  uint32_t size;
+  /* The machine the slice is sent to or received from */
+  uint32_t machine;
+} cdt_halo_slice_t;
+
+/* One exchange's worth of the slices another machine has sent this one, one after another in the order
+   they were declared. */
+typedef struct cdt_host_halo_exchange_t {
+  uint8_t *data;
+  uint32_t capacity;
+  /* The number of bytes the sender declared, and the number of them that have arrived */
+  uint32_t total;
+  uint32_t received;
+  struct cdt_host_halo_exchange_t *next;
+} cdt_host_halo_exchange_t;
+
+/* The exchanges another machine has sent this one that have not been copied into place yet. A sender
+   may be any number of exchanges ahead of us, so its later exchanges are queued behind the one we are
+   waiting for rather than holding up the worker that receives them.
+   The entry must be locked before being accessed in any way. */
+typedef struct cdt_host_halo_inbox_t {
+  /* The oldest exchange, which is the next one to be copied into place, and the one still arriving */
+  cdt_host_halo_exchange_t *head;
+  cdt_host_halo_exchange_t *tail;
+  /* An exchange that has been copied into place, kept so its buffer can be reused */
+  cdt_host_halo_exchange_t *spare;
+  /* Signalled whenever an exchange has arrived in full */
+  pthread_cond_t cond;
+  pthread_mutex_t lock;
+} cdt_host_halo_inbox_t;
+
+/* A request from another machine parked until the leases it waits for have run out, when it is handed
+   back to the machine's worker thread */
+typedef struct cdt_host_parked_t {
+  uint32_t sender_id;
+  /* The time, as given by cdt_host_now, at which the request is handled again */
+  uint64_t due;
+  cdt_packet_t packet;
+  struct cdt_host_parked_t *next;
+} cdt_host_parked_t;
+
 typedef struct cdt_host_t {
   /* Will be 1 if this machine is the manager, otherwise 0. */
   int manager;
   cdt_server_t *server;
   pthread_t server_thread;
+  /* Drops the leased copies of pages that have run out, and hands back parked requests once they are due */
+  pthread_t lease_thread;
+  /* The pages this machine holds leased copies of */
+  cdt_host_page_list_t leased_pages;
+  cdt_host_parked_t *parked;
+  /* Protects parked and lease_changes, and is signalled along with lease_cond whenever a lease starts
+     or a request is parked, so the lease thread can sleep until the next one runs out */
+  pthread_mutex_t lease_lock;
+  pthread_cond_t lease_cond;
+  uint32_t lease_changes;
+  /* Resolves the faults handed over by the SIGSEGV handler */
+  pthread_t fault_thread;
+  /* The responses to the fault thread's requests for pages, which are kept apart from the user thread's */
+  mqd_t fault_queue;
+  /* Held by whichever thread has requests for pages outstanding, see cdt_fault_lock */
+  pthread_mutex_t fault_lock;
+  /* Nonzero while the fault thread holds fault_lock, so that responses for pages go to fault_queue */
+  int faulting;
 
   /* The id of this machine. Will be 0 if this is the manager. */
   uint32_t self_id;
   int num_peers;
+  /* The number of machines in the cluster, including those that have not connected yet. Each machine is
+     the home for the shared pages whose index modulo num_machines is its id. */
+  uint32_t num_machines;
   /* Each bit represents whether a peer is waiting to be connected. */
   uint32_t peers_to_be_connected;
   cdt_peer_t peers[CDT_MAX_MACHINES];
+  /* The machine each shared page was last known to live on, or -1 if the page is at the home given by
+     its index. Always accurate for the pages this machine is the home for, and at a page's previous
+     home this is a forwarding pointer to the machine the page moved to. */
+  int homes[CDT_MAX_SHARED_PAGES];
+  /* The log2 of the number of pages in the coherence block each shared page belongs to, which every
+     machine learns when the page is allocated. */
+  uint8_t block_shifts[CDT_MAX_SHARED_PAGES];
+  /* Set for the shared pages made immutable by cdt_freeze, which every machine is told about. Copies of
+     frozen pages are never invalidated or leased, and writing to them is an error. */
+  uint8_t frozen[CDT_MAX_SHARED_PAGES];
+  /* Set for this machine's copies of the shared pages marked by cdt_fault_mark_frozen, which are read in
+     place like those of frozen pages. Only reads look at it, so the copies are still written, leased and
+     invalidated as usual. */
+  uint8_t marked[CDT_MAX_SHARED_PAGES];
+  /* Set for the shared pages allocated with CDT_MALLOC_HALO, which every machine is told about. Each
+     machine maps its own copy of a halo page the first time it touches it, and no home keeps track of it. */
+  uint8_t halo[CDT_MAX_SHARED_PAGES];
+  /* Entries are only valid for the pages this machine is not the home for. */
   cdt_host_pte_t shared_pagetable[CDT_MAX_SHARED_PAGES];
-  /* This array is only valid if the host is the manager. */
+  /* Entries are only valid for the pages this machine is the home for. */
   cdt_manager_pte_t manager_pagetable[CDT_MAX_SHARED_PAGES];
+  /* This is only valid if the host is the manager, which hands out shared pages. */
   unsigned int manager_first_unallocated_pg_idx;
+  /* The pages this machine has twinned or, as their home, written since they were last released */
+  cdt_host_page_list_t release_pages;
+  /* The pages this machine is the home for that each machine has been left a stale copy of, which it is
+     told about at its next acquire */
+  cdt_host_page_list_t write_notices[CDT_MAX_MACHINES];
+  cdt_host_lock_t locks[CDT_MAX_LOCKS];
+  /* This array is only valid if the host is the manager. */
+  cdt_manager_lock_t manager_locks[CDT_MAX_LOCKS];
+  /* The number of objects this machine has created. Object ids are handed out so that the home of the
+     object with a given id is that id modulo num_machines. */
+  uint32_t object_counter;
+  /* Entries are only valid for the objects this machine is not the home for. */
+  cdt_host_object_t objects[CDT_MAX_OBJECTS];
+  /* Entries are only valid for the objects this machine is the home for. */
+  cdt_manager_object_t manager_objects[CDT_MAX_OBJECTS];
+  /* The halo slices this machine sends and receives at each exchange, which only its thread uses */
+  cdt_halo_slice_t halo_sends[CDT_MAX_HALO_SLICES];
+  int num_halo_sends;
+  cdt_halo_slice_t halo_receives[CDT_MAX_HALO_SLICES];
+  int num_halo_receives;
+  cdt_host_halo_inbox_t halo_inboxes[CDT_MAX_MACHINES];
 
   pthread_mutex_t thread_lock;
   uint32_t thread_counter;
@@ -90,6 +334,104 @@ int cdt_host_start();
  */
 cdt_host_t *cdt_get_host();
 
+/**
+ * Get the id of the machine this machine believes is the home for the shared page with index idx.
+ * The answer is only guaranteed to be current if it is this machine.
+ */
+uint32_t cdt_host_home(const cdt_host_t *host, int idx);
+
+/**
+ * Get the current time in milliseconds, for timing leases. Only comparable between machines in how
+ * much time has passed, not as absolute times.
+ */
+uint64_t cdt_host_now();
+
+/**
+ * Get the first page and number of pages of the coherence block the shared page with index idx belongs to.
+ */
+void cdt_host_block(const cdt_host_t *host, int idx, int *start, int *num_pages);
+
+/**
+ * Add the shared page with index idx to list, unless it is already in it.
+ */
+void cdt_host_list_page(cdt_host_page_list_t *list, uint32_t idx);
+
+/**
+ * Remove the pages in the given ranges from list and store them in pages, which must have room for
+ * CDT_MAX_SHARED_PAGES entries. Every page is removed if ranges is NULL.
+ *
+ * Returns the number of pages removed.
+ */
+uint32_t cdt_host_take_pages(cdt_host_page_list_t *list, uint32_t *pages, const cdt_page_range_t *ranges,
+                             uint32_t num_ranges);
+
+/**
+ * Start timing the lease on this machine's copy of the shared page with index idx, which is dropped by
+ * the lease thread once the time given by cdt_host_now reaches expiry. An expiry of 0 means the copy is
+ * not leased.
+ *
+ * The PTE in shared_pagetable for idx MUST be locked before calling this.
+ */
+void cdt_host_start_lease(cdt_host_t *host, int idx, uint64_t expiry);
+
+/**
+ * Park a request from sender_id, which is handed back to the worker thread for sender_id once the time
+ * given by cdt_host_now reaches due.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_host_park(cdt_host_t *host, uint32_t sender_id, const cdt_packet_t *packet, uint64_t due);
+
+/**
+ * Get the lock of the PTE this machine uses for the shared page with index idx, which is the entry in
+ * manager_pagetable if this machine is the page's home and the entry in shared_pagetable otherwise.
+ */
+pthread_mutex_t* cdt_host_page_lock(cdt_host_t *host, int idx);
+
+/**
+ * Lock the PTE this machine uses for the shared page with index idx, taking into account that the
+ * page's home may move to or away from this machine while waiting for the lock.
+ *
+ * Returns the lock that is now held.
+ */
+pthread_mutex_t* cdt_host_lock_page(cdt_host_t *host, int idx);
+
+/**
+ * Get the queue on which the calling thread receives the responses to the requests it sends on behalf of
+ * requester_id. Requests this machine sends for itself are answered on its own task queue, except for those
+ * of the fault thread, which are answered on host->fault_queue.
+ */
+mqd_t cdt_host_response_queue(cdt_host_t *host, uint32_t requester_id);
+
+/**
+ * Place a local copy of the shared page at shared_va and protect it according to access, which is
+ * one of INVALID_PAGE, READ_ONLY_PAGE, and READ_WRITE_PAGE. Local copies live directly in the shared
+ * region, so once mapped the page can be accessed with regular loads and stores.
+ * 
+ * If contents is NULL the page is zero filled, if it is shared_va the copy already there is kept, and
+ * otherwise PAGESIZE bytes are copied from contents.
+ * 
+ * Returns a pointer to the local copy, or NULL on error.
+ */
+void* cdt_host_map_page(uint64_t shared_va, const void *contents, int access);
+
+/**
+ * Apply a diff of size bytes created by cdt_diff_encode to the local copy of the shared page at shared_va,
+ * and protect it according to access. The changes are made to a copy of the page that replaces it once
+ * they are all in place.
+ *
+ * Returns a pointer to the local copy, or NULL on error, including if the diff is malformed.
+ */
+void* cdt_host_patch_page(uint64_t shared_va, const void *diff, size_t size, int access);
+
+/**
+ * Change the protection of the local copy of the shared page at shared_va to match access.
+ * Pass INVALID_PAGE to make the page inaccessible on this machine.
+ * 
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_host_protect_page(uint64_t shared_va, int access);
+
 /**
  * Wait for the host thread to finish.
  * 
@@ -0,0 +1,43 @@
+#ifndef COORDINATE_LOCK_H
+#define COORDINATE_LOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+typedef struct cdt_lock_t {
+  pthread_mutex_t local_lock;
+
+  uint32_t remote_id;
+} cdt_lock_t;
+
+/**
+ * Initialize a lock that can be acquired by any thread.
+ * 
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_lock_init(cdt_lock_t *lock);
+
+/**
+ * Bind the shared memory range of size bytes starting at addr to lock. Acquiring the lock brings the
+ * pages of every range bound to it up to date, and releasing it publishes the writes made to them.
+ * 
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_lock_bind(cdt_lock_t *lock, void *addr, size_t size);
+
+/**
+ * Acquire lock, waiting until it is free.
+ * 
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_lock_acquire(cdt_lock_t *lock);
+
+/**
+ * Release lock, which MUST be held by the calling thread.
+ * 
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_lock_release(cdt_lock_t *lock);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef COORDINATE_OBJECT_H
+#define COORDINATE_OBJECT_H
+
+#include <stdint.h>
+
+/* The largest shared object, which is one cache line */
+#define CDT_MAX_OBJECT_SIZE 64
+
+/* Errors reported by an object's home, which object operations return as they are */
+/* The home has no object with this id, as when the cdt_object_t was never initialized */
+#define CDT_OBJECT_UNKNOWN 1
+/* The home could not apply the operation, such as when it could not invalidate the cached copies */
+#define CDT_OBJECT_FAILED 2
+/* The object is not the size the operation needs, which is the only error the caller can correct */
+#define CDT_OBJECT_WRONG_SIZE 3
+
+/**
+ * A small shared object, such as a counter, a queue head or a flag, that is kept coherent on its own
+ * rather than with the rest of the page it would otherwise share. The object is homed on the machine
+ * that created it, other machines cache copies of it until it is next updated, and updates are applied
+ * at the home, so unrelated objects never invalidate each other.
+ *
+ * A cdt_object_t may be copied freely, including through shared memory to other machines.
+ */
+typedef struct cdt_object_t {
+  void *local_data;
+
+  uint32_t remote_id;
+  uint32_t size;
+} cdt_object_t;
+
+/**
+ * Initialize an object of size bytes, which must be at most CDT_MAX_OBJECT_SIZE. Its contents start
+ * out zeroed.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_object_init(cdt_object_t *object, uint32_t size);
+
+/**
+ * Copy the current contents of object into dest.
+ *
+ * Returns 0 on success, one of the CDT_OBJECT_ errors if the home rejected it, or -1 on any other error.
+ */
+int cdt_object_read(const cdt_object_t *object, void *dest);
+
+/**
+ * Replace the contents of object with those of src.
+ *
+ * Returns 0 on success, one of the CDT_OBJECT_ errors if the home rejected it, or -1 on any other error.
+ */
+int cdt_object_write(const cdt_object_t *object, const void *src);
+
+/**
+ * Atomically add value to object, which must be the size of an int64_t, and store the value it held
+ * before in old if old is not NULL.
+ *
+ * Returns 0 on success, one of the CDT_OBJECT_ errors if the home rejected it, or -1 on any other error.
+ */
+int cdt_object_fetch_add(const cdt_object_t *object, int64_t value, int64_t *old);
+
+/**
+ * Wait until object, which must be the size of an int64_t, holds at least value. The calling thread
+ * sleeps until the update that brings the object there, rather than polling it.
+ *
+ * Returns 0 on success, one of the CDT_OBJECT_ errors if the home rejected it, or -1 on any other error.
+ */
+int cdt_object_wait(const cdt_object_t *object, int64_t value);
+
+#endif
@@ -4,8 +4,13 @@
 #include "util.h"
 
 typedef struct cdt_thread_t cdt_thread_t;
+typedef struct cdt_page_range_t cdt_page_range_t;
 
-#define CDT_PACKET_DATA_SIZE (PAGESIZE + sizeof(uint32_t))
+/* Large enough for a page along with the few words describing it, such as its index, flags and version */
+#define CDT_PACKET_DATA_SIZE (PAGESIZE + 4 * sizeof(uint32_t))
+
+/* Read, write and range responses leave out pages that are all zeros, and their parse functions give a
+   NULL page for them, which cdt_host_map_page zero fills. */
 
 enum cdt_packet_type {
   CDT_PACKET_SELF_IDENTIFY         = 0,
@@ -17,6 +22,8 @@ enum cdt_packet_type {
 
   CDT_PACKET_ALLOC_REQ             = 10,
   CDT_PACKET_ALLOC_RESP            = 12,
+
+  CDT_PACKET_PEER_READY            = 14,
   
   CDT_PACKET_THREAD_CREATE_REQ     = 20,
   CDT_PACKET_THREAD_CREATE_RESP    = 21,
@@ -36,6 +43,65 @@ enum cdt_packet_type {
   CDT_PACKET_WRITE_DEMOTE_RESP     = 37,
   CDT_PACKET_WRITE_INVALIDATE_REQ  = 38,
   CDT_PACKET_WRITE_INVALIDATE_RESP = 39,
+
+  CDT_PACKET_DIFF_REQ              = 40,
+  CDT_PACKET_DIFF_RESP             = 41,
+
+  CDT_PACKET_ACQUIRE_REQ           = 42,
+  CDT_PACKET_ACQUIRE_RESP          = 43,
+
+  CDT_PACKET_LOCK_CREATE_REQ       = 44,
+  CDT_PACKET_LOCK_CREATE_RESP      = 45,
+  CDT_PACKET_LOCK_BIND_REQ         = 46,
+  CDT_PACKET_LOCK_BIND_RESP        = 47,
+  CDT_PACKET_LOCK_ACQUIRE_REQ      = 48,
+  CDT_PACKET_LOCK_ACQUIRE_RESP     = 49,
+  CDT_PACKET_LOCK_RELEASE_REQ      = 50,
+  CDT_PACKET_LOCK_RELEASE_RESP     = 51,
+
+  CDT_PACKET_HOME_ALLOC_REQ        = 52,
+  CDT_PACKET_HOME_ALLOC_RESP       = 53,
+  CDT_PACKET_HOME_MOVED            = 55,
+
+  CDT_PACKET_WRITE_FORWARD_REQ     = 56,
+  CDT_PACKET_WRITE_FORWARD_RESP    = 57,
+
+  CDT_PACKET_READ_FORWARD_REQ      = 58,
+
+  CDT_PACKET_READ_RANGE_REQ        = 60,
+  CDT_PACKET_READ_RANGE_RESP       = 61,
+  CDT_PACKET_WRITE_RANGE_REQ       = 62,
+  CDT_PACKET_WRITE_RANGE_RESP      = 63,
+
+  CDT_PACKET_OBJECT_READ_REQ       = 64,
+  CDT_PACKET_OBJECT_READ_RESP      = 65,
+  CDT_PACKET_OBJECT_UPDATE_REQ     = 66,
+  CDT_PACKET_OBJECT_UPDATE_RESP    = 67,
+  CDT_PACKET_OBJECT_INVALIDATE_REQ = 68,
+  CDT_PACKET_OBJECT_INVALIDATE_RESP = 69,
+
+  CDT_PACKET_WRITE_UPDATE_REQ      = 70,
+  CDT_PACKET_WRITE_UPDATE_RESP     = 71,
+
+  CDT_PACKET_UPGRADE_REQ           = 72,
+  CDT_PACKET_UPGRADE_RESP          = 73,
+  CDT_PACKET_READ_CURRENT          = 75,
+
+  CDT_PACKET_FREEZE_REQ            = 76,
+  CDT_PACKET_FREEZE_RESP           = 77,
+
+  CDT_PACKET_READ_INVALIDATE_RANGE_REQ  = 78,
+  CDT_PACKET_READ_INVALIDATE_RANGE_RESP = 79,
+
+  CDT_PACKET_BROADCAST_REQ         = 80,
+  CDT_PACKET_BROADCAST_RESP        = 81,
+  CDT_PACKET_REPLICA_PUSH_REQ      = 82,
+  CDT_PACKET_REPLICA_PUSH_RESP     = 83,
+
+  CDT_PACKET_HALO_PUSH_REQ         = 84,
+
+  CDT_PACKET_OBJECT_WAIT_REQ       = 86,
+  CDT_PACKET_OBJECT_WAIT_RESP      = 87,
 };
 
 /**
@@ -55,19 +121,28 @@ uint32_t cdt_packet_response_get_requester(cdt_packet_t *packet);
 int cdt_packet_self_identify_create(cdt_packet_t *packet, const char *address, const char *port);
 void cdt_packet_self_identify_parse(cdt_packet_t *packet, char **address, char **port);
 
-void cdt_packet_peer_id_assign_create(cdt_packet_t *packet, uint32_t peer_id);
-void cdt_packet_peer_id_assign_parse(cdt_packet_t *packet, uint32_t *peer_id);
+/**
+ * Create a packet giving a new peer its id, the number of machines, and the compression mode to send
+ * packets with.
+ */
+void cdt_packet_peer_id_assign_create(cdt_packet_t *packet, uint32_t peer_id, uint32_t num_machines, uint32_t compression);
+void cdt_packet_peer_id_assign_parse(cdt_packet_t *packet, uint32_t *peer_id, uint32_t *num_machines, uint32_t *compression);
 
 void cdt_packet_peer_id_confim_create(cdt_packet_t *packet);
 
+/**
+ * Create a packet telling the manager that this machine is connected to every other machine.
+ */
+void cdt_packet_peer_ready_create(cdt_packet_t *packet);
+
 int cdt_packet_new_peer_create(cdt_packet_t *packet, uint32_t peer_id, const char *address, const char *port);
 void cdt_packet_new_peer_parse(cdt_packet_t *packet, uint32_t *peer_id, char **address, char **port);
 
 void cdt_packet_existing_peer_create(cdt_packet_t *packet, uint32_t peer_id);
 void cdt_packet_existing_peer_parse(cdt_packet_t *packet, uint32_t *peer_id);
 
-void cdt_packet_alloc_req_create(cdt_packet_t *packet, uint32_t peer_id, uint32_t num_pages);
-void cdt_packet_alloc_req_parse(cdt_packet_t *packet, uint32_t *peer_id, uint32_t *num_pages);
+void cdt_packet_alloc_req_create(cdt_packet_t *packet, uint32_t peer_id, uint32_t num_pages, uint32_t flags);
+void cdt_packet_alloc_req_parse(cdt_packet_t *packet, uint32_t *peer_id, uint32_t *num_pages, uint32_t *flags);
 
 void cdt_packet_alloc_resp_create(cdt_packet_t *packet, uint64_t page, uint32_t num_pages);
 void cdt_packet_alloc_resp_parse(cdt_packet_t *packet, uint64_t *page, uint32_t *num_pages);
@@ -90,11 +165,77 @@ void cdt_packet_thread_join_req_parse(cdt_packet_t *packet, cdt_thread_t *thread
 void cdt_packet_thread_join_resp_create(cdt_packet_t *packet, uint32_t status, uint64_t return_value);
 void cdt_packet_thread_join_resp_parse(cdt_packet_t *packet, uint32_t *status, uint64_t *return_value);
 
-void cdt_packet_read_req_create(cdt_packet_t *packet, uint64_t page_addr);
-void cdt_packet_read_req_parse(cdt_packet_t *packet, uint64_t *page_addr);
+/**
+ * Create a request for a read-only copy of the page at page_addr. version is that of the stale copy the
+ * requester still holds, or 0 if it has none.
+ */
+void cdt_packet_read_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t version);
+void cdt_packet_read_req_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *version);
+
+/**
+ * Create a response granting R/O access to page. held is how many milliseconds the home spent on the
+ * request before answering it, which the requester adds to its lease if the page is leased. version
+ * is that of the page being sent, or 0 if it is not known.
+ */
+void cdt_packet_read_resp_create(cdt_packet_t *packet, void *page, uint32_t flags, uint32_t held, uint32_t version);
+void cdt_packet_read_resp_parse(cdt_packet_t *packet, void **page, uint32_t *flags, uint32_t *held, uint32_t *version);
+
+/**
+ * Create a response granting R/O access to the page at page_addr to a machine whose stale copy has the
+ * page's current version, so the page itself is not sent. held is as for cdt_packet_read_resp_create.
+ */
+void cdt_packet_read_current_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t held);
+void cdt_packet_read_current_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *held);
+
+/**
+ * Create a request to make the num_pages shared pages starting at index start immutable. If copies is
+ * zero, the receiver freezes the pages it is the home for, and otherwise it keeps its copies of the
+ * other pages for good, which is only asked once every home has frozen its pages.
+ */
+void cdt_packet_freeze_req_create(cdt_packet_t *packet, uint32_t start, uint32_t num_pages, uint32_t copies);
+void cdt_packet_freeze_req_parse(cdt_packet_t *packet, uint32_t *start, uint32_t *num_pages, uint32_t *copies);
+
+void cdt_packet_freeze_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t status);
+void cdt_packet_freeze_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *status);
+
+/**
+ * Create a request to push read-only copies of the num_pages shared pages starting at index start that
+ * the receiver is the home for to every machine.
+ */
+void cdt_packet_broadcast_req_create(cdt_packet_t *packet, uint32_t start, uint32_t num_pages);
+void cdt_packet_broadcast_req_parse(cdt_packet_t *packet, uint32_t *start, uint32_t *num_pages);
+
+void cdt_packet_broadcast_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t status);
+void cdt_packet_broadcast_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *status);
+
+/**
+ * Create a request carrying a read-only copy of the page with index idx down the broadcast tree rooted
+ * at its home root, on behalf of requester_id. The last one from root has the index CDT_PACKET_RANGE_DONE,
+ * in which case page is ignored, and every machine answers it with a CDT_PACKET_REPLICA_PUSH_RESP to root.
+ */
+void cdt_packet_replica_push_req_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t root, uint32_t idx, void *page,
+                                        uint32_t flags, uint32_t version);
+void cdt_packet_replica_push_req_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *root, uint32_t *idx, void **page,
+                                       uint32_t *flags, uint32_t *version);
+
+/**
+ * Create a response from machine_id to a replica push from root, which either reports that the page with
+ * index idx was not taken, or has the index CDT_PACKET_RANGE_DONE once every page has been handled.
+ */
+void cdt_packet_replica_push_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t root, uint32_t machine_id,
+                                         uint32_t idx);
+void cdt_packet_replica_push_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *root, uint32_t *machine_id,
+                                        uint32_t *idx);
 
-void cdt_packet_read_resp_create(cdt_packet_t *packet, void *page);
-void cdt_packet_read_resp_parse(cdt_packet_t *packet, void **page);
+/* The most bytes of halo slices carried by a single halo push request. */
+#define CDT_PACKET_HALO_MAX_SIZE (CDT_PACKET_DATA_SIZE - 2 * sizeof(uint32_t))
+
+/**
+ * Create a request carrying size bytes of the halo slices the sender exchanges with the receiver, starting
+ * offset bytes into the total bytes of all of them. No response is sent.
+ */
+void cdt_packet_halo_push_req_create(cdt_packet_t *packet, uint32_t offset, uint32_t total, const void *data, uint32_t size);
+void cdt_packet_halo_push_req_parse(cdt_packet_t *packet, uint32_t *offset, uint32_t *total, void **data, uint32_t *size);
 
 void cdt_packet_read_invalidate_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id);
 void cdt_packet_read_invalidate_req_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id);
@@ -102,22 +243,266 @@ void cdt_packet_read_invalidate_req_parse(cdt_packet_t *packet, uint64_t *page_a
 void cdt_packet_read_invalidate_resp_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id);
 void cdt_packet_read_invalidate_resp_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id);
 
+/**
+ * Create a request to invalidate the read-only copies of each of the num_pages pages starting at index
+ * start whose bit is set in wanted, on behalf of requester_id. num_pages may be at most
+ * CDT_PACKET_RANGE_MAX_PAGES. A single response is sent once every copy has been invalidated.
+ */
+void cdt_packet_read_invalidate_range_req_create(cdt_packet_t *packet, uint32_t start, uint32_t num_pages, const uint8_t *wanted,
+                                                 uint32_t requester_id);
+void cdt_packet_read_invalidate_range_req_parse(cdt_packet_t *packet, uint32_t *start, uint32_t *num_pages, uint8_t **wanted,
+                                                uint32_t *requester_id);
+
+void cdt_packet_read_invalidate_range_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t start);
+void cdt_packet_read_invalidate_range_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *start);
+
 void cdt_packet_write_req_create(cdt_packet_t *packet, uint64_t page_addr);
 void cdt_packet_write_req_parse(cdt_packet_t *packet, uint64_t *page_addr);
 
-void cdt_packet_write_resp_create(cdt_packet_t *packet, void *page);
-void cdt_packet_write_resp_parse(cdt_packet_t *packet, void **page);
+/**
+ * Create a response granting R/W access to page. If home is nonzero, the requester also becomes the
+ * page's home. If base is nonzero, the home keeps page as it is until the requester gives it back, so
+ * the requester may send back only what it changed.
+ */
+void cdt_packet_write_resp_create(cdt_packet_t *packet, void *page, uint32_t flags, uint32_t home, uint32_t base);
+void cdt_packet_write_resp_parse(cdt_packet_t *packet, void **page, uint32_t *flags, uint32_t *home, uint32_t *base);
+
+/**
+ * Create a request for R/W access to the page at page_addr from a machine that holds a read-only copy
+ * of it. The home answers with a CDT_PACKET_UPGRADE_RESP if that copy is still current, and with a
+ * CDT_PACKET_WRITE_RESP carrying the page otherwise.
+ */
+void cdt_packet_upgrade_req_create(cdt_packet_t *packet, uint64_t page_addr);
+void cdt_packet_upgrade_req_parse(cdt_packet_t *packet, uint64_t *page_addr);
+
+/**
+ * Create a response granting R/W access to the page at page_addr to a machine whose read-only copy is
+ * current, so the page itself is not sent. home and base have the same meaning as for
+ * cdt_packet_write_resp_create.
+ */
+void cdt_packet_upgrade_resp_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t home, uint32_t base);
+void cdt_packet_upgrade_resp_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *home, uint32_t *base);
 
 void cdt_packet_write_demote_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id);
 void cdt_packet_write_demote_req_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id);
 
-void cdt_packet_write_demote_resp_create(cdt_packet_t *packet, void *page, uint32_t requester_id);
-void cdt_packet_write_demote_resp_parse(cdt_packet_t *packet, void **page, uint32_t *requester_id);
+/**
+ * Create a response giving the home the contents of page. If base is not NULL, it is the copy of the page
+ * that was granted by the home, which the home still holds, and only the words that differ from it are
+ * sent when that is smaller than the page.
+ */
+void cdt_packet_write_demote_resp_create(cdt_packet_t *packet, void *page, const void *base, uint32_t requester_id);
+/**
+ * Parse a response created by cdt_packet_write_demote_resp_create. If size is PAGESIZE, data is the page,
+ * otherwise it is a diff to apply to the copy the home holds.
+ */
+void cdt_packet_write_demote_resp_parse(cdt_packet_t *packet, void **data, uint32_t *size, uint32_t *requester_id);
 
 void cdt_packet_write_invalidate_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id);
 void cdt_packet_write_invalidate_req_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id);
 
-void cdt_packet_write_invalidate_resp_create(cdt_packet_t *packet, void *page, uint32_t requester_id);
-void cdt_packet_write_invalidate_resp_parse(cdt_packet_t *packet, void **page, uint32_t *requester_id);
+/**
+ * Like cdt_packet_write_demote_resp_create, for a writer giving up its copy of the page.
+ */
+void cdt_packet_write_invalidate_resp_create(cdt_packet_t *packet, void *page, const void *base, uint32_t requester_id);
+void cdt_packet_write_invalidate_resp_parse(cdt_packet_t *packet, void **data, uint32_t *size, uint32_t *requester_id);
+
+/**
+ * Create a request asking the writer of the page at page_addr to give the page and R/W access directly to
+ * requester_id, which also becomes the page's home if home is nonzero.
+ */
+void cdt_packet_write_forward_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id, uint32_t home);
+void cdt_packet_write_forward_req_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id, uint32_t *home);
+
+/**
+ * Create a packet telling the home that requester_id now holds the page at page_addr. clean is nonzero
+ * if the previous writer was given the page on a read and never wrote to it.
+ */
+void cdt_packet_write_forward_resp_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id, uint32_t clean);
+void cdt_packet_write_forward_resp_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id, uint32_t *clean);
+
+/**
+ * Create a request asking a machine holding a read-only copy of the page at page_addr to send it to
+ * requester_id in a CDT_PACKET_READ_RESP on behalf of the home.
+ */
+void cdt_packet_read_forward_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id);
+void cdt_packet_read_forward_req_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id);
+
+/* The most pages that can be asked for in a single range request. */
+#define CDT_PACKET_RANGE_MAX_PAGES 1024
+/* The page index of the range response that ends the home's answer to a range request. */
+#define CDT_PACKET_RANGE_DONE 0xffffffff
+
+/**
+ * Create a request for R/O copies of the pages from start to start + num_pages whose bits are set in
+ * wanted. The home answers with a CDT_PACKET_READ_RANGE_RESP for each of those pages it can send
+ * right away, followed by one with the index CDT_PACKET_RANGE_DONE.
+ */
+void cdt_packet_read_range_req_create(cdt_packet_t *packet, uint32_t start, uint32_t num_pages, const uint8_t *wanted);
+void cdt_packet_read_range_req_parse(cdt_packet_t *packet, uint32_t *start, uint32_t *num_pages, uint8_t **wanted);
+
+/**
+ * Create a response carrying the page with index idx, or ending the response to a range request if
+ * idx is CDT_PACKET_RANGE_DONE, in which case page is ignored.
+ */
+void cdt_packet_read_range_resp_create(cdt_packet_t *packet, uint32_t idx, void *page, uint32_t flags);
+void cdt_packet_read_range_resp_parse(cdt_packet_t *packet, uint32_t *idx, void **page, uint32_t *flags);
+
+/**
+ * Create a request for R/W access to the pages from start to start + num_pages whose bits are set in
+ * wanted. The home answers with a CDT_PACKET_WRITE_RANGE_RESP for each of those pages it can hand
+ * over right away, followed by one with the index CDT_PACKET_RANGE_DONE. If overwrite is nonzero the
+ * requester is about to write every byte of the pages, so single-writer pages are granted without
+ * their contents.
+ */
+void cdt_packet_write_range_req_create(cdt_packet_t *packet, uint32_t start, uint32_t num_pages, const uint8_t *wanted,
+                                      uint32_t overwrite);
+void cdt_packet_write_range_req_parse(cdt_packet_t *packet, uint32_t *start, uint32_t *num_pages, uint8_t **wanted,
+                                     uint32_t *overwrite);
+
+/**
+ * Create a response granting R/W access to the page with index idx, or ending the response to a range
+ * request if idx is CDT_PACKET_RANGE_DONE, in which case page is ignored. The home always keeps page as
+ * it is until a single-writer page is given back, as with the base flag of a write response. A NULL
+ * page is sent like a page of zeros.
+ */
+void cdt_packet_write_range_resp_create(cdt_packet_t *packet, uint32_t idx, void *page, uint32_t flags);
+void cdt_packet_write_range_resp_parse(cdt_packet_t *packet, uint32_t *idx, void **page, uint32_t *flags);
+
+/**
+ * Encode the differences between page and twin, starting at word index *word. If the diff does not fit
+ * in a single packet, *word is left at the first word that still has to be sent.
+ */
+void cdt_packet_diff_req_create(cdt_packet_t *packet, uint64_t page_addr, const void *page, const void *twin, uint32_t *word);
+void cdt_packet_diff_req_parse(cdt_packet_t *packet, uint64_t *page_addr, void **diff, uint32_t *diff_size);
+
+/**
+ * Create a response to a diff request. status is nonzero if the home could not merge the diff.
+ */
+void cdt_packet_diff_resp_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id, uint32_t status);
+void cdt_packet_diff_resp_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id, uint32_t *status);
+
+/* The most bytes of diff carried by a single diff or write update request. */
+#define CDT_PACKET_DIFF_MAX_SIZE (CDT_PACKET_DATA_SIZE - sizeof(uint64_t) - sizeof(uint32_t))
+
+/**
+ * Create a request pushing diff_size bytes of diff, made by requester_id, to a machine holding a copy
+ * of the write-update page at page_addr.
+ */
+void cdt_packet_write_update_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id, const void *diff, uint32_t diff_size);
+void cdt_packet_write_update_req_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id, void **diff, uint32_t *diff_size);
+
+void cdt_packet_write_update_resp_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id);
+void cdt_packet_write_update_resp_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id);
+
+/**
+ * Create a request for the pages in the given ranges that the requester holds stale copies of.
+ */
+void cdt_packet_acquire_req_create(cdt_packet_t *packet, const cdt_page_range_t *ranges, uint32_t num_ranges);
+void cdt_packet_acquire_req_parse(cdt_packet_t *packet, cdt_page_range_t *ranges, uint32_t *num_ranges);
+
+/* The most page indices that fit in a single acquire response. */
+#define CDT_PACKET_ACQUIRE_MAX_PAGES ((CDT_PACKET_DATA_SIZE - 3 * sizeof(uint32_t)) / sizeof(uint32_t))
+
+/**
+ * Create a response carrying the indices of num_pages pages the requester must invalidate. more is
+ * nonzero if further responses follow this one.
+ */
+void cdt_packet_acquire_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t more, const uint32_t *pages, uint32_t num_pages);
+void cdt_packet_acquire_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *more, uint32_t **pages, uint32_t *num_pages);
+
+void cdt_packet_lock_create_req_create(cdt_packet_t *packet);
+
+void cdt_packet_lock_create_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t lock_id);
+void cdt_packet_lock_create_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *lock_id);
+
+void cdt_packet_lock_bind_req_create(cdt_packet_t *packet, uint32_t lock_id, uint32_t start, uint32_t num_pages);
+void cdt_packet_lock_bind_req_parse(cdt_packet_t *packet, uint32_t *lock_id, uint32_t *start, uint32_t *num_pages);
+
+void cdt_packet_lock_bind_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t status);
+void cdt_packet_lock_bind_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *status);
+
+void cdt_packet_lock_acquire_req_create(cdt_packet_t *packet, uint32_t lock_id);
+void cdt_packet_lock_acquire_req_parse(cdt_packet_t *packet, uint32_t *lock_id);
+
+/**
+ * Create a response granting a lock, carrying the ranges bound to the lock.
+ */
+void cdt_packet_lock_acquire_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t status,
+                                         const cdt_page_range_t *ranges, uint32_t num_ranges);
+void cdt_packet_lock_acquire_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *status,
+                                        cdt_page_range_t *ranges, uint32_t *num_ranges);
+
+void cdt_packet_lock_release_req_create(cdt_packet_t *packet, uint32_t lock_id);
+void cdt_packet_lock_release_req_parse(cdt_packet_t *packet, uint32_t *lock_id);
+
+void cdt_packet_lock_release_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t status);
+void cdt_packet_lock_release_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *status);
+
+/**
+ * Create a request telling the home of some of the pages from start to start + num_pages that they were
+ * allocated by allocator_id with the given cdt_malloc_flags.
+ */
+void cdt_packet_home_alloc_req_create(cdt_packet_t *packet, uint32_t allocator_id, uint32_t start, uint32_t num_pages, uint32_t flags);
+void cdt_packet_home_alloc_req_parse(cdt_packet_t *packet, uint32_t *allocator_id, uint32_t *start, uint32_t *num_pages, uint32_t *flags);
+
+void cdt_packet_home_alloc_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t status);
+void cdt_packet_home_alloc_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *status);
+
+/* The home given by a home moved response for a page that is not allocated at its home, which the
+   requester treats as an error */
+#define CDT_PACKET_NO_HOME 0xffffffff
+
+/**
+ * Create a response to a read or write request sent to a machine that is no longer the home of the
+ * page at page_addr, pointing the requester to the machine the page moved to.
+ */
+void cdt_packet_home_moved_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t home);
+void cdt_packet_home_moved_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *home);
+
+/* The ways an object update request can change an object */
+#define CDT_PACKET_OBJECT_STORE 0
+#define CDT_PACKET_OBJECT_ADD 1
+
+void cdt_packet_object_read_req_create(cdt_packet_t *packet, uint32_t object_id);
+void cdt_packet_object_read_req_parse(cdt_packet_t *packet, uint32_t *object_id);
+
+/**
+ * Create a response carrying the size bytes of data the object with id object_id holds.
+ */
+void cdt_packet_object_read_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t object_id, uint32_t status,
+                                        const void *data, uint32_t size);
+void cdt_packet_object_read_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *object_id, uint32_t *status,
+                                       void **data, uint32_t *size);
+
+/**
+ * Create a request to apply op, one of CDT_PACKET_OBJECT_STORE and CDT_PACKET_OBJECT_ADD, with the size
+ * bytes of data as its operand to the object with id object_id.
+ */
+void cdt_packet_object_update_req_create(cdt_packet_t *packet, uint32_t object_id, uint32_t op, const void *data, uint32_t size);
+void cdt_packet_object_update_req_parse(cdt_packet_t *packet, uint32_t *object_id, uint32_t *op, void **data, uint32_t *size);
+
+/**
+ * Create a response to an update request carrying the size bytes of data the object held before it.
+ */
+void cdt_packet_object_update_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t object_id, uint32_t status,
+                                          const void *data, uint32_t size);
+void cdt_packet_object_update_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *object_id, uint32_t *status,
+                                         void **data, uint32_t *size);
+
+void cdt_packet_object_invalidate_req_create(cdt_packet_t *packet, uint32_t object_id, uint32_t requester_id);
+void cdt_packet_object_invalidate_req_parse(cdt_packet_t *packet, uint32_t *object_id, uint32_t *requester_id);
+
+void cdt_packet_object_invalidate_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t object_id);
+void cdt_packet_object_invalidate_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *object_id);
+
+/**
+ * Create a request to be answered once the object with id object_id, which holds an int64_t, is at least value.
+ */
+void cdt_packet_object_wait_req_create(cdt_packet_t *packet, uint32_t object_id, int64_t value);
+void cdt_packet_object_wait_req_parse(cdt_packet_t *packet, uint32_t *object_id, int64_t *value);
+
+void cdt_packet_object_wait_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t object_id, uint32_t status);
+void cdt_packet_object_wait_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *object_id, uint32_t *status);
 
 #endif
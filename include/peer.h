@@ -7,6 +7,7 @@
 
 typedef struct cdt_host_t cdt_host_t;
 typedef struct cdt_manager_pte_t cdt_manager_pte_t;
+typedef struct cdt_packet_t cdt_packet_t;
 
 /**
  * Represents a peer machine in the network.
@@ -23,6 +24,10 @@ typedef struct cdt_peer_t {
 
   mqd_t task_queue;
   pthread_t worker_thread;
+  /* Requests from this peer that arrived while its worker thread was waiting for a response on
+     task_queue, which are handled before anything else is taken from the queue. */
+  cdt_packet_t *deferred;
+  uint32_t num_deferred;
 } cdt_peer_t;
 
 /**
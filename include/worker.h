@@ -16,6 +16,24 @@ typedef struct cdt_thread_t cdt_thread_t;
  */
 void* cdt_worker_thread_start(void *arg);
 
+/**
+ * Take the next packet for a peer's worker thread, preferring requests that were set aside by
+ * cdt_worker_receive_response.
+ * 
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_worker_next_task(cdt_peer_t *peer, cdt_packet_t *packet);
+
+/**
+ * Wait on a peer's task queue for a response sent on its behalf by another machine, setting aside any
+ * requests from the peer itself that arrive first.
+ * 
+ * This MUST only be called from the peer's worker thread.
+ * 
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_worker_receive_response(cdt_peer_t *peer, cdt_packet_t *packet);
+
 /**
  * Handle CDT_PACKET_THREAD_CREATE_REQ
  */
@@ -25,20 +43,113 @@ int cdt_worker_thread_create(cdt_peer_t *sender, cdt_packet_t *packet);
  * Handle CDT_PACKET_WRITE_REQ
  */
 int cdt_worker_write_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_UPGRADE_REQ
+ */
+int cdt_worker_upgrade_req(cdt_peer_t *sender, cdt_packet_t *packet);
 /**
  * Handle CDT_PACKET_WRITE_INVALIDATE_REQ
  */
 int cdt_worker_write_invalidate_req(cdt_peer_t *sender, cdt_packet_t *packet);
+/**
+ * Handle CDT_PACKET_WRITE_FORWARD_REQ
+ */
+int cdt_worker_write_forward_req(cdt_peer_t *sender, cdt_packet_t *packet);
+/**
+ * Handle CDT_PACKET_READ_FORWARD_REQ
+ */
+int cdt_worker_read_forward_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_READ_RANGE_REQ
+ */
+int cdt_worker_read_range_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_WRITE_RANGE_REQ
+ */
+int cdt_worker_write_range_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Pick which machine's copy of a read-only page is sent to requester_id, going round the home and
+ * the page's other readers in turn.
+ * 
+ * The home PTE MUST be locked before calling this.
+ */
+uint32_t cdt_worker_pick_replica(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t requester_id);
+
+/**
+ * Place the contents of the page at shared_va sent back by its writer, which are either the whole page or a
+ * diff against the copy this machine holds if size is less than PAGESIZE, and protect it according to access.
+ * 
+ * Returns a pointer to the page, or NULL on error.
+ */
+void* cdt_worker_map_write_back(uint64_t shared_va, const void *data, uint32_t size, int access);
+
+/**
+ * Record that reader_id was just given a read-only copy of a page, starting its lease if the page is leased.
+ * 
+ * The home PTE MUST be locked before calling this.
+ */
+void cdt_worker_grant_lease(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t reader_id);
+
+/**
+ * Get the time at which the last lease on a page held by a machine other than this one and requester_id runs
+ * out, which is 0 if there is none, and remove those machines from the page's read set. The time is kept
+ * as the page's lease_wait, so it still counts for requests that come in after the leases were taken away.
+ * 
+ * The home PTE MUST be locked before calling this.
+ */
+uint64_t cdt_worker_revoke_leases(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t requester_id);
+
+/**
+ * Park a request for a leased page until the leases it has to wait for have run out, taking them away
+ * first if write is nonzero. The lease thread hands the request back to sender's worker once it is due.
+ *
+ * The home PTE MUST be locked before calling this.
+ *
+ * Returns 1 if the request was parked, in which case it must not be answered, 0 otherwise.
+ */
+int cdt_worker_park_for_leases(cdt_host_t *host, cdt_peer_t *sender, cdt_manager_pte_t *pte, const cdt_packet_t *packet, int write);
+
+/**
+ * Wait until the time given by cdt_host_now reaches expiry.
+ */
+void cdt_worker_wait_lease(uint64_t expiry);
+
+/**
+ * Invalidate this machine's read-only copy of the page with index idx, which its home has asked for. If
+ * the copy is still on its way here, it is dropped as soon as it arrives.
+ */
+void cdt_worker_invalidate_copy(cdt_host_t *host, int idx);
+
 /**
  * Handle CDT_PACKET_READ_INVALIDATE_REQ
  */
 int cdt_worker_read_invalidate_req(cdt_peer_t *sender, cdt_packet_t *packet);
 
+/**
+ * Handle CDT_PACKET_READ_INVALIDATE_RANGE_REQ
+ */
+int cdt_worker_read_invalidate_range_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
 /** Finds a series of unused page table entries and returns the beginning index of the PTE if successful.
   * If unsuccessful, returns -1.
-  * IMPORTANT: it returns holding the locks for every PTE in the range if successful.
+  * Every home of a page in the range has set up its PTE for the page by the time this returns.
   */
-int cdt_find_unused_pte(uint32_t peer_id, uint32_t num_pages);
+int cdt_find_unused_pte(uint32_t peer_id, uint32_t num_pages, uint32_t flags);
+
+/**
+ * Set up the home PTEs of the pages from start to start + num_pages that this machine is the home for,
+ * after they were allocated by allocator_id with the given cdt_malloc_flags.
+ */
+void cdt_worker_do_home_alloc(cdt_host_t *host, uint32_t allocator_id, uint32_t start, uint32_t num_pages, uint32_t flags);
+
+/**
+ * Handle CDT_PACKET_HOME_ALLOC_REQ
+ */
+int cdt_worker_home_alloc(cdt_peer_t *sender, cdt_packet_t *packet);
 
 /**
  * Handle CDT_PACKET_WRITE_DEMOTE_RESP
@@ -50,6 +161,279 @@ int cdt_worker_write_demote(cdt_peer_t *sender, cdt_packet_t *packet);
  */
 int cdt_worker_read_req(cdt_peer_t *sender, cdt_packet_t *packet);
 
+/**
+ * Handle CDT_PACKET_DIFF_REQ
+ */
+int cdt_worker_diff_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_ACQUIRE_REQ
+ */
+int cdt_worker_acquire_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_FREEZE_REQ
+ */
+int cdt_worker_freeze_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_BROADCAST_REQ
+ */
+int cdt_worker_broadcast_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_REPLICA_PUSH_REQ
+ */
+int cdt_worker_replica_push_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_HALO_PUSH_REQ
+ */
+int cdt_worker_halo_push_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Mark the copies of a release-consistent page held by every reader other than writer_id as stale,
+ * so that they are discarded at each reader's next acquire.
+ * 
+ * The home PTE MUST be locked before calling this.
+ */
+void cdt_worker_record_write_notice(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t writer_id);
+
+/**
+ * Count writer_id taking ownership of a single-writer page, and decide whether the page's home should
+ * move to writer_id along with the page.
+ * 
+ * The home PTE MUST be locked before calling this.
+ * 
+ * Returns 1 if the home should move to writer_id, otherwise 0.
+ */
+uint32_t cdt_worker_count_write(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t writer_id);
+
+/**
+ * Record writer_id taking ownership of a single-writer page, and mark the page as migratory if
+ * writer_id read it from the machine that last wrote it while no other machine held a copy, or as
+ * shared if other machines did.
+ *
+ * The home PTE MUST be locked before calling this.
+ */
+void cdt_worker_detect_migratory(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t writer_id);
+
+/**
+ * Give a single-writer page a new version, when a machine is given ownership of it.
+ *
+ * The home PTE MUST be locked before calling this.
+ */
+void cdt_worker_next_version(cdt_host_t *host, cdt_manager_pte_t *pte);
+
+/**
+ * Get the version of the home's copy of a page to send along with it, or 0 if copies of the page cannot
+ * be revalidated.
+ *
+ * The home PTE MUST be locked before calling this.
+ */
+uint32_t cdt_worker_copy_version(cdt_manager_pte_t *pte);
+
+/**
+ * Decide whether a read of a page by reader_id should be granted R/W ownership of the page instead,
+ * because the page is migratory and nobody else is reading it.
+ *
+ * The home PTE MUST be locked before calling this.
+ *
+ * Returns 1 if reader_id should be given ownership, otherwise 0.
+ */
+int cdt_worker_take_migratory(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t reader_id);
+
+/**
+ * Hand the home of the shared page with index idx over to new_home, which has just been sent the page
+ * with R/W access.
+ * 
+ * The home PTE MUST be locked before calling this.
+ */
+void cdt_worker_do_home_leave(cdt_host_t *host, int idx, uint32_t new_home);
+
+/**
+ * Tell the sender of a read or write request for a page this machine is not the home of where to find
+ * the page's home, which is home, or CDT_PACKET_NO_HOME if the page is not allocated.
+ * 
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_worker_home_moved(cdt_host_t *host, cdt_peer_t *sender, uint64_t page_addr, uint32_t home);
+
+/**
+ * Handle CDT_PACKET_LOCK_CREATE_REQ
+ */
+int cdt_worker_lock_create(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_LOCK_BIND_REQ
+ */
+int cdt_worker_lock_bind(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_LOCK_ACQUIRE_REQ
+ */
+int cdt_worker_lock_acquire(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_LOCK_RELEASE_REQ
+ */
+int cdt_worker_lock_release(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Allocate an entry in the manager's lock table.
+ * 
+ * Returns the ID of the new lock, or -1 on error.
+ */
+int cdt_worker_do_lock_create(cdt_host_t *host);
+
+/**
+ * Freeze the pages this machine is the home for among the num_pages shared pages starting at index start,
+ * on behalf of requester_id. Their writers are recalled, with their responses received on the task queue
+ * of requester_id.
+ *
+ * No PTE locks may be held when calling this.
+ *
+ * Returns 0 on success, -1 if a page is not allocated single-writer memory or on error.
+ */
+int cdt_worker_do_freeze(cdt_host_t *host, uint32_t requester_id, uint32_t start, uint32_t num_pages);
+
+/* The number of machines each machine passes broadcast pages on to. */
+#define CDT_WORKER_BROADCAST_FANOUT 2
+
+/**
+ * Send packet on to this machine's children in the broadcast tree rooted at root, which reaches every
+ * machine in about log(machines) steps.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_worker_forward_push(cdt_host_t *host, uint32_t root, cdt_packet_t *packet);
+
+/**
+ * Push read-only copies of the single-writer pages this machine is the home for among the num_pages
+ * shared pages starting at index start to every other machine, on behalf of requester_id, and record
+ * them all as readers. Writers are recalled first, and every response is received on the task queue of
+ * requester_id. Multiple-writer and leased pages are skipped.
+ *
+ * No PTE locks may be held when calling this.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_worker_do_broadcast(cdt_host_t *host, uint32_t requester_id, uint32_t start, uint32_t num_pages);
+
+/**
+ * Keep the copies this machine holds of the pages it is not the home for among the num_pages shared pages
+ * starting at index start for good. Only valid once every home has frozen its pages with cdt_worker_do_freeze.
+ *
+ * No PTE locks may be held when calling this.
+ */
+void cdt_worker_freeze_copies(cdt_host_t *host, uint32_t start, uint32_t num_pages);
+
+/**
+ * Bind num_pages shared pages starting at index start to a lock.
+ * 
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_worker_do_lock_bind(cdt_host_t *host, uint32_t lock_id, uint32_t start, uint32_t num_pages);
+
+/**
+ * Grant a lock to requester_id if it is free, otherwise queue requester_id to be granted the lock once it
+ * is released. Either way, the grant is delivered as a CDT_PACKET_LOCK_ACQUIRE_RESP on requester_id's task queue.
+ * 
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_worker_do_lock_acquire(cdt_host_t *host, uint32_t lock_id, uint32_t requester_id);
+
+/**
+ * Release a lock held by releaser_id, granting it to the next waiting machine if there is one.
+ * 
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_worker_do_lock_release(cdt_host_t *host, uint32_t lock_id, uint32_t releaser_id);
+
+/**
+ * Handle CDT_PACKET_WRITE_UPDATE_REQ
+ */
+int cdt_worker_write_update_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_OBJECT_READ_REQ
+ */
+int cdt_worker_object_read_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_OBJECT_UPDATE_REQ
+ */
+int cdt_worker_object_update_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_OBJECT_INVALIDATE_REQ
+ */
+int cdt_worker_object_invalidate_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Handle CDT_PACKET_OBJECT_WAIT_REQ
+ */
+int cdt_worker_object_wait_req(cdt_peer_t *sender, cdt_packet_t *packet);
+
+/**
+ * Apply op, one of CDT_PACKET_OBJECT_STORE and CDT_PACKET_OBJECT_ADD, to an object this machine is the
+ * home for on behalf of requester_id, after invalidating the copies cached by every other machine.
+ * Responses are received on the task queue of requester_id. The size bytes the object held before are
+ * copied into old, and requester_id is recorded as caching the result.
+ *
+ * Returns 0 on success, CDT_OBJECT_UNKNOWN or CDT_OBJECT_WRONG_SIZE if the update does not fit the object,
+ * or -1 on error.
+ */
+int cdt_worker_do_object_update(cdt_host_t *host, uint32_t object_id, uint32_t requester_id, uint32_t op,
+                                const void *data, uint32_t size, void *old);
+
+/**
+ * Answer requester_id once an object this machine is the home for, which holds an int64_t, is at least
+ * value, straight away if it already is. The answer is sent to the task queue of this machine's thread
+ * if requester_id is this machine. Nobody is ever blocked waiting here.
+ *
+ * Returns 0 if an answer has been or will be sent, -1 on error.
+ */
+int cdt_worker_do_object_wait(cdt_host_t *host, uint32_t object_id, uint32_t requester_id, int64_t value);
+
+/**
+ * Invalidate the copies of every reader of a page that is not also one of its writers, on behalf of requester_id.
+ * Responses are received on the task queue of requester_id.
+ * 
+ * The home PTE MUST be locked before calling this.
+ * 
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_worker_invalidate_readers(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t requester_id);
+
+/**
+ * Push a diff of changes made by requester_id to every other machine holding a copy of a write-update page.
+ * Responses are received on the task queue of requester_id.
+ *
+ * The home PTE MUST be locked before calling this.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_worker_push_update(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t requester_id, const void *diff, uint32_t diff_size);
+
+/* The most recall requests kept in flight to a single writer by cdt_worker_recall_range. */
+#define CDT_WORKER_RECALL_WINDOW 8
+
+/**
+ * Bring the home's copy of every single-writer page from start to start + num_pages whose bit is set in
+ * wanted up to date, on behalf of requester_id. Writers are demoted, or invalidated along with every
+ * reader other than requester_id if write is nonzero, and the requests to each machine are all sent
+ * before waiting for any of them. Responses are received on the task queue of requester_id.
+ *
+ * Pages are left read-only with no writer, and read may only be used when requester_id is the home.
+ * Leases that have yet to run out are waited for, so worker threads must leave such pages out of wanted.
+ *
+ * The home PTEs for every page in wanted MUST be locked before calling this.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int cdt_worker_recall_range(cdt_host_t *host, uint32_t requester_id, uint32_t start, uint32_t num_pages, const uint8_t *wanted, int write);
+
 int cdt_allocate_shared_page(cdt_peer_t *sender, cdt_packet_t *packet);
 /**
  * The underlying implementation of creating a thread.
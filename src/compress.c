@@ -0,0 +1,172 @@
+#include <string.h>
+#include <stdint.h>
+#include "compress.h"
+
+/*
+ * The compressed data is a series of sequences, each made of a token byte, some literal bytes, and a
+ * match copying bytes that were already written. The high four bits of the token are the number of
+ * literals and the low four bits are the length of the match minus CDT_COMPRESS_MIN_MATCH. A nibble of
+ * 15 is followed by bytes to add to it, ending with the first byte that is not 255. The literals are
+ * followed by the two byte little endian distance back to the start of the match. The last sequence
+ * has no match, and ends the data right after its literals.
+ */
+#define CDT_COMPRESS_MIN_MATCH 4
+#define CDT_COMPRESS_MAX_OFFSET 0xffff
+#define CDT_COMPRESS_HASH_BITS 12
+
+static uint32_t cdt_compress_read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t cdt_compress_hash(uint32_t v) {
+  return (v * 2654435761u) >> (32 - CDT_COMPRESS_HASH_BITS);
+}
+
+static int cdt_compress_put_length(uint8_t *out, size_t *op, size_t capacity, size_t length) {
+  for (; length >= 255; length -= 255) {
+    if (*op >= capacity)
+      return 0;
+    out[(*op)++] = 255;
+  }
+
+  if (*op >= capacity)
+    return 0;
+  out[(*op)++] = length;
+  return 1;
+}
+
+/**
+ * Append a sequence to out, with no match if match_length is 0.
+ *
+ * Returns 1 on success, 0 if it does not fit in capacity.
+ */
+static int cdt_compress_sequence(uint8_t *out, size_t *op, size_t capacity, const uint8_t *literals, size_t num_literals,
+                                 size_t offset, size_t match_length) {
+  size_t literal_code = num_literals < 15 ? num_literals : 15;
+  size_t match_code = 0;
+  if (match_length)
+    match_code = match_length - CDT_COMPRESS_MIN_MATCH < 15 ? match_length - CDT_COMPRESS_MIN_MATCH : 15;
+
+  if (*op >= capacity)
+    return 0;
+  out[(*op)++] = literal_code << 4 | match_code;
+
+  if (literal_code == 15 && !cdt_compress_put_length(out, op, capacity, num_literals - 15))
+    return 0;
+
+  if (*op + num_literals > capacity)
+    return 0;
+  memcpy(out + *op, literals, num_literals);
+  *op += num_literals;
+
+  if (!match_length)
+    return 1;
+
+  if (*op + 2 > capacity)
+    return 0;
+  out[(*op)++] = offset & 0xff;
+  out[(*op)++] = offset >> 8;
+
+  if (match_code == 15 && !cdt_compress_put_length(out, op, capacity, match_length - CDT_COMPRESS_MIN_MATCH - 15))
+    return 0;
+
+  return 1;
+}
+
+size_t cdt_compress(const void *src, size_t size, void *dst, size_t capacity) {
+  const uint8_t *in = (const uint8_t*)src;
+  uint8_t *out = (uint8_t*)dst;
+
+  // Positions are kept plus one so that 0 means no earlier position had the same hash
+  uint16_t table[1 << CDT_COMPRESS_HASH_BITS];
+  if (size >= UINT16_MAX)
+    return 0;
+  memset(table, 0, sizeof(table));
+
+  size_t ip = 0, anchor = 0, op = 0;
+  while (ip + CDT_COMPRESS_MIN_MATCH <= size) {
+    uint32_t seq = cdt_compress_read32(in + ip);
+    uint32_t h = cdt_compress_hash(seq);
+    size_t ref = table[h];
+    table[h] = ip + 1;
+
+    if (ref == 0 || ip - (ref - 1) > CDT_COMPRESS_MAX_OFFSET || cdt_compress_read32(in + ref - 1) != seq) {
+      ip++;
+      continue;
+    }
+    ref--;
+
+    size_t length = CDT_COMPRESS_MIN_MATCH;
+    while (ip + length < size && in[ref + length] == in[ip + length])
+      length++;
+
+    if (!cdt_compress_sequence(out, &op, capacity, in + anchor, ip - anchor, ip - ref, length))
+      return 0;
+
+    ip += length;
+    anchor = ip;
+  }
+
+  if (!cdt_compress_sequence(out, &op, capacity, in + anchor, size - anchor, 0, 0))
+    return 0;
+
+  return op;
+}
+
+static int cdt_decompress_get_length(const uint8_t *in, size_t *ip, size_t size, size_t *length) {
+  uint8_t b;
+  do {
+    if (*ip >= size)
+      return 0;
+    b = in[(*ip)++];
+    *length += b;
+  } while (b == 255);
+
+  return 1;
+}
+
+int cdt_decompress(const void *src, size_t size, void *dst, size_t capacity) {
+  const uint8_t *in = (const uint8_t*)src;
+  uint8_t *out = (uint8_t*)dst;
+  size_t ip = 0, op = 0;
+
+  while (ip < size) {
+    uint8_t token = in[ip++];
+
+    size_t length = token >> 4;
+    if (length == 15 && !cdt_decompress_get_length(in, &ip, size, &length))
+      return -1;
+
+    if (ip + length > size || op + length > capacity)
+      return -1;
+    memcpy(out + op, in + ip, length);
+    ip += length;
+    op += length;
+
+    if (ip == size)
+      break;
+
+    if (ip + 2 > size)
+      return -1;
+    size_t offset = in[ip] | in[ip + 1] << 8;
+    ip += 2;
+    if (offset == 0 || offset > op)
+      return -1;
+
+    length = token & 0xf;
+    if (length == 15 && !cdt_decompress_get_length(in, &ip, size, &length))
+      return -1;
+    length += CDT_COMPRESS_MIN_MATCH;
+
+    if (op + length > capacity)
+      return -1;
+
+    // The match may overlap the bytes it produces, so it is copied one byte at a time
+    for (size_t i = 0; i < length; i++, op++)
+      out[op] = out[op - offset];
+  }
+
+  return op;
+}
@@ -3,8 +3,22 @@
 #include <unistd.h>
 #include "util.h"
 #include "packet.h"
+#include "compress.h"
 #include "connection.h"
 
+/* Set in the type sent on the wire when the packet's data is compressed. */
+#define CDT_CONNECTION_COMPRESSED 0x40000000
+
+static int cdt_connection_compression = CDT_CONNECTION_COMPRESS_NONE;
+
+void cdt_connection_set_compression(int mode) {
+  cdt_connection_compression = mode;
+}
+
+int cdt_connection_get_compression() {
+  return cdt_connection_compression;
+}
+
 int extract_location_from_addr(int family, struct sockaddr *addr, cdt_connection_t *connection) {
   if (family == AF_INET) {
 
@@ -33,6 +47,7 @@ int cdt_connection_create(cdt_connection_t *connection, int fd, struct sockaddr_
 
   memset(connection, 0, sizeof(cdt_connection_t));
   connection->fd = fd;
+  pthread_mutex_init(&connection->send_lock, NULL);
 
   if (extract_location_from_addr(addr->ss_family, (struct sockaddr*)addr, connection) != 0) {
     debug_print("Cannot extract address from socket\n");
@@ -89,6 +104,7 @@ int cdt_connection_connect(cdt_connection_t *connection, const char *address, co
   }
 
   connection->fd = sfd;
+  pthread_mutex_init(&connection->send_lock, NULL);
   return 0;
 }
 
@@ -98,61 +114,95 @@ void cdt_connection_close(cdt_connection_t *connection) {
   connection->fd = -1;
 }
 
-int cdt_connection_receive(const cdt_connection_t *connection, cdt_packet_t *packet) {
-  int left_to_read = 2 * sizeof(uint32_t);
-  void *data = (void*)packet;
-  while (left_to_read > 0) {
-    int n = read(connection->fd, data, left_to_read);
+static int cdt_connection_read(int fd, void *data, int size) {
+  while (size > 0) {
+    int n = read(fd, data, size);
+    if (n <= 0) return -1;
+
+    size -= n;
+    data += n;
+  }
+
+  return 0;
+}
+
+static int cdt_connection_write(int fd, const void *data, int size) {
+  while (size > 0) {
+    int n = write(fd, data, size);
     if (n <= 0) return -1;
 
-    left_to_read -= n;
+    size -= n;
     data += n;
   }
 
+  return 0;
+}
+
+int cdt_connection_receive(cdt_connection_t *connection, cdt_packet_t *packet) {
+  if (cdt_connection_read(connection->fd, packet, 2 * sizeof(uint32_t)) != 0)
+    return -1;
+
   packet->size = ntohl(packet->size);
   packet->type = ntohl(packet->type);
+
+  int compressed = packet->type & CDT_CONNECTION_COMPRESSED;
+  packet->type &= ~CDT_CONNECTION_COMPRESSED;
   
   if (packet->size < 0 || packet->size > CDT_PACKET_DATA_SIZE || packet->type < 0)
     return -1;
 
-  left_to_read = packet->size;
-  while (left_to_read > 0) {
-    int n = read(connection->fd, data, left_to_read);
-    if (n <= 0) return -1;
+  if (!compressed)
+    return cdt_connection_read(connection->fd, packet->data, packet->size);
 
-    left_to_read -= n;
-    data += n;
+  if (cdt_connection_read(connection->fd, connection->receive_buffer, packet->size) != 0)
+    return -1;
+
+  int size = cdt_decompress(connection->receive_buffer, packet->size, packet->data, CDT_PACKET_DATA_SIZE);
+  if (size < 0) {
+    debug_print("Received malformed compressed packet of type %d\n", packet->type);
+    return -1;
   }
 
+  packet->size = size;
   return 0;
 }
 
-int cdt_connection_send(const cdt_connection_t *connection, const cdt_packet_t *packet) {
+int cdt_connection_send_locked(cdt_connection_t *connection, const cdt_packet_t *packet) {
+  const void *data = packet->data;
+  uint32_t size = packet->size;
+  uint32_t type = packet->type;
+
+  // A page that did not compress is usually followed by more like it, so stop trying for a while
+  if (cdt_connection_compression == CDT_CONNECTION_COMPRESS_LZ && size >= CDT_CONNECTION_COMPRESS_MIN_SIZE) {
+    if (connection->compress_skip > 0) {
+      connection->compress_skip--;
+    } else {
+      size_t compressed_size = cdt_compress(packet->data, size, connection->send_buffer, size - size / 8);
+      if (compressed_size > 0) {
+        data = connection->send_buffer;
+        size = compressed_size;
+        type |= CDT_CONNECTION_COMPRESSED;
+      } else {
+        connection->compress_skip = CDT_CONNECTION_COMPRESS_BYPASS;
+      }
+    }
+  }
+
   uint32_t size_and_type[] = {
-    htonl(packet->size),
-    htonl(packet->type)
+    htonl(size),
+    htonl(type)
   };
 
-  int left_to_write = sizeof(size_and_type);
-  const void *data = (void*)size_and_type;
-  while (left_to_write > 0) {
-    int n = write(connection->fd, data, left_to_write);
-    if (n <= 0) return -1;
-
-    left_to_write -= n;
-    data += n;
-  }
-
-  left_to_write = packet->size;
-  data = (void*)packet + sizeof(size_and_type);
+  if (cdt_connection_write(connection->fd, size_and_type, sizeof(size_and_type)) != 0)
+    return -1;
 
-  while (left_to_write > 0) {
-    int n = write(connection->fd, data, left_to_write);
-    if (n <= 0) return -1;
+  return cdt_connection_write(connection->fd, data, size);
+}
 
-    left_to_write -= n;
-    data += n;
-  }
+int cdt_connection_send(cdt_connection_t *connection, const cdt_packet_t *packet) {
+  pthread_mutex_lock(&connection->send_lock);
+  int res = cdt_connection_send_locked(connection, packet);
+  pthread_mutex_unlock(&connection->send_lock);
 
-  return 0;
+  return res;
 }
@@ -3,10 +3,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "host.h"
 #include "packet.h"
 #include "coordinate.h"
 #include "worker.h"
+#include "fault.h"
 
 int cdt_get_cores(int fallback) {
 #ifdef COORDINATE_LOCAL
@@ -22,6 +26,10 @@ int cdt_get_cores(int fallback) {
 
 // Returns NULL on failure. size is the number of bytes requested.
 void* cdt_malloc(size_t size) {
+  return cdt_malloc_flags(size, 0);
+}
+
+void* cdt_malloc_flags(size_t size, int flags) {
 #ifdef COORDINATE_LOCAL
   return malloc(size);
 #else
@@ -35,47 +43,81 @@ void* cdt_malloc(size_t size) {
   if (size % PAGESIZE  != 0) 
     num_pages_req++;
 
-  if (host->manager) {
-    int start_pte_idx = cdt_find_unused_pte(host->self_id, num_pages_req);
-    if (start_pte_idx == -1)
-      return NULL;
+  if (flags & (CDT_MALLOC_RELEASE_CONSISTENT | CDT_MALLOC_WRITE_UPDATE))
+    flags |= CDT_MALLOC_MULTIPLE_WRITER;
 
-    // If we've gotten to this point, assume we're holding lock of all PTEs from start_pte_idx to start_pte_idx + num_pages_req
-    for (int i = start_pte_idx; i < start_pte_idx + num_pages_req; i++) {
-      host->manager_pagetable[i].page = calloc(1, PAGESIZE);
-      pthread_mutex_unlock(&host->manager_pagetable[i].lock);
-    }
-    return (void *)host->manager_pagetable[start_pte_idx].shared_va;
+  if ((flags & CDT_MALLOC_LEASE) && (flags & CDT_MALLOC_MULTIPLE_WRITER)) {
+    debug_print("Leases are only supported for single-writer memory\n");
+    return NULL;
   }
-  // Not the manager, so send msg to manager requesting allocation
-  cdt_packet_t packet;
-  cdt_packet_alloc_req_create(&packet, host->self_id, num_pages_req);
-  
-  if (cdt_connection_send(&host->peers[0].connection, &packet) != 0) {
-    fprintf(stderr, "Failed to send allocation request packet\n");
+
+  if ((flags & CDT_MALLOC_HALO) && flags != CDT_MALLOC_HALO) {
+    debug_print("Halo memory cannot be combined with other flags\n");
     return NULL;
   }
 
-  if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1) {
-    debug_print("Failed to receive a message from manager receiver-thread\n");
+  if (CDT_BLOCK_SHIFT(flags) > CDT_MALLOC_MAX_BLOCK_SHIFT) {
+    debug_print("Coherence blocks can be at most 2^%d pages\n", CDT_MALLOC_MAX_BLOCK_SHIFT);
     return NULL;
   }
 
+  // Faults bring in whole blocks, so the allocation is made of whole blocks too
+  uint32_t block_pages = 1 << CDT_BLOCK_SHIFT(flags);
+  num_pages_req = (num_pages_req + block_pages - 1) & ~(block_pages - 1);
+
   uint64_t page_address;
   uint32_t resp_num_pages;
-  cdt_packet_alloc_resp_parse(&packet, &page_address, &resp_num_pages);
-  assert(resp_num_pages == num_pages_req);
 
-  if (page_address == 0)
-    return NULL;
+  if (host->manager) {
+    int start_pte_idx = cdt_find_unused_pte(host->self_id, num_pages_req, flags);
+    if (start_pte_idx == -1)
+      return NULL;
 
+    page_address = host->manager_pagetable[start_pte_idx].shared_va;
+    resp_num_pages = num_pages_req;
+  } else {
+    // Not the manager, so send msg to manager requesting allocation
+    cdt_packet_t packet;
+    cdt_packet_alloc_req_create(&packet, host->self_id, num_pages_req, flags);
+    
+    if (cdt_connection_send(&host->peers[0].connection, &packet) != 0) {
+      fprintf(stderr, "Failed to send allocation request packet\n");
+      return NULL;
+    }
+
+    if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1) {
+      debug_print("Failed to receive a message from manager receiver-thread\n");
+      return NULL;
+    }
+
+    cdt_packet_alloc_resp_parse(&packet, &page_address, &resp_num_pages);
+    assert(resp_num_pages == num_pages_req);
+
+    if (page_address == 0)
+      return NULL;
+  }
+
+  // Halo pages are mapped by each machine when it first touches them
+  if (flags & CDT_MALLOC_HALO)
+    return (void *)page_address;
+
+  // The homes of the pages have already set up their PTEs, so only our copies of the other pages are left
   int pte_idx = SHARED_VA_TO_IDX(page_address);
-  // Note: there's probably a race here
   for (int i = pte_idx; i < pte_idx + resp_num_pages; i++) {
+    if (cdt_host_home(host, i) == host->self_id)
+      continue;
+
     pthread_mutex_lock(&host->shared_pagetable[i].lock);
     host->shared_pagetable[i].in_use = 1;
     host->shared_pagetable[i].access = READ_WRITE_PAGE;
-    host->shared_pagetable[i].page = calloc(1, PAGESIZE);
+    host->shared_pagetable[i].page = cdt_host_map_page(host->shared_pagetable[i].shared_va, NULL, READ_WRITE_PAGE);
+    host->shared_pagetable[i].flags = flags;
+    if (flags & CDT_MALLOC_MULTIPLE_WRITER) { // we start out as a writer of the zeroed page
+      host->shared_pagetable[i].twin = calloc(1, PAGESIZE);
+      cdt_host_list_page(&host->release_pages, i);
+    }
+    else // the home has never touched its copy, which is still zero
+      host->shared_pagetable[i].base = calloc(1, PAGESIZE);
     pthread_mutex_unlock(&host->shared_pagetable[i].lock);
   }
 
@@ -93,10 +135,54 @@ void cdt_free(void *ptr) {
 
 int is_shared_va(const void * addr) {
   // TODO: ensure the user's malloc never gives them an address in the shared region?
-  return (uint64_t)addr >= CDT_SHARED_VA_START && (uint64_t)addr < CDT_SHARED_VA_END;
+  return IS_SHARED_VA(addr);
+}
+
+#ifndef COORDINATE_LOCAL
+/**
+ * Check whether any of the n bytes starting at addr are halo memory.
+ */
+static int cdt_is_halo(cdt_host_t *host, const void *addr, size_t n) {
+  if (n == 0 || !IS_SHARED_VA(addr))
+    return 0;
+
+  for (uint64_t i = SHARED_VA_TO_IDX(addr); i <= SHARED_VA_TO_IDX((const char*)addr + n - 1); i++) {
+    if (__atomic_load_n(&host->halo[i], __ATOMIC_ACQUIRE))
+      return 1;
+  }
+
+  return 0;
 }
+#endif
 
-int cdt_copyout(void *dest, const void *src, size_t n) {
+/**
+ * Copy n bytes from src to dest with non-temporal stores where the CPU has them, so that a large copy
+ * does not evict everything else from the cache on its way to memory.
+ */
+static void cdt_stream_copy(void *dest, const void *src, size_t n) {
+#ifdef __SSE2__
+  char *d = (char*)dest;
+  const char *s = (const char*)src;
+
+  // Only aligned stores can be streamed, so the ragged ends are copied normally
+  size_t head = (16 - ((uint64_t)d & 15)) & 15;
+  if (head > n)
+    head = n;
+  memcpy(d, s, head);
+  d += head, s += head, n -= head;
+
+  for (; n >= 16; d += 16, s += 16, n -= 16)
+    _mm_stream_si128((__m128i*)d, _mm_loadu_si128((const __m128i*)s));
+  memcpy(d, s, n);
+
+  // Streamed stores are weakly ordered, so they must land before the pages can be sent anywhere
+  _mm_sfence();
+#else
+  memcpy(dest, src, n);
+#endif
+}
+
+int cdt_copyout(void *dest, const void *src, size_t n, int stream) {
   cdt_host_t *host = cdt_get_host();
 
   int start_va_idx = SHARED_VA_TO_IDX(PGROUNDDOWN(dest));
@@ -105,230 +191,85 @@ int cdt_copyout(void *dest, const void *src, size_t n) {
   uint64_t start_offset = (uint64_t)dest - PGROUNDDOWN(dest);
   uint64_t src_page_start = (uint64_t)src - start_offset;
 
-  if (host->manager == 0) {
-    for (int i = start_va_idx; i <= end_va_idx; i++) {
-      cdt_host_pte_t *pte = &host->shared_pagetable[i];
-      uint64_t page_addr = pte->shared_va;
-      uint64_t offset = i == start_va_idx ? start_offset : 0;
-      size_t length = (i == end_va_idx ? (uint64_t)dest + n - PGROUNDDOWN(dest + n - 1) : PAGESIZE) - offset;
-      const void *src_addr = (const void*)src_page_start + (i - start_va_idx) * PAGESIZE + offset;
+  // Take the pages we overwrite completely up front, without their old contents
+  int first_full = start_offset == 0 ? start_va_idx : start_va_idx + 1;
+  int last_full = ((uint64_t)dest + n) % PAGESIZE == 0 ? end_va_idx : end_va_idx - 1;
+  if (first_full <= last_full && cdt_fault_own_range(host, first_full, last_full - first_full + 1, 1) != 0)
+    return -1;
+
+  for (int i = start_va_idx; i <= end_va_idx; i++) {
+    uint64_t offset = i == start_va_idx ? start_offset : 0;
+    size_t length = (i == end_va_idx ? (uint64_t)dest + n - PGROUNDDOWN(dest + n - 1) : PAGESIZE) - offset;
+    const void *src_addr = (const void*)src_page_start + (i - start_va_idx) * PAGESIZE + offset;
+
+    // Make sure our machine has R/W access to the page, then write to the local copy
+    if (cdt_fault_write(host, i) != 0)
+      return -1;
+
+    void *local_copy = (void*)(CDT_SHARED_VA_START + (uint64_t)i * PAGESIZE + offset);
+    if (stream)
+      cdt_stream_copy(local_copy, src_addr, length);
+    else
+      memmove(local_copy, src_addr, length);
+  }
 
-      if (pte->in_use && pte->access == READ_WRITE_PAGE) {
-        // Our machine has R/W access to the page, so go ahead and write to the page
-        void * local_copy = pte->page + offset;
+  return 0;
+}
 
-        memmove(local_copy, src_addr, length);
-      } else {
-        // We don't have R/W access to the page, so request write access from the manager
-        cdt_packet_t packet;
-        cdt_packet_write_req_create(&packet, page_addr);
-        if (cdt_connection_send(&host->peers[0].connection, &packet) != 0)
-          return -1;
+int cdt_copyin(void *dest, const void *src, size_t n) {
+  cdt_host_t *host = cdt_get_host();
 
-        if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1)
-          return -1;
+  int start_va_idx = SHARED_VA_TO_IDX(PGROUNDDOWN(src));
+  int end_va_idx = SHARED_VA_TO_IDX(PGROUNDDOWN(src + n - 1));
 
-        void * page;
-        cdt_packet_write_resp_parse(&packet, &page);
+  uint64_t start_offset = (uint64_t)src - PGROUNDDOWN(src);
+  uint64_t dest_page_start = (uint64_t)dest - start_offset;
 
-        // Update machine PTE access and page
-        pte->access = READ_WRITE_PAGE;
-        pte->in_use = 1;
-        void *local_copy = pte->page = malloc(PAGESIZE);
+  // Bring in every missing page at once
+  if (cdt_fault_read_range(host, start_va_idx, end_va_idx - start_va_idx + 1) != 0)
+    return -1;
 
-        memmove(local_copy, page, PAGESIZE);
+  for (int i = start_va_idx; i <= end_va_idx; i++) {
+    uint64_t offset = i == start_va_idx ? start_offset : 0;
+    size_t length = (i == end_va_idx ? (uint64_t)src + n - PGROUNDDOWN(src + n - 1) : PAGESIZE) - offset;
+    void *dest_addr = (void*)dest_page_start + (i - start_va_idx) * PAGESIZE + offset;
 
-        local_copy += offset;
+    // Make sure our machine has read access to the page, then read from the local copy
+    if (cdt_fault_read(host, i) != 0)
+      return -1;
 
-        memmove(local_copy, src_addr, length);
-      }
-    }
-  } else {
-    // Manager is attempting to write
-    for (int i = start_va_idx; i <= end_va_idx; i++) {
-      cdt_manager_pte_t *pte = &host->manager_pagetable[i];
-      uint64_t page_addr = pte->shared_va;
-      uint64_t offset = i == start_va_idx ? start_offset : 0;
-      size_t length = (i == end_va_idx ? (uint64_t)dest + n - PGROUNDDOWN(dest + n - 1) : PAGESIZE) - offset;
-      const void *src_addr = (const void*)src_page_start + (i - start_va_idx) * PAGESIZE + offset;
-
-      if (!pte->in_use) {
-        debug_print("Trying to read invalid page at %p\n", (void*)page_addr);
-        return -1;
-      }
-
-      if (pte->writer >= 0) {
-        // page is in write mode
-        if (pte->writer == host->self_id) {
-          // manager has R/W access
-          void *local_copy = pte->page + offset;
-          memmove(local_copy, src_addr, length);
-        } else {
-          // Send request to writer for invalidation and page
-          cdt_packet_t packet;
-          cdt_packet_write_invalidate_req_create(&packet, page_addr, host->self_id);
-          if (cdt_connection_send(&host->peers[pte->writer].connection, &packet) != 0)
-            return -1;
-          
-          if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1)
-            return -1;
-          
-          void *page;
-          uint32_t requester_id;
-          cdt_packet_write_invalidate_resp_parse(&packet, &page, &requester_id);
-          assert(requester_id == host->self_id);
-
-          // Update mngr PTE access and page
-          pte->writer = host->self_id;
-          pte->in_use = 1;
-          pte->page = malloc(PAGESIZE);
-
-          void *local_copy = pte->page;
-          memmove(local_copy, page, PAGESIZE);
-
-          local_copy += offset;
-
-          memmove(local_copy, src_addr, length);
-        }
-      } else { // page is in R/O mode
-        // Send invalidation requests to all readers
-        int read_count = 0;
-        cdt_packet_t packet;
-        cdt_packet_read_invalidate_req_create(&packet, page_addr, host->self_id);
-        for (int p = 0; p < CDT_MAX_MACHINES; p++) {
-          if (p != host->self_id && pte->read_set[p]) {
-            read_count++;
-            if (cdt_connection_send(&host->peers[p].connection, &packet) != 0)
-              return -1;
-          }
-        }
-
-        for (int j = 0; j < read_count; j++) {
-          if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1)
-            return -1;
-          
-          uint64_t resp_page_addr;
-          uint32_t requester_id;
-          cdt_packet_read_invalidate_resp_parse(&packet, &resp_page_addr, &requester_id);
-          assert(requester_id == host->self_id);
-          assert(resp_page_addr == page_addr);
-        }
-
-        for (int p = 0; p < CDT_MAX_MACHINES; p++)
-            pte->read_set[p] = 0;
-        
-        pte->writer = host->self_id;
-
-        void *local_copy = pte->page + offset;
-        memmove(local_copy, src_addr, length);
-      }
-    }
+    const void *local_copy = (const void*)(CDT_SHARED_VA_START + (uint64_t)i * PAGESIZE + offset);
+    memmove(dest_addr, local_copy, length);
   }
 
   return 0;
 }
 
-int cdt_copyin(void *dest, const void *src, size_t n) {
+void* cdt_write_shared(void *dest, const void *src, size_t n, int stream) {
   cdt_host_t *host = cdt_get_host();
 
-  int start_va_idx = SHARED_VA_TO_IDX(PGROUNDDOWN(src));
-  int end_va_idx = SHARED_VA_TO_IDX(PGROUNDDOWN(src + n - 1));
+  int start_va_idx = SHARED_VA_TO_IDX(PGROUNDDOWN(dest));
+  int end_va_idx = SHARED_VA_TO_IDX(PGROUNDDOWN(dest + n - 1));
 
-  uint64_t start_offset = (uint64_t)src - PGROUNDDOWN(src);
-  uint64_t dest_page_start = (uint64_t)dest - start_offset;
+  // A page's home may move while it is locked, so remember which lock was taken for each page
+  pthread_mutex_t **locks = malloc((end_va_idx - start_va_idx + 1) * sizeof(*locks));
+  if (!locks)
+    return NULL;
 
-  if (host->manager == 0) {
-    for (int i = start_va_idx; i <= end_va_idx; i++) {
-      cdt_host_pte_t *pte = &host->shared_pagetable[i];
-      uint64_t page_addr = pte->shared_va;
-      uint64_t offset = i == start_va_idx ? start_offset : 0;
-      size_t length = (i == end_va_idx ? (uint64_t)src + n - PGROUNDDOWN(src + n - 1) : PAGESIZE) - offset;
-      void *dest_addr = (void*)dest_page_start + (i - start_va_idx) * PAGESIZE + offset;
-
-      if (pte->in_use && pte->access != INVALID_PAGE) {
-        // Our machine has R/W access to the page, so go ahead and write to the page
-        void *local_copy = pte->page + offset;
-        memmove(dest_addr, local_copy, length);
-      } else {
-        // We don't have read access to the page, so request R/O access from the manager
-        cdt_packet_t packet;
-        cdt_packet_read_req_create(&packet, page_addr);
-        if (cdt_connection_send(&host->peers[0].connection, &packet) != 0)
-          return -1;
-
-        if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1)
-          return -1;
-
-        void *page;
-        cdt_packet_read_resp_parse(&packet, &page);
-
-        // Update machine PTE access and page
-        pte->access = READ_ONLY_PAGE;
-        pte->in_use = 1;
-        void *local_copy = pte->page = malloc(PAGESIZE);
-
-        memmove(local_copy, page, PAGESIZE);
-
-        local_copy += offset;
-        
-        memmove(dest_addr, local_copy, length);
-      }
-    }
-  } else {
-    // Manager is attempting to read
-    for (int i = start_va_idx; i <= end_va_idx; i++) {
-      cdt_manager_pte_t *pte = &host->manager_pagetable[i];
-      uint64_t page_addr = pte->shared_va;
-      uint64_t offset = i == start_va_idx ? start_offset : 0;
-      size_t length = (i == end_va_idx ? (uint64_t)src + n - PGROUNDDOWN(src + n - 1) : PAGESIZE) - offset;
-      void *dest_addr = (void*)dest_page_start + (i - start_va_idx) * PAGESIZE + offset;
-
-      if (!pte->in_use) {
-        debug_print("Trying to write to invalid page at %p\n", (void*)page_addr);
-        return -1;
-      }
-
-      if (pte->writer >= 0) {
-        // page is in write mode
-        if (pte->writer == host->self_id) {
-          // manager has R/W access
-          void *local_copy = pte->page + offset;
-          memmove(dest_addr, local_copy, length);
-        } else {
-          // Send request to writer for demotion and page
-          cdt_packet_t packet;
-          cdt_packet_write_demote_req_create(&packet, page_addr, host->self_id);
-
-          if (cdt_connection_send(&host->peers[pte->writer].connection, &packet) != 0)
-            return -1;
-
-          if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1)
-            return -1;
-          
-          void *page;
-          uint32_t requester_id;
-          cdt_packet_write_demote_resp_parse(&packet, &page, &requester_id);
-
-          pte->writer = -1;
-          pte->read_set[host->self_id] = 1;
-          pte->read_set[pte->writer] = 1;
-
-          void *local_page = pte->page = malloc(PAGESIZE);
-          memmove(local_page, page, PAGESIZE);
-
-          local_page += offset;
-
-          memmove(dest_addr, local_page, length);
-        }
-      } else {
-        // Currently in R/O
-        void *local_page = pte->page + offset;
-        memmove(dest_addr, local_page, length);
-      }
-    }
+  cdt_fault_lock(host);
+  for (int i = start_va_idx; i <= end_va_idx; i++) {
+    locks[i - start_va_idx] = cdt_host_lock_page(host, i);
   }
 
-  return 0;
+  int res = cdt_copyout(dest, src, n, stream);
+
+  for (int i = start_va_idx; i <= end_va_idx; i++) {
+    pthread_mutex_unlock(locks[i - start_va_idx]);
+  }
+  cdt_fault_unlock(host);
+  free(locks);
+
+  return res != 0 ? NULL : dest;
 }
 
 void* cdt_memcpy(void *dest, const void *src, size_t n) {
@@ -343,37 +284,45 @@ void* cdt_memcpy(void *dest, const void *src, size_t n) {
     return memcpy(dest, src, n);
   }
 
-  // Write shared mem: src is local and dest is shared
-  if (is_shared_va(dest) == 1 &&  is_shared_va(src) == 0) {
-    int start_va_idx = SHARED_VA_TO_IDX(PGROUNDDOWN(dest));
-    int end_va_idx = SHARED_VA_TO_IDX(PGROUNDDOWN(dest + n - 1));
-
-    for (int i = start_va_idx; i <= end_va_idx; i++) {
-      pthread_mutex_lock(host->manager ? &host->manager_pagetable[i].lock : &host->shared_pagetable[i].lock);
-    }
-
-    int res = cdt_copyout(dest, src, n);
+  // Halo memory is never fetched from anywhere, so it is copied in place, and any page missing here is
+  // faulted in as it is touched
+  if (cdt_is_halo(host, dest, n) || cdt_is_halo(host, src, n))
+    return memmove(dest, src, n);
 
-    for (int i = start_va_idx; i <= end_va_idx; i++) {
-      pthread_mutex_unlock(host->manager ? &host->manager_pagetable[i].lock : &host->shared_pagetable[i].lock);
-    }
+  // Write shared mem: src is local and dest is shared
+  if (is_shared_va(dest) == 1 &&  is_shared_va(src) == 0)
+    return cdt_write_shared(dest, src, n, 0);
 
-    return res != 0 ? NULL : dest;
-  }
   // Read shared mem: dest is local and src is shared
   if (is_shared_va(src) == 1 &&  is_shared_va(dest) == 0) {
     int start_va_idx = SHARED_VA_TO_IDX(PGROUNDDOWN(src));
     int end_va_idx = SHARED_VA_TO_IDX(PGROUNDDOWN(src + n - 1));
 
+    // Copies of frozen pages never change, so once we hold all of them they are read in place
+    int frozen = 1;
+    for (int i = start_va_idx; frozen && i <= end_va_idx; i++)
+      frozen = cdt_fault_frozen_copy(host, i);
+
+    if (frozen)
+      return memcpy(dest, src, n);
+
+    // A page's home may move while it is locked, so remember which lock was taken for each page
+    pthread_mutex_t **locks = malloc((end_va_idx - start_va_idx + 1) * sizeof(*locks));
+    if (!locks)
+      return NULL;
+
+    cdt_fault_lock(host);
     for (int i = start_va_idx; i <= end_va_idx; i++) {
-      pthread_mutex_lock(host->manager ? &host->manager_pagetable[i].lock : &host->shared_pagetable[i].lock);
+      locks[i - start_va_idx] = cdt_host_lock_page(host, i);
     }
 
     int res = cdt_copyin(dest, src, n);
 
     for (int i = start_va_idx; i <= end_va_idx; i++) {
-      pthread_mutex_unlock(host->manager ? &host->manager_pagetable[i].lock : &host->shared_pagetable[i].lock);
+      pthread_mutex_unlock(locks[i - start_va_idx]);
     }
+    cdt_fault_unlock(host);
+    free(locks);
 
     return res != 0 ? NULL : dest;
   }
@@ -390,3 +339,188 @@ void* cdt_memcpy(void *dest, const void *src, size_t n) {
   return res == 0 ? NULL : dest;
 #endif
 }
+
+void* cdt_stream_write(void *dest, const void *src, size_t n) {
+#ifdef COORDINATE_LOCAL
+  cdt_stream_copy(dest, src, n);
+  return dest;
+#else
+  if (n == 0 || !is_shared_va(dest) || is_shared_va(src) || cdt_is_halo(cdt_get_host(), dest, n))
+    return cdt_memcpy(dest, src, n);
+
+  return cdt_write_shared(dest, src, n, 1);
+#endif
+}
+
+#ifndef COORDINATE_LOCAL
+/**
+ * Ask every other machine to freeze the pages it is the home for among the num_pages pages starting at
+ * index start, or its copies of the others if copies is nonzero, and wait for all of them to finish.
+ */
+int cdt_freeze_peers(cdt_host_t *host, uint32_t start, uint32_t num_pages, uint32_t copies) {
+  cdt_packet_t packet;
+  cdt_packet_freeze_req_create(&packet, start, num_pages, copies);
+  uint32_t pending = 0;
+  for (uint32_t i = 0; i < host->num_machines; i++) {
+    if (i == host->self_id)
+      continue;
+
+    if (cdt_connection_send(&host->peers[i].connection, &packet) != 0) {
+      debug_print("Failed to send freeze request packet to peer %d\n", i);
+      return -1;
+    }
+    pending++;
+  }
+
+  int res = 0;
+  for (; pending > 0; pending--) {
+    if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1) {
+      debug_print("Failed to receive freeze response\n");
+      return -1;
+    }
+
+    uint32_t requester_id, status;
+    cdt_packet_freeze_resp_parse(&packet, &requester_id, &status);
+    assert(requester_id == host->self_id);
+
+    if (status != 0)
+      res = -1;
+  }
+
+  return res;
+}
+#endif
+
+int cdt_freeze(void *addr, size_t size) {
+#ifdef COORDINATE_LOCAL
+  return 0;
+#else
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet initialized\n");
+    return -1;
+  }
+
+  if (size == 0 || !IS_SHARED_VA(addr) || !IS_SHARED_VA((char*)addr + size - 1)) {
+    debug_print("Can only freeze shared memory\n");
+    return -1;
+  }
+
+  uint32_t start = SHARED_VA_TO_IDX(addr);
+  uint32_t num_pages = SHARED_VA_TO_IDX((char*)addr + size - 1) - start + 1;
+
+  // Our own pages are frozen before asking anyone else, since the writers we recall answer on the same queue
+  cdt_fault_lock(host);
+  int res = cdt_worker_do_freeze(host, host->self_id, start, num_pages);
+  cdt_fault_unlock(host);
+  if (res != 0)
+    return -1;
+
+  // No machine keeps its copies of the other pages for good until all of their homes have recalled the writers
+  if (cdt_freeze_peers(host, start, num_pages, 0) != 0)
+    return -1;
+
+  cdt_worker_freeze_copies(host, start, num_pages);
+  return cdt_freeze_peers(host, start, num_pages, 1);
+#endif
+}
+
+int cdt_broadcast(void *addr, size_t len) {
+#ifdef COORDINATE_LOCAL
+  return 0;
+#else
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet initialized\n");
+    return -1;
+  }
+
+  if (len == 0 || !IS_SHARED_VA(addr) || !IS_SHARED_VA((char*)addr + len - 1)) {
+    debug_print("Can only broadcast shared memory\n");
+    return -1;
+  }
+
+  uint32_t start = SHARED_VA_TO_IDX(addr);
+  uint32_t num_pages = SHARED_VA_TO_IDX((char*)addr + len - 1) - start + 1;
+
+  // Our own pages are pushed before asking anyone else, since the machines we push them to answer on the same queue
+  cdt_fault_lock(host);
+  int res = cdt_worker_do_broadcast(host, host->self_id, start, num_pages);
+  cdt_fault_unlock(host);
+  if (res != 0)
+    return -1;
+
+  cdt_packet_t packet;
+  cdt_packet_broadcast_req_create(&packet, start, num_pages);
+  uint32_t pending = 0;
+  for (uint32_t i = 0; i < host->num_machines; i++) {
+    if (i == host->self_id)
+      continue;
+
+    if (cdt_connection_send(&host->peers[i].connection, &packet) != 0) {
+      debug_print("Failed to send broadcast request packet to peer %d\n", i);
+      return -1;
+    }
+    pending++;
+  }
+
+  for (; pending > 0; pending--) {
+    if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1) {
+      debug_print("Failed to receive broadcast response\n");
+      return -1;
+    }
+
+    uint32_t requester_id, status;
+    cdt_packet_broadcast_resp_parse(&packet, &requester_id, &status);
+    assert(requester_id == host->self_id);
+
+    if (status != 0)
+      res = -1;
+  }
+
+  return res;
+#endif
+}
+
+void cdt_sync() {
+  cdt_release();
+  cdt_acquire();
+}
+
+void cdt_acquire() {
+#ifndef COORDINATE_LOCAL
+  cdt_host_t *host = cdt_get_host();
+  if (!host)
+    return;
+
+  cdt_page_range_t all = { .start = 0, .num_pages = CDT_MAX_SHARED_PAGES };
+  cdt_fault_lock(host);
+  if (cdt_fault_acquire(host, &all, 1) != 0)
+    debug_print("Failed to acquire shared pages\n");
+  cdt_fault_unlock(host);
+#endif
+}
+
+void cdt_release() {
+#ifndef COORDINATE_LOCAL
+  cdt_host_t *host = cdt_get_host();
+  if (!host)
+    return;
+
+  // Only the pages we have twinned or written as their home can have anything to publish
+  uint32_t pages[CDT_MAX_SHARED_PAGES];
+  uint32_t num_pages = cdt_host_take_pages(&host->release_pages, pages, NULL, 0);
+  cdt_fault_lock(host);
+  for (uint32_t i = 0; i < num_pages; i++) {
+    pthread_mutex_t *lock = cdt_host_lock_page(host, pages[i]);
+
+    if (cdt_fault_release(host, pages[i]) != 0) {
+      debug_print("Failed to release shared page %d\n", pages[i]);
+      cdt_host_list_page(&host->release_pages, pages[i]);
+    }
+
+    pthread_mutex_unlock(lock);
+  }
+  cdt_fault_unlock(host);
+#endif
+}
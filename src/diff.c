@@ -0,0 +1,70 @@
+#include <string.h>
+#include <arpa/inet.h>
+#include "util.h"
+#include "diff.h"
+
+/* Each run starts with a header containing the index of its first word and the number of words in it. */
+typedef struct cdt_diff_run_t {
+  uint16_t start;
+  uint16_t length;
+} cdt_diff_run_t;
+
+size_t cdt_diff_encode(const void *page, const void *twin, void *diff, size_t size, uint32_t *word) {
+  const uint32_t *words = (const uint32_t*)page;
+  const uint32_t *twin_words = (const uint32_t*)twin;
+  size_t used = 0;
+  uint32_t i = *word;
+
+  while (i < CDT_DIFF_PAGE_WORDS) {
+    if (words[i] == twin_words[i]) {
+      i++;
+      continue;
+    }
+
+    // Only start a run if at least one word of it fits
+    if (used + sizeof(cdt_diff_run_t) + CDT_DIFF_WORD_SIZE > size)
+      break;
+
+    uint32_t start = i;
+    size_t max_length = (size - used - sizeof(cdt_diff_run_t)) / CDT_DIFF_WORD_SIZE;
+    while (i < CDT_DIFF_PAGE_WORDS && i - start < max_length && words[i] != twin_words[i])
+      i++;
+
+    cdt_diff_run_t run = {
+      .start = htons(start),
+      .length = htons(i - start)
+    };
+    memmove(diff + used, &run, sizeof(run));
+    used += sizeof(run);
+
+    memmove(diff + used, words + start, (i - start) * CDT_DIFF_WORD_SIZE);
+    used += (i - start) * CDT_DIFF_WORD_SIZE;
+  }
+
+  *word = i;
+  return used;
+}
+
+int cdt_diff_apply(void *page, const void *diff, size_t size) {
+  uint32_t *words = (uint32_t*)page;
+  size_t used = 0;
+
+  while (used < size) {
+    if (used + sizeof(cdt_diff_run_t) > size)
+      return -1;
+
+    cdt_diff_run_t run;
+    memmove(&run, diff + used, sizeof(run));
+    used += sizeof(run);
+
+    uint32_t start = ntohs(run.start);
+    uint32_t length = ntohs(run.length);
+    if (start + length > CDT_DIFF_PAGE_WORDS || used + length * CDT_DIFF_WORD_SIZE > size)
+      return -1;
+
+    memmove(words + start, diff + used, length * CDT_DIFF_WORD_SIZE);
+    used += length * CDT_DIFF_WORD_SIZE;
+  }
+
+  return 0;
+}
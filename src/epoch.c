@@ -0,0 +1,100 @@
+#include <string.h>
+#include "util.h"
+#include "host.h"
+#include "fault.h"
+#include "coordinate.h"
+
+int cdt_epoch_init(cdt_epoch_array_t *array, size_t size, uint32_t participants) {
+  if (size == 0 || participants == 0) {
+    debug_print("Epoch arrays need a size and at least one participant\n");
+    return -1;
+  }
+
+  array->size = size;
+  array->participants = participants;
+  array->epoch = 0;
+
+  array->buffers[0] = cdt_malloc(size);
+  if (!array->buffers[0])
+    return -1;
+
+  array->buffers[1] = cdt_malloc(size);
+  if (!array->buffers[1]) {
+    cdt_free(array->buffers[0]);
+    return -1;
+  }
+
+#ifdef COORDINATE_LOCAL
+  memset(array->buffers[0], 0, size);
+  memset(array->buffers[1], 0, size);
+#endif
+
+  if (cdt_object_init(&array->arrivals, sizeof(int64_t)) != 0) {
+    cdt_free(array->buffers[0]);
+    cdt_free(array->buffers[1]);
+    return -1;
+  }
+
+  return 0;
+}
+
+int64_t cdt_epoch_current(const cdt_epoch_array_t *array) {
+  return __atomic_load_n(&array->epoch, __ATOMIC_ACQUIRE);
+}
+
+const void* cdt_epoch_read(const cdt_epoch_array_t *array) {
+  return array->buffers[(cdt_epoch_current(array) + 1) % 2];
+}
+
+void* cdt_epoch_write(const cdt_epoch_array_t *array) {
+  return array->buffers[cdt_epoch_current(array) % 2];
+}
+
+/**
+ * Mark this machine's copies of the generation buffer as frozen while it is read, or clear the mark if
+ * frozen is zero.
+ */
+void cdt_epoch_mark(const cdt_epoch_array_t *array, const void *buffer, int frozen) {
+#ifndef COORDINATE_LOCAL
+  cdt_host_t *host = cdt_get_host();
+  if (!host)
+    return;
+
+  int start = SHARED_VA_TO_IDX(buffer);
+  int end = SHARED_VA_TO_IDX((const char*)buffer + array->size - 1);
+  cdt_fault_mark_frozen(host, start, end - start + 1, frozen);
+#endif
+}
+
+int cdt_epoch_advance(cdt_epoch_array_t *array) {
+  int64_t period = array->participants + 1;
+  int64_t epoch = cdt_epoch_current(array);
+  int64_t done = (epoch + 1) * period;
+
+  // The generation we were reading is written in the next epoch, which only starts once we have arrived
+  cdt_epoch_mark(array, array->buffers[(epoch + 1) % 2], 0);
+
+  int64_t arrived;
+  if (cdt_object_fetch_add(&array->arrivals, 1, &arrived) != 0)
+    return -1;
+
+  // The last thread to arrive hands the generation that was just written to every machine, then lets
+  // everyone into the next epoch even if that failed, since the others are waiting for it
+  int res = 0;
+  if (arrived == done - 2) {
+    if (cdt_broadcast(array->buffers[epoch % 2], array->size) != 0) {
+      debug_print("Failed to broadcast epoch %ld\n", (long)epoch);
+      res = -1;
+    }
+
+    if (cdt_object_fetch_add(&array->arrivals, 1, NULL) != 0)
+      return -1;
+  } else if (cdt_object_wait(&array->arrivals, done) != 0) {
+    return -1;
+  }
+
+  // Nobody writes the generation that was just written until every participant has arrived again
+  cdt_epoch_mark(array, array->buffers[epoch % 2], 1);
+  __atomic_store_n(&array->epoch, epoch + 1, __ATOMIC_RELEASE);
+  return res;
+}
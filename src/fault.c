@@ -0,0 +1,1059 @@
+#define _GNU_SOURCE
+#include <signal.h>
+#include <ucontext.h>
+#include <mqueue.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "host.h"
+#include "packet.h"
+#include "diff.h"
+#include "worker.h"
+#include "coordinate.h"
+#include "fault.h"
+
+static struct sigaction cdt_fault_default_action;
+
+void cdt_fault_begin_fetch(cdt_host_pte_t *pte) {
+  pthread_mutex_lock(&pte->fetch_lock);
+  pte->fetching = 1;
+  pte->fetch_invalidated = 0;
+  pthread_mutex_unlock(&pte->fetch_lock);
+}
+
+/**
+ * Returns 1 if the page was invalidated while it was being fetched, otherwise 0.
+ */
+int cdt_fault_end_fetch(cdt_host_pte_t *pte) {
+  pthread_mutex_lock(&pte->fetch_lock);
+  int invalidated = pte->fetch_invalidated;
+  pte->fetching = 0;
+  pte->fetch_invalidated = 0;
+  pthread_mutex_unlock(&pte->fetch_lock);
+
+  return invalidated;
+}
+
+/**
+ * Send a read, write or upgrade request for a page to its home, as given by type, and wait for the
+ * response, following the page to wherever its home has moved.
+ */
+int cdt_fault_request_home(cdt_host_t *host, int idx, int type, cdt_packet_t *packet) {
+  uint64_t page_addr = host->shared_pagetable[idx].shared_va;
+
+  while (1) {
+    if (type == CDT_PACKET_UPGRADE_REQ)
+      cdt_packet_upgrade_req_create(packet, page_addr);
+    else if (type == CDT_PACKET_WRITE_REQ)
+      cdt_packet_write_req_create(packet, page_addr);
+    else
+      cdt_packet_read_req_create(packet, page_addr, host->shared_pagetable[idx].version);
+
+    if (cdt_connection_send(&host->peers[cdt_host_home(host, idx)].connection, packet) != 0)
+      return -1;
+
+    if (mq_receive(cdt_host_response_queue(host, host->self_id), (char*)packet, sizeof(*packet), NULL) == -1)
+      return -1;
+
+    if (packet->type != CDT_PACKET_HOME_MOVED)
+      return 0;
+
+    uint64_t resp_page_addr;
+    uint32_t home;
+    cdt_packet_home_moved_parse(packet, &resp_page_addr, &home);
+    assert(resp_page_addr == page_addr);
+    if (home >= host->num_machines) {
+      debug_print("Page %p is not allocated at its home\n", (void*)page_addr);
+      return -1;
+    }
+
+    if (home == host->self_id) {
+      // The machine we asked is about to become the home but has not heard yet, so ask it again
+      sched_yield();
+      continue;
+    }
+
+    __atomic_store_n(&host->homes[idx], home, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * Become the home of a single-writer page we were just granted R/W access to by its previous home.
+ */
+void cdt_fault_become_home(cdt_host_t *host, int idx, uint32_t flags) {
+  cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+  cdt_manager_pte_t *home_pte = &host->manager_pagetable[idx];
+
+  pthread_mutex_lock(&home_pte->lock);
+
+  home_pte->in_use = 1;
+  home_pte->flags = flags;
+  home_pte->writer = host->self_id;
+  home_pte->last_writer = host->self_id;
+  cdt_worker_next_version(host, home_pte);
+  home_pte->migratory = 0;
+  home_pte->dirty = 0;
+  for (int i = 0; i < CDT_MAX_MACHINES; i++) {
+    home_pte->read_set[i] = 0;
+    home_pte->write_set[i] = 0;
+    home_pte->stale_set[i] = 0;
+    home_pte->write_counts[i] = 0;
+    home_pte->lease_expiry[i] = 0;
+  }
+  home_pte->page = pte->page;
+  free(pte->base);
+  pte->base = NULL;
+
+  __atomic_store_n(&host->homes[idx], host->self_id, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&home_pte->lock);
+
+  // The page stays mapped, it is just tracked by the home PTE from now on
+  pte->in_use = 0;
+  pte->access = INVALID_PAGE;
+  pte->page = NULL;
+}
+
+/**
+ * Start the lease on a read-only copy of a leased page, which the home cannot have granted any earlier
+ * than the time given by granted. The copy is used even if the lease has already run out, since it was
+ * current when it was sent.
+ */
+void cdt_fault_start_lease(cdt_host_t *host, int idx, uint64_t granted) {
+  cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+
+  // Copies of frozen pages are kept for good
+  uint64_t expiry = 0;
+  if ((pte->flags & CDT_MALLOC_LEASE) && !__atomic_load_n(&host->frozen[idx], __ATOMIC_ACQUIRE))
+    expiry = granted + CDT_LEASE_MS - CDT_LEASE_SLACK_MS;
+  cdt_host_start_lease(host, idx, expiry);
+}
+
+/**
+ * Keep a copy of a single-writer page we were just granted R/W access to, whose home still holds the
+ * contents in base, so that only our changes are sent back when the page is recalled. If base is NULL
+ * the home's copy is out of date and any copy we kept is dropped.
+ */
+int cdt_fault_keep_base(cdt_host_pte_t *pte, const void *base) {
+  if (!base || (pte->flags & CDT_MALLOC_MULTIPLE_WRITER)) {
+    free(pte->base);
+    pte->base = NULL;
+    return 0;
+  }
+
+  if (!pte->base)
+    pte->base = malloc(PAGESIZE);
+  if (!pte->base)
+    return -1;
+
+  memmove(pte->base, base, PAGESIZE);
+  return 0;
+}
+
+/**
+ * Keep a twin of the page with index idx in *twin, reusing the one already there if there is one, so that
+ * only our changes to it are published at the next release, and list the page for that release.
+ */
+int cdt_fault_keep_twin(cdt_host_t *host, int idx, void **twin, const void *page) {
+  if (!*twin)
+    *twin = malloc(PAGESIZE);
+  if (!*twin)
+    return -1;
+
+  memmove(*twin, page, PAGESIZE);
+  cdt_host_list_page(&host->release_pages, idx);
+  return 0;
+}
+
+/**
+ * Map a page we were just granted ownership of by a write response. If write is zero, the page was
+ * handed over on a read and is mapped read-only until our first write to it.
+ */
+int cdt_fault_take_ownership(cdt_host_t *host, int idx, void *page, uint32_t flags, uint32_t home, uint32_t base, int write) {
+  cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+
+  // A new home keeps track of the page in its home PTE, which does not know about exclusive copies
+  int access = write || home ? READ_WRITE_PAGE : READ_ONLY_PAGE;
+
+  // Update machine PTE access and page, which is already in place if our read-only copy was upgraded
+  pte->page = cdt_host_map_page(pte->shared_va, page, access);
+  if (!pte->page)
+    return -1;
+
+  pte->access = access;
+  pte->exclusive = access != READ_WRITE_PAGE;
+  pte->version = 0;
+  pte->in_use = 1;
+  pte->flags = flags;
+
+  if (flags & CDT_MALLOC_MULTIPLE_WRITER) {
+    // Keep a twin so that only our changes are sent back at the next synchronization point
+    if (cdt_fault_keep_twin(host, idx, &pte->twin, pte->page) != 0)
+      return -1;
+  }
+
+  if (cdt_fault_keep_base(pte, base ? pte->page : NULL) != 0)
+    return -1;
+
+  // We write the page more than anyone else, so its home moves here
+  if (home)
+    cdt_fault_become_home(host, idx, flags);
+
+  return 0;
+}
+
+/**
+ * Ask the home of a page we hold no copy of for a R/O copy of it. The copy that arrives is dropped if
+ * ours was invalidated while it was on its way, leaving the page unmapped.
+ */
+int cdt_fault_fetch_peer(cdt_host_t *host, int idx) {
+  cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+  cdt_packet_t packet;
+  uint64_t asked = cdt_host_now();
+  cdt_fault_begin_fetch(pte);
+  if (cdt_fault_request_home(host, idx, CDT_PACKET_READ_REQ, &packet) != 0) {
+    cdt_fault_end_fetch(pte);
+    return -1;
+  }
+
+  void *page;
+  uint32_t flags, held, version;
+  if (packet.type == CDT_PACKET_WRITE_RESP) {
+    // The page is migratory, so the home gave us ownership of it. Like any write response, it carries
+    // the current page even if our old copy was invalidated on the way.
+    uint32_t home, base;
+    cdt_packet_write_resp_parse(&packet, &page, &flags, &home, &base);
+    cdt_fault_end_fetch(pte);
+    return cdt_fault_take_ownership(host, idx, page, flags, home, base, 0);
+  }
+
+  if (packet.type == CDT_PACKET_READ_CURRENT) {
+    // Our stale copy is still in place and nobody has written the page since
+    uint64_t resp_page_addr;
+    cdt_packet_read_current_parse(&packet, &resp_page_addr, &held);
+    assert(resp_page_addr == pte->shared_va);
+    page = (void*)pte->shared_va;
+    flags = pte->flags;
+    version = pte->version;
+  } else {
+    cdt_packet_read_resp_parse(&packet, &page, &flags, &held, &version);
+  }
+
+  // The copy may have been sent before the invalidation, so drop it and ask again
+  if (cdt_fault_end_fetch(pte))
+    return 0;
+
+  // Update machine PTE access and page
+  pte->page = cdt_host_map_page(pte->shared_va, page, READ_ONLY_PAGE);
+  if (!pte->page)
+    return -1;
+
+  pte->access = READ_ONLY_PAGE;
+  pte->in_use = 1;
+  pte->flags = flags;
+  pte->version = version;
+  // The home had our request for at least as long as it says it held on to it
+  cdt_fault_start_lease(host, idx, asked + held);
+
+  return 0;
+}
+
+int cdt_fault_read_peer(cdt_host_t *host, int idx) {
+  cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+
+  // Callers read the page while still holding its PTE lock, so it must be mapped when we return
+  while (!pte->in_use || pte->access == INVALID_PAGE) {
+    if (cdt_fault_fetch_peer(host, idx) != 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Check that none of the pages from start to start + num_pages has been frozen, before taking R/W access
+ * to any of them.
+ *
+ * Returns 0 if they can all be written, -1 otherwise.
+ */
+int cdt_fault_check_writable(cdt_host_t *host, int start, int num_pages) {
+  for (int i = start; i < start + num_pages; i++) {
+    if (__atomic_load_n(&host->frozen[i], __ATOMIC_ACQUIRE)) {
+      fprintf(stderr, "Write to frozen shared memory at %p\n", (void*)(CDT_SHARED_VA_START + (uint64_t)i * PAGESIZE));
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Fetch the pages from start to start + num_pages that this machine is missing, or does not hold
+ * R/W access to if write is nonzero, asking each home for all of its pages in one request. If overwrite
+ * is nonzero every byte of the pages is about to be written, so the homes leave out their contents.
+ */
+int cdt_fault_fetch_range(cdt_host_t *host, int start, int num_pages, int write, int overwrite) {
+  if (write && cdt_fault_check_writable(host, start, num_pages) != 0)
+    return -1;
+
+  int res = 0;
+
+  for (int chunk = start; chunk < start + num_pages; chunk += CDT_PACKET_RANGE_MAX_PAGES) {
+    int chunk_pages = start + num_pages - chunk;
+    if (chunk_pages > CDT_PACKET_RANGE_MAX_PAGES)
+      chunk_pages = CDT_PACKET_RANGE_MAX_PAGES;
+
+    // Work out which of the missing pages to ask each home for
+    uint8_t wanted[CDT_MAX_MACHINES][CDT_PACKET_RANGE_MAX_PAGES / 8];
+    int asking[CDT_MAX_MACHINES];
+    memset(wanted, 0, sizeof(wanted));
+    memset(asking, 0, sizeof(asking));
+
+    for (int i = 0; i < chunk_pages; i++) {
+      int idx = chunk + i;
+      uint32_t home = cdt_host_home(host, idx);
+      cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+      if (home == host->self_id || (pte->in_use && (pte->access == READ_WRITE_PAGE || pte->exclusive)))
+        continue;
+
+      // Release consistent and write-update copies we already hold are written without asking the home
+      if (pte->in_use && pte->access == READ_ONLY_PAGE &&
+          (!write || (pte->flags & (CDT_MALLOC_RELEASE_CONSISTENT | CDT_MALLOC_WRITE_UPDATE))))
+        continue;
+
+      wanted[home][i / 8] |= 1 << (i % 8);
+      asking[home] = 1;
+      cdt_fault_begin_fetch(pte);
+    }
+
+    // Send every request before waiting, so the homes stream their pages back at the same time
+    cdt_packet_t packet;
+    uint32_t pending = 0;
+    uint64_t asked = cdt_host_now();
+    for (uint32_t p = 0; p < host->num_machines; p++) {
+      if (!asking[p])
+        continue;
+
+      if (write)
+        cdt_packet_write_range_req_create(&packet, chunk, chunk_pages, wanted[p], overwrite);
+      else
+        cdt_packet_read_range_req_create(&packet, chunk, chunk_pages, wanted[p]);
+
+      if (cdt_connection_send(&host->peers[p].connection, &packet) != 0) {
+        debug_print("Failed to send range request packet to peer %d\n", p);
+        res = -1;
+        continue;
+      }
+      pending++;
+    }
+
+    while (pending > 0) {
+      if (mq_receive(cdt_host_response_queue(host, host->self_id), (char*)&packet, sizeof(packet), NULL) == -1) {
+        res = -1;
+        break;
+      }
+
+      uint32_t idx, flags;
+      void *page;
+      if (write)
+        cdt_packet_write_range_resp_parse(&packet, &idx, &page, &flags);
+      else
+        cdt_packet_read_range_resp_parse(&packet, &idx, &page, &flags);
+
+      if (idx == CDT_PACKET_RANGE_DONE) {
+        pending--;
+        continue;
+      }
+
+      // A read copy may have been sent before the invalidation, so drop it and let the access fault again
+      cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+      if (cdt_fault_end_fetch(pte) && !write)
+        continue;
+
+      // A page sent without its contents keeps whatever our frame held, since all of it is about to be written
+      if (overwrite && !page && !(flags & CDT_MALLOC_MULTIPLE_WRITER))
+        page = (void*)pte->shared_va;
+
+      pte->page = cdt_host_map_page(pte->shared_va, page, write ? READ_WRITE_PAGE : READ_ONLY_PAGE);
+      if (!pte->page) {
+        res = -1;
+        continue;
+      }
+
+      pte->access = write ? READ_WRITE_PAGE : READ_ONLY_PAGE;
+      pte->in_use = 1;
+      pte->flags = flags;
+      pte->version = 0;
+      if (!write)
+        cdt_fault_start_lease(host, idx, asked);
+
+      // Without the home's contents there is nothing to diff against, so the whole page is written back
+      if (write && !(flags & CDT_MALLOC_MULTIPLE_WRITER) && cdt_fault_keep_base(pte, overwrite ? NULL : pte->page) != 0) {
+        res = -1;
+        continue;
+      }
+
+      if (write && (flags & CDT_MALLOC_MULTIPLE_WRITER)) {
+        // Keep a twin so that only our changes are sent back at the next synchronization point
+        if (cdt_fault_keep_twin(host, idx, &pte->twin, pte->page) != 0) {
+          res = -1;
+          continue;
+        }
+      }
+    }
+
+    // Anything the homes could not send right away is left to be faulted in one page at a time
+    for (int i = 0; i < chunk_pages; i++) {
+      uint32_t home = cdt_host_home(host, chunk + i);
+      if (home != host->self_id && (wanted[home][i / 8] & (1 << (i % 8))))
+        cdt_fault_end_fetch(&host->shared_pagetable[chunk + i]);
+    }
+  }
+
+  return res;
+}
+
+int cdt_fault_read_range(cdt_host_t *host, int start, int num_pages) {
+  return cdt_fault_fetch_range(host, start, num_pages, 0, 0);
+}
+
+int cdt_fault_write_range(cdt_host_t *host, int start, int num_pages) {
+  return cdt_fault_fetch_range(host, start, num_pages, 1, 0);
+}
+
+int cdt_fault_read_home(cdt_host_t *host, int idx) {
+  cdt_manager_pte_t *pte = &host->manager_pagetable[idx];
+  uint64_t page_addr = pte->shared_va;
+
+  if (!pte->in_use) {
+    debug_print("Trying to read invalid page at %p\n", (void*)page_addr);
+    return -1;
+  }
+
+  if (pte->writer < 0 || pte->writer == host->self_id) // page is in R/O mode or the home has R/W access
+    return 0;
+
+  // Send request to writer for demotion and page
+  cdt_packet_t packet;
+  cdt_packet_write_demote_req_create(&packet, page_addr, host->self_id);
+
+  if (cdt_connection_send(&host->peers[pte->writer].connection, &packet) != 0)
+    return -1;
+
+  if (mq_receive(cdt_host_response_queue(host, host->self_id), (char*)&packet, sizeof(packet), NULL) == -1)
+    return -1;
+
+  void *data;
+  uint32_t size, requester_id;
+  cdt_packet_write_demote_resp_parse(&packet, &data, &size, &requester_id);
+  assert(requester_id == host->self_id);
+
+  pte->page = cdt_worker_map_write_back(page_addr, data, size, READ_ONLY_PAGE);
+  if (!pte->page)
+    return -1;
+
+  pte->read_set[host->self_id] = 1;
+  cdt_worker_grant_lease(host, pte, pte->writer);
+  pte->writer = -1;
+
+  return 0;
+}
+
+int cdt_fault_write_peer(cdt_host_t *host, int idx) {
+  cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+
+  if (pte->in_use && pte->access == READ_WRITE_PAGE)
+    return 0;
+
+  if (pte->in_use && pte->exclusive) {
+    // We already own the page, it was only mapped read-only to see whether we would write to it
+    if (cdt_host_protect_page(pte->shared_va, READ_WRITE_PAGE) != 0)
+      return -1;
+
+    pte->access = READ_WRITE_PAGE;
+    pte->exclusive = 0;
+    return 0;
+  }
+
+  if (pte->in_use && pte->access == READ_ONLY_PAGE && (pte->flags & (CDT_MALLOC_RELEASE_CONSISTENT | CDT_MALLOC_WRITE_UPDATE))) {
+    // Our copy may be written without asking the home, since changes are only published at release and
+    // a write-update copy is kept current by the home
+    if (cdt_fault_keep_twin(host, idx, &pte->twin, pte->page) != 0)
+      return -1;
+
+    if (cdt_host_protect_page(pte->shared_va, READ_WRITE_PAGE) != 0)
+      return -1;
+
+    pte->access = READ_WRITE_PAGE;
+    return 0;
+  }
+
+  // We don't have R/W access to the page, so request write access from its home. A read-only copy of a
+  // single-writer page only needs the other copies taken away, unless it has been invalidated meanwhile.
+  int upgrade = pte->in_use && pte->access == READ_ONLY_PAGE && !(pte->flags & CDT_MALLOC_MULTIPLE_WRITER);
+  cdt_packet_t packet;
+  void *page;
+  uint32_t flags, home, base;
+  do {
+    cdt_fault_begin_fetch(pte);
+    if (cdt_fault_request_home(host, idx, upgrade ? CDT_PACKET_UPGRADE_REQ : CDT_PACKET_WRITE_REQ, &packet) != 0) {
+      cdt_fault_end_fetch(pte);
+      return -1;
+    }
+
+    if (packet.type == CDT_PACKET_UPGRADE_RESP) {
+      // Nobody else can have written the page since the home still counted us as a reader
+      uint64_t resp_page_addr;
+      cdt_packet_upgrade_resp_parse(&packet, &resp_page_addr, &home, &base);
+      assert(resp_page_addr == pte->shared_va);
+      cdt_fault_end_fetch(pte);
+
+      page = pte->page;
+      flags = pte->flags;
+      break;
+    }
+
+    cdt_packet_write_resp_parse(&packet, &page, &flags, &home, &base);
+
+    // A write response always carries the current page, so it is used even if our old copy was invalidated,
+    // unless an update to a write-update page was pushed to us while it was on its way here
+  } while (cdt_fault_end_fetch(pte) && (flags & CDT_MALLOC_WRITE_UPDATE));
+
+  return cdt_fault_take_ownership(host, idx, page, flags, home, base, 1);
+}
+
+int cdt_fault_write_home(cdt_host_t *host, int idx) {
+  cdt_manager_pte_t *pte = &host->manager_pagetable[idx];
+  uint64_t page_addr = pte->shared_va;
+
+  if (!pte->in_use) {
+    debug_print("Trying to write to invalid page at %p\n", (void*)page_addr);
+    return -1;
+  }
+
+  if (pte->flags & CDT_MALLOC_MULTIPLE_WRITER) {
+    // The home writes directly to the merged copy, readers are invalidated or updated at the next synchronization point
+    if (!pte->dirty && (pte->flags & CDT_MALLOC_WRITE_UPDATE)) {
+      // Readers are sent only what we change, which is found by comparing against a twin
+      if (cdt_fault_keep_twin(host, idx, &pte->twin, pte->page) != 0)
+        return -1;
+    }
+
+    if (!pte->dirty && cdt_host_protect_page(page_addr, READ_WRITE_PAGE) != 0)
+      return -1;
+
+    pte->dirty = 1;
+    cdt_host_list_page(&host->release_pages, idx);
+    return 0;
+  }
+
+  if (pte->writer == host->self_id) // home has R/W access
+    return 0;
+
+  cdt_worker_detect_migratory(host, pte, host->self_id);
+  cdt_worker_next_version(host, pte);
+  cdt_worker_count_write(host, pte, host->self_id);
+
+  if (pte->writer >= 0) {
+    // Send request to writer for invalidation and page
+    cdt_packet_t packet;
+    cdt_packet_write_invalidate_req_create(&packet, page_addr, host->self_id);
+    if (cdt_connection_send(&host->peers[pte->writer].connection, &packet) != 0)
+      return -1;
+
+    if (mq_receive(cdt_host_response_queue(host, host->self_id), (char*)&packet, sizeof(packet), NULL) == -1)
+      return -1;
+
+    void *data;
+    uint32_t size, requester_id;
+    cdt_packet_write_invalidate_resp_parse(&packet, &data, &size, &requester_id);
+    assert(requester_id == host->self_id);
+
+    // Update home PTE access and page
+    pte->page = cdt_worker_map_write_back(page_addr, data, size, READ_WRITE_PAGE);
+    if (!pte->page)
+      return -1;
+
+    pte->writer = host->self_id;
+    return 0;
+  }
+
+  // page is in R/O mode, so wait out the readers' leases or send invalidation requests to all of them
+  if (pte->flags & CDT_MALLOC_LEASE)
+    cdt_worker_wait_lease(cdt_worker_revoke_leases(host, pte, host->self_id));
+
+  int read_count = 0;
+  cdt_packet_t packet;
+  cdt_packet_read_invalidate_req_create(&packet, page_addr, host->self_id);
+  for (int p = 0; p < CDT_MAX_MACHINES; p++) {
+    if (p != host->self_id && pte->read_set[p]) {
+      read_count++;
+      if (cdt_connection_send(&host->peers[p].connection, &packet) != 0)
+        return -1;
+    }
+  }
+
+  for (int j = 0; j < read_count; j++) {
+    if (mq_receive(cdt_host_response_queue(host, host->self_id), (char*)&packet, sizeof(packet), NULL) == -1)
+      return -1;
+
+    uint64_t resp_page_addr;
+    uint32_t requester_id;
+    cdt_packet_read_invalidate_resp_parse(&packet, &resp_page_addr, &requester_id);
+    assert(requester_id == host->self_id);
+    assert(resp_page_addr == page_addr);
+  }
+
+  for (int p = 0; p < CDT_MAX_MACHINES; p++)
+    pte->read_set[p] = 0;
+
+  if (cdt_host_protect_page(page_addr, READ_WRITE_PAGE) != 0)
+    return -1;
+
+  pte->writer = host->self_id;
+  return 0;
+}
+
+/**
+ * Bring the pages from start to start + num_pages that this machine is the home of up to date, or take
+ * R/W access to them if write is nonzero, recalling them from all of their writers and readers at once.
+ */
+int cdt_fault_home_range(cdt_host_t *host, int start, int num_pages, int write) {
+  if (write && cdt_fault_check_writable(host, start, num_pages) != 0)
+    return -1;
+
+  uint8_t wanted[CDT_PACKET_RANGE_MAX_PAGES / 8];
+  assert(num_pages <= CDT_PACKET_RANGE_MAX_PAGES);
+  memset(wanted, 0, sizeof(wanted));
+
+  for (int i = 0; i < num_pages; i++) {
+    cdt_manager_pte_t *pte = &host->manager_pagetable[start + i];
+    if (cdt_host_home(host, start + i) != host->self_id || !pte->in_use ||
+        (pte->flags & CDT_MALLOC_MULTIPLE_WRITER) || pte->writer == host->self_id || (!write && pte->writer < 0))
+      continue;
+
+    wanted[i / 8] |= 1 << (i % 8);
+  }
+
+  if (cdt_worker_recall_range(host, host->self_id, start, num_pages, wanted, write) != 0)
+    return -1;
+
+  for (int i = 0; write && i < num_pages; i++) {
+    cdt_manager_pte_t *pte = &host->manager_pagetable[start + i];
+    if (!(wanted[i / 8] & (1 << (i % 8))))
+      continue;
+
+    if (cdt_host_protect_page(pte->shared_va, READ_WRITE_PAGE) != 0)
+      return -1;
+
+    pte->read_set[host->self_id] = 0;
+    pte->writer = host->self_id;
+    cdt_worker_next_version(host, pte);
+  }
+
+  return 0;
+}
+
+int cdt_fault_own_range(cdt_host_t *host, int start, int num_pages, int overwrite) {
+  for (int chunk = start; chunk < start + num_pages; chunk += CDT_PACKET_RANGE_MAX_PAGES) {
+    int chunk_pages = start + num_pages - chunk;
+    if (chunk_pages > CDT_PACKET_RANGE_MAX_PAGES)
+      chunk_pages = CDT_PACKET_RANGE_MAX_PAGES;
+
+    if (cdt_fault_home_range(host, chunk, chunk_pages, 1) != 0)
+      return -1;
+  }
+
+  return cdt_fault_fetch_range(host, start, num_pages, 1, overwrite);
+}
+
+int cdt_fault_read(cdt_host_t *host, int idx) {
+  return cdt_host_home(host, idx) == host->self_id ? cdt_fault_read_home(host, idx) : cdt_fault_read_peer(host, idx);
+}
+
+int cdt_fault_write(cdt_host_t *host, int idx) {
+  if (cdt_fault_check_writable(host, idx, 1) != 0)
+    return -1;
+
+  return cdt_host_home(host, idx) == host->self_id ? cdt_fault_write_home(host, idx) : cdt_fault_write_peer(host, idx);
+}
+
+int cdt_fault_block(cdt_host_t *host, int start, int num_pages, int write) {
+  if (num_pages == 1)
+    return write ? cdt_fault_write(host, start) : cdt_fault_read(host, start);
+
+  // Ask the block's home for all of it at once, then fault in whatever it could not send
+  if (cdt_host_home(host, start) == host->self_id) {
+    if (cdt_fault_home_range(host, start, num_pages, write) != 0)
+      return -1;
+  } else if ((write ? cdt_fault_write_range(host, start, num_pages) : cdt_fault_read_range(host, start, num_pages)) != 0) {
+    return -1;
+  }
+
+  for (int i = start; i < start + num_pages; i++) {
+    if ((write ? cdt_fault_write(host, i) : cdt_fault_read(host, i)) != 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+int cdt_fault_frozen_copy(cdt_host_t *host, int idx) {
+  // A marked copy that is taken away after all faults back in when it is read
+  if (__atomic_load_n(&host->marked[idx], __ATOMIC_ACQUIRE))
+    return host->shared_pagetable[idx].access == READ_ONLY_PAGE;
+
+  if (!__atomic_load_n(&host->frozen[idx], __ATOMIC_ACQUIRE))
+    return 0;
+
+  // The home of a frozen page always holds it, and nobody else ever loses their copy of it
+  return cdt_host_home(host, idx) == host->self_id || host->shared_pagetable[idx].access == READ_ONLY_PAGE;
+}
+
+void cdt_fault_mark_frozen(cdt_host_t *host, int start, int num_pages, int frozen) {
+  for (int i = start; i < start + num_pages && i < CDT_MAX_SHARED_PAGES; i++) {
+    if (!frozen || cdt_host_home(host, i) != host->self_id)
+      __atomic_store_n(&host->marked[i], frozen ? 1 : 0, __ATOMIC_RELEASE);
+  }
+}
+
+int cdt_fault_release_peer(cdt_host_t *host, int idx) {
+  cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+
+  if (!pte->twin)
+    return 0;
+
+  // Send our changes to the page's home, which may take several packets if much of the page was written
+  uint32_t word = 0;
+  while (word < CDT_DIFF_PAGE_WORDS) {
+    cdt_packet_t packet;
+    cdt_packet_diff_req_create(&packet, pte->shared_va, pte->page, pte->twin, &word);
+    if (cdt_connection_send(&host->peers[cdt_host_home(host, idx)].connection, &packet) != 0)
+      return -1;
+
+    if (mq_receive(cdt_host_response_queue(host, host->self_id), (char*)&packet, sizeof(packet), NULL) == -1)
+      return -1;
+
+    uint64_t resp_page_addr;
+    uint32_t requester_id, status;
+    cdt_packet_diff_resp_parse(&packet, &resp_page_addr, &requester_id, &status);
+    assert(requester_id == host->self_id);
+    assert(resp_page_addr == pte->shared_va);
+
+    if (status != 0) {
+      debug_print("Home of page %p could not merge our changes\n", (void*)pte->shared_va);
+      return -1;
+    }
+  }
+
+  free(pte->twin);
+  pte->twin = NULL;
+
+  if (pte->flags & (CDT_MALLOC_RELEASE_CONSISTENT | CDT_MALLOC_WRITE_UPDATE)) {
+    // Our copy stays valid until the next acquire, or is kept current by the home, but further writes
+    // must go through a new twin
+    pte->access = READ_ONLY_PAGE;
+    return cdt_host_protect_page(pte->shared_va, READ_ONLY_PAGE);
+  }
+
+  // Our copy is missing the changes of other writers, so it is refetched on the next access
+  pte->access = INVALID_PAGE;
+  pte->page = NULL;
+  return cdt_host_protect_page(pte->shared_va, INVALID_PAGE);
+}
+
+int cdt_fault_release_home(cdt_host_t *host, int idx) {
+  cdt_manager_pte_t *pte = &host->manager_pagetable[idx];
+
+  if (!pte->in_use || !pte->dirty)
+    return 0;
+
+  if (pte->flags & CDT_MALLOC_WRITE_UPDATE) {
+    // Push our changes to every copy, which may take several packets if much of the page was written
+    uint32_t word = 0;
+    while (word < CDT_DIFF_PAGE_WORDS) {
+      uint8_t diff[CDT_PACKET_DIFF_MAX_SIZE];
+      size_t diff_size = cdt_diff_encode(pte->page, pte->twin, diff, sizeof(diff), &word);
+      if (diff_size > 0 && cdt_worker_push_update(host, pte, host->self_id, diff, diff_size) != 0)
+        return -1;
+    }
+
+    free(pte->twin);
+    pte->twin = NULL;
+  } else if (pte->flags & CDT_MALLOC_RELEASE_CONSISTENT) {
+    cdt_worker_record_write_notice(host, pte, host->self_id);
+  } else if (cdt_worker_invalidate_readers(host, pte, host->self_id) != 0) {
+    return -1;
+  }
+
+  // Write protect the page again so the next write marks it dirty
+  pte->dirty = 0;
+  return cdt_host_protect_page(pte->shared_va, READ_ONLY_PAGE);
+}
+
+int cdt_fault_release(cdt_host_t *host, int idx) {
+  return cdt_host_home(host, idx) == host->self_id ? cdt_fault_release_home(host, idx) : cdt_fault_release_peer(host, idx);
+}
+
+int cdt_fault_invalidate(cdt_host_t *host, int idx) {
+  cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+
+  if (cdt_fault_release_peer(host, idx) != 0)
+    return -1;
+
+  if (pte->access == INVALID_PAGE)
+    return 0;
+
+  pte->access = INVALID_PAGE;
+  pte->page = NULL;
+  return cdt_host_protect_page(pte->shared_va, INVALID_PAGE);
+}
+
+int cdt_fault_acquire(cdt_host_t *host, const cdt_page_range_t *ranges, uint32_t num_ranges) {
+  // Each home keeps track of the stale copies of its own pages, so ask all of them at once
+  cdt_packet_t packet;
+  cdt_packet_acquire_req_create(&packet, ranges, num_ranges);
+  uint32_t pending = 0;
+  for (uint32_t i = 0; i < host->num_machines; i++) {
+    if (i == host->self_id)
+      continue;
+
+    if (cdt_connection_send(&host->peers[i].connection, &packet) != 0) {
+      debug_print("Failed to send acquire request packet to peer %d\n", i);
+      return -1;
+    }
+    pending++;
+  }
+
+  // Stale pages are only invalidated once every response has arrived, since invalidating a page we
+  // have written to sends its changes to its home and waits for a reply on the same queue
+  uint32_t stale[CDT_MAX_SHARED_PAGES];
+  uint32_t num_stale = 0;
+
+  while (pending > 0) {
+    if (mq_receive(cdt_host_response_queue(host, host->self_id), (char*)&packet, sizeof(packet), NULL) == -1) {
+      debug_print("Failed to receive acquire response\n");
+      return -1;
+    }
+
+    uint32_t requester_id, more, *pages, num_pages;
+    cdt_packet_acquire_resp_parse(&packet, &requester_id, &more, &pages, &num_pages);
+    assert(requester_id == host->self_id);
+
+    // Each home only reports its own pages, and each of them once
+    for (uint32_t i = 0; i < num_pages && num_stale < CDT_MAX_SHARED_PAGES; i++) {
+      if (pages[i] < CDT_MAX_SHARED_PAGES)
+        stale[num_stale++] = pages[i];
+    }
+
+    if (!more)
+      pending--;
+  }
+
+  int res = 0;
+  for (uint32_t n = 0; n < num_stale; n++) {
+    uint32_t i = stale[n];
+    if (cdt_host_home(host, i) == host->self_id)
+      continue;
+
+    pthread_mutex_lock(&host->shared_pagetable[i].lock);
+    if (cdt_fault_invalidate(host, i) != 0) {
+      debug_print("Failed to invalidate stale shared page %d\n", i);
+      res = -1;
+    }
+    pthread_mutex_unlock(&host->shared_pagetable[i].lock);
+  }
+
+  return res;
+}
+
+int cdt_fault_halo(cdt_host_t *host, int idx) {
+  // No home keeps track of halo pages, so this machine's copy always lives in its shared pagetable
+  cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+  pthread_mutex_lock(&pte->lock);
+
+  int res = 0;
+  if (!pte->in_use || pte->access != READ_WRITE_PAGE) {
+    pte->page = cdt_host_map_page(pte->shared_va, NULL, READ_WRITE_PAGE);
+    if (pte->page) {
+      pte->in_use = 1;
+      pte->access = READ_WRITE_PAGE;
+      pte->flags = CDT_MALLOC_HALO;
+    } else {
+      res = -1;
+    }
+  }
+
+  pthread_mutex_unlock(&pte->lock);
+  return res;
+}
+
+int cdt_fault_is_write(cdt_host_t *host, int idx, ucontext_t *context) {
+#if defined(__x86_64__)
+  // Bit 1 of the page fault error code is set when the faulting access was a write
+  return (context->uc_mcontext.gregs[REG_ERR] & 0x2) != 0;
+#else
+  // Without the error code, a fault on a page we can already read must have been a write
+  if (cdt_host_home(host, idx) == host->self_id)
+    return host->manager_pagetable[idx].writer < 0;
+
+  return host->shared_pagetable[idx].access == READ_ONLY_PAGE;
+#endif
+}
+
+/* A fault handed from the signal handler to the fault thread, which lives on the faulting thread's stack */
+typedef struct cdt_fault_request_t {
+  void *addr;
+  ucontext_t *context;
+  /* Set by the fault thread to 0 if the page is now mapped, -1 otherwise */
+  int res;
+  /* Set to 1 by the fault thread once res is set. The faulting thread sleeps on it as a futex. */
+  int done;
+} cdt_fault_request_t;
+
+/* Carries pointers to cdt_fault_request_t from the signal handler to the fault thread */
+static int cdt_fault_pipe[2];
+
+static const char* const cdt_fault_queue_name = "/coordinate_fault";
+
+void cdt_fault_lock(cdt_host_t *host) {
+  pthread_mutex_lock(&host->fault_lock);
+}
+
+void cdt_fault_unlock(cdt_host_t *host) {
+  pthread_mutex_unlock(&host->fault_lock);
+}
+
+/**
+ * Map the shared page at addr with enough access for the access described by context to succeed.
+ */
+int cdt_fault_resolve(cdt_host_t *host, void *addr, ucontext_t *context) {
+  int idx = SHARED_VA_TO_IDX(addr);
+  if (__atomic_load_n(&host->halo[idx], __ATOMIC_ACQUIRE))
+    return cdt_fault_halo(host, idx);
+
+  int block_start, block_pages;
+  cdt_host_block(host, idx, &block_start, &block_pages);
+
+  // The responses to our requests go to the fault queue until we are done
+  cdt_fault_lock(host);
+  __atomic_store_n(&host->faulting, 1, __ATOMIC_RELEASE);
+
+  // The whole coherence block is brought in at once, so lock every page in it in order
+  pthread_mutex_t *locks[1 << CDT_MALLOC_MAX_BLOCK_SHIFT];
+  for (int i = 0; i < block_pages; i++)
+    locks[i] = cdt_host_lock_page(host, block_start + i);
+
+  int res = cdt_fault_block(host, block_start, block_pages, cdt_fault_is_write(host, idx, context));
+
+  for (int i = 0; i < block_pages; i++)
+    pthread_mutex_unlock(locks[i]);
+
+  __atomic_store_n(&host->faulting, 0, __ATOMIC_RELEASE);
+  cdt_fault_unlock(host);
+
+  if (res != 0)
+    debug_print("Failed to resolve fault at %p\n", addr);
+
+  return res;
+}
+
+/**
+ * Resolve the faults handed over by the signal handler. Resolving a fault takes locks, allocates twins
+ * and waits for other machines, none of which may be done inside a signal handler.
+ */
+void* cdt_fault_thread_start(void *arg) {
+  cdt_fault_request_t *request;
+  while (read(cdt_fault_pipe[0], &request, sizeof(request)) == sizeof(request)) {
+    request->res = cdt_fault_resolve(cdt_get_host(), request->addr, request->context);
+
+    // The request is gone as soon as the faulting thread sees done, so waking an address it no longer
+    // sleeps on is harmless
+    int *done = &request->done;
+    __atomic_store_n(done, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, done, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+
+  debug_print("Fault thread stopped\n");
+  return NULL;
+}
+
+void cdt_fault_handler(int signal, siginfo_t *info, void *context) {
+  // Only async-signal-safe calls may be made here, so the fault is handed to the fault thread and we
+  // sleep until it has been resolved
+  int saved_errno = errno;
+  cdt_host_t *host = cdt_get_host();
+
+  if (host && IS_SHARED_VA(info->si_addr)) {
+    cdt_fault_request_t request = {
+      .addr = info->si_addr,
+      .context = (ucontext_t*)context,
+      .res = -1,
+      .done = 0,
+    };
+    cdt_fault_request_t *pointer = &request;
+
+    if (write(cdt_fault_pipe[1], &pointer, sizeof(pointer)) == sizeof(pointer)) {
+      while (!__atomic_load_n(&request.done, __ATOMIC_ACQUIRE))
+        syscall(SYS_futex, &request.done, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+    }
+
+    if (request.res == 0) {
+      errno = saved_errno;
+      return; // the faulting access will be retried now that the page is mapped
+    }
+  }
+
+  // Not a fault we can resolve, so restore the previous action and let the access fault again
+  sigaction(SIGSEGV, &cdt_fault_default_action, NULL);
+  errno = saved_errno;
+}
+
+int cdt_fault_init() {
+  cdt_host_t *host = cdt_get_host();
+
+  if (pipe(cdt_fault_pipe) != 0) {
+    debug_print("Failed to create fault pipe\n");
+    return -1;
+  }
+
+  struct mq_attr fault_queue_attr = {
+    .mq_maxmsg = 10,
+    .mq_msgsize = sizeof(cdt_packet_t),
+  };
+
+  mq_unlink(cdt_fault_queue_name); // close any lingering message queue
+  host->fault_queue = mq_open(cdt_fault_queue_name, O_RDWR | O_CREAT, 0660, &fault_queue_attr);
+  if (host->fault_queue == -1) {
+    debug_print("Failed to create fault queue %s\n", cdt_fault_queue_name);
+    return -1;
+  }
+
+  if (pthread_mutex_init(&host->fault_lock, NULL) != 0) {
+    debug_print("Failed to initialize fault lock\n");
+    return -1;
+  }
+
+  if (pthread_create(&host->fault_thread, NULL, cdt_fault_thread_start, NULL) != 0) {
+    debug_print("Failed to start fault thread\n");
+    return -1;
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = cdt_fault_handler;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+
+  if (sigaction(SIGSEGV, &action, &cdt_fault_default_action) != 0) {
+    debug_print("Failed to install shared memory fault handler\n");
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "packet.h"
+#include "coordinate.h"
+
+#ifndef COORDINATE_LOCAL
+/**
+ * Add a slice of len bytes at addr, exchanged with the machine running thread, to the num_slices slices.
+ */
+int cdt_halo_declare(cdt_host_t *host, cdt_halo_slice_t *slices, int *num_slices, void *addr, size_t len,
+                     const cdt_thread_t *thread) {
+  uint32_t machine = thread->remote_peer_id;
+  if (machine >= host->num_machines || machine == host->self_id) {
+    debug_print("Halo slices can only be exchanged with threads on other machines\n");
+    return -1;
+  }
+
+  if (len == 0 || len > UINT32_MAX || !IS_SHARED_VA(addr) || !IS_SHARED_VA((char*)addr + len - 1)) {
+    debug_print("Halo slices must be in shared memory\n");
+    return -1;
+  }
+
+  for (uint64_t i = SHARED_VA_TO_IDX(addr); i <= SHARED_VA_TO_IDX((char*)addr + len - 1); i++) {
+    if (!__atomic_load_n(&host->halo[i], __ATOMIC_ACQUIRE)) {
+      debug_print("Halo slices must be allocated with CDT_MALLOC_HALO\n");
+      return -1;
+    }
+  }
+
+  if (*num_slices >= CDT_MAX_HALO_SLICES) {
+    debug_print("Maximum number of halo slices exceeded\n");
+    return -1;
+  }
+
+  cdt_halo_slice_t *slice = &slices[(*num_slices)++];
+  slice->addr = (uint64_t)addr;
+  slice->size = len;
+  slice->machine = machine;
+  return 0;
+}
+
+/**
+ * Copy size bytes between buffer and the slices exchanged with machine, starting offset bytes into all
+ * of them laid end to end. The bytes are copied out of the slices if gather is nonzero, and into them
+ * otherwise.
+ */
+void cdt_halo_copy(const cdt_halo_slice_t *slices, int num_slices, uint32_t machine, uint32_t offset, uint8_t *buffer,
+                   uint32_t size, int gather) {
+  uint32_t position = 0;
+  for (int i = 0; i < num_slices && size > 0; i++) {
+    const cdt_halo_slice_t *slice = &slices[i];
+    if (slice->machine != machine)
+      continue;
+
+    if (offset < position + slice->size) {
+      uint32_t start = offset - position;
+      uint32_t length = slice->size - start < size ? slice->size - start : size;
+      uint8_t *halo = (uint8_t*)slice->addr + start;
+      memmove(gather ? buffer : halo, gather ? halo : buffer, length);
+
+      buffer += length;
+      offset += length;
+      size -= length;
+    }
+
+    position += slice->size;
+  }
+}
+
+/**
+ * Get the total size of the slices exchanged with machine.
+ */
+uint32_t cdt_halo_total(const cdt_halo_slice_t *slices, int num_slices, uint32_t machine) {
+  uint32_t total = 0;
+  for (int i = 0; i < num_slices; i++) {
+    if (slices[i].machine == machine)
+      total += slices[i].size;
+  }
+
+  return total;
+}
+#endif
+
+int cdt_halo_send(void *addr, size_t len, const cdt_thread_t *reader) {
+#ifdef COORDINATE_LOCAL
+  return 0;
+#else
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet started\n");
+    return -1;
+  }
+
+  return cdt_halo_declare(host, host->halo_sends, &host->num_halo_sends, addr, len, reader);
+#endif
+}
+
+int cdt_halo_receive(void *addr, size_t len, const cdt_thread_t *writer) {
+#ifdef COORDINATE_LOCAL
+  return 0;
+#else
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet started\n");
+    return -1;
+  }
+
+  return cdt_halo_declare(host, host->halo_receives, &host->num_halo_receives, addr, len, writer);
+#endif
+}
+
+int cdt_halo_exchange() {
+#ifdef COORDINATE_LOCAL
+  return 0;
+#else
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet started\n");
+    return -1;
+  }
+
+  // Every slice for a machine goes out together, packed into as few packets as they fit in
+  cdt_packet_t packet;
+  for (uint32_t p = 0; p < host->num_machines; p++) {
+    uint32_t total = cdt_halo_total(host->halo_sends, host->num_halo_sends, p);
+    for (uint32_t offset = 0; offset < total; offset += CDT_PACKET_HALO_MAX_SIZE) {
+      uint8_t data[CDT_PACKET_HALO_MAX_SIZE];
+      uint32_t size = total - offset < CDT_PACKET_HALO_MAX_SIZE ? total - offset : CDT_PACKET_HALO_MAX_SIZE;
+      cdt_halo_copy(host->halo_sends, host->num_halo_sends, p, offset, data, size, 1);
+
+      cdt_packet_halo_push_req_create(&packet, offset, total, data, size);
+      if (cdt_connection_send(&host->peers[p].connection, &packet) != 0) {
+        debug_print("Failed to send halo push packet to peer %d\n", p);
+        return -1;
+      }
+    }
+  }
+
+  // Our neighbours' slices are only copied into place now, so they never change while we are reading them
+  int res = 0;
+  for (uint32_t p = 0; p < host->num_machines; p++) {
+    uint32_t total = cdt_halo_total(host->halo_receives, host->num_halo_receives, p);
+    if (total == 0)
+      continue;
+
+    cdt_host_halo_inbox_t *inbox = &host->halo_inboxes[p];
+    pthread_mutex_lock(&inbox->lock);
+    while (!inbox->head || inbox->head->received < inbox->head->total)
+      pthread_cond_wait(&inbox->cond, &inbox->lock);
+
+    cdt_host_halo_exchange_t *exchange = inbox->head;
+    inbox->head = exchange->next;
+    if (!inbox->head)
+      inbox->tail = NULL;
+    pthread_mutex_unlock(&inbox->lock);
+
+    // The exchange is ours alone now, so the worker can queue the next one while we copy this one
+    if (exchange->total == total) {
+      cdt_halo_copy(host->halo_receives, host->num_halo_receives, p, 0, exchange->data, total, 0);
+    } else {
+      debug_print("Peer %d sent %u bytes of halo slices where %u were declared\n", p, exchange->total, total);
+      res = -1;
+    }
+
+    pthread_mutex_lock(&inbox->lock);
+    if (!inbox->spare) {
+      inbox->spare = exchange;
+      exchange = NULL;
+    }
+    pthread_mutex_unlock(&inbox->lock);
+
+    if (exchange) {
+      free(exchange->data);
+      free(exchange);
+    }
+  }
+
+  return res;
+#endif
+}
+
+void cdt_halo_clear() {
+#ifndef COORDINATE_LOCAL
+  cdt_host_t *host = cdt_get_host();
+  if (!host)
+    return;
+
+  host->num_halo_sends = 0;
+  host->num_halo_receives = 0;
+#endif
+}
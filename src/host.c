@@ -1,11 +1,16 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/mman.h>
 #include "server.h"
 #include "connection.h"
 #include "packet.h"
 #include "host.h"
+#include "diff.h"
+#include "fault.h"
 
 cdt_host_t cdt_host = {
   .manager = -1
@@ -76,7 +81,7 @@ void* cdt_host_thread(void *arg) {
       cdt_packet_self_identify_parse(&packet, &address, &port);
 
       cdt_packet_t auxiliary_packet;
-      cdt_packet_peer_id_assign_create(&auxiliary_packet, peer->id);
+      cdt_packet_peer_id_assign_create(&auxiliary_packet, peer->id, cdt_host.num_machines, cdt_connection_get_compression());
 
       if (cdt_connection_send(&connection, &auxiliary_packet) != 0) {
         fprintf(stderr, "Failed to send assign id packet to %s:%d\n", connection.address, connection.port);
@@ -146,6 +151,128 @@ void* cdt_host_thread(void *arg) {
   return NULL;
 }
 
+void* cdt_host_lease_thread(void *arg) {
+  uint32_t seen = 0;
+
+  pthread_mutex_lock(&cdt_host.lease_lock);
+  while (1) {
+    // Sleep until the next lease runs out or request is due, or until either of them changes
+    uint64_t next = 0;
+    while (seen == cdt_host.lease_changes) {
+      if (next == 0) {
+        pthread_cond_wait(&cdt_host.lease_cond, &cdt_host.lease_lock);
+      } else {
+        uint64_t now = cdt_host_now();
+        if (next <= now)
+          break;
+
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_sec += (next - now) / 1000;
+        until.tv_nsec += (next - now) % 1000 * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+          until.tv_sec++;
+          until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&cdt_host.lease_cond, &cdt_host.lease_lock, &until);
+      }
+    }
+    seen = cdt_host.lease_changes;
+
+    // Take out the requests that are due, which are sent back to their workers without the lock held
+    uint64_t now = cdt_host_now();
+    cdt_host_parked_t *due = NULL;
+    for (cdt_host_parked_t **entry = &cdt_host.parked; *entry;) {
+      cdt_host_parked_t *parked = *entry;
+      if (parked->due <= now) {
+        *entry = parked->next;
+        parked->next = due;
+        due = parked;
+      } else {
+        if (!next || parked->due < next)
+          next = parked->due;
+        entry = &parked->next;
+      }
+    }
+    pthread_mutex_unlock(&cdt_host.lease_lock);
+
+    while (due) {
+      cdt_host_parked_t *parked = due;
+      due = parked->next;
+      if (mq_send(cdt_host.peers[parked->sender_id].task_queue, (char*)&parked->packet, sizeof(parked->packet), 0) == -1)
+        debug_print("Failed to hand a parked request back to peer %d's worker thread\n", parked->sender_id);
+      free(parked);
+    }
+
+    // Drop the copies whose leases have run out, and keep track of the rest
+    uint32_t pages[CDT_MAX_SHARED_PAGES];
+    uint32_t num_pages = cdt_host_take_pages(&cdt_host.leased_pages, pages, NULL, 0);
+    for (uint32_t n = 0; n < num_pages; n++) {
+      int i = pages[n];
+      cdt_host_pte_t *pte = &cdt_host.shared_pagetable[i];
+      uint64_t expiry = __atomic_load_n(&pte->lease_expiry, __ATOMIC_RELAXED);
+      if (!expiry)
+        continue;
+
+      // A locked PTE is being changed by a fault or a request from the home, so it is tried again shortly
+      if (expiry > now || pthread_mutex_trylock(&pte->lock) != 0) {
+        uint64_t retry = expiry > now ? expiry : now + CDT_LEASE_SLACK_MS / 2;
+        if (!next || retry < next)
+          next = retry;
+        cdt_host_list_page(&cdt_host.leased_pages, i);
+        continue;
+      }
+
+      if (pte->in_use && pte->access == READ_ONLY_PAGE && pte->lease_expiry && pte->lease_expiry <= now &&
+          cdt_fault_invalidate(&cdt_host, i) != 0)
+        debug_print("Failed to drop the leased copy of shared page %d\n", i);
+      __atomic_store_n(&pte->lease_expiry, 0, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&pte->lock);
+    }
+
+    pthread_mutex_lock(&cdt_host.lease_lock);
+  }
+
+  return NULL;
+}
+
+/**
+ * Wake the lease thread, so it sees a lease or request that may run out before the one it sleeps until.
+ */
+void cdt_host_wake_lease_thread(cdt_host_t *host) {
+  pthread_mutex_lock(&host->lease_lock);
+  host->lease_changes++;
+  pthread_cond_signal(&host->lease_cond);
+  pthread_mutex_unlock(&host->lease_lock);
+}
+
+void cdt_host_start_lease(cdt_host_t *host, int idx, uint64_t expiry) {
+  __atomic_store_n(&host->shared_pagetable[idx].lease_expiry, expiry, __ATOMIC_RELAXED);
+  if (!expiry)
+    return;
+
+  cdt_host_list_page(&host->leased_pages, idx);
+  cdt_host_wake_lease_thread(host);
+}
+
+int cdt_host_park(cdt_host_t *host, uint32_t sender_id, const cdt_packet_t *packet, uint64_t due) {
+  cdt_host_parked_t *parked = malloc(sizeof(*parked));
+  if (!parked)
+    return -1;
+
+  parked->sender_id = sender_id;
+  parked->due = due;
+  parked->packet = *packet;
+
+  pthread_mutex_lock(&host->lease_lock);
+  parked->next = host->parked;
+  host->parked = parked;
+  host->lease_changes++;
+  pthread_cond_signal(&host->lease_cond);
+  pthread_mutex_unlock(&host->lease_lock);
+  return 0;
+}
+
 cdt_host_t* cdt_host_init(int manager, cdt_server_t *server, uint32_t peers_to_be_connected) {
   if (cdt_host.manager != -1)
     return NULL;
@@ -154,6 +281,8 @@ cdt_host_t* cdt_host_init(int manager, cdt_server_t *server, uint32_t peers_to_b
   cdt_host.server = server;
   cdt_host.peers_to_be_connected = peers_to_be_connected;
   cdt_host.num_peers = manager ? 1 : 2;
+  if (manager) // peers learn the size of the cluster when they are assigned an id
+    cdt_host.num_machines = __builtin_popcount(peers_to_be_connected) + 1;
 
   void *addr = mmap((void*)CDT_SHARED_VA_START, CDT_MAX_SHARED_PAGES * PAGESIZE, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, -1, 0);
   if (addr != (void*)CDT_SHARED_VA_START) {
@@ -161,22 +290,62 @@ cdt_host_t* cdt_host_init(int manager, cdt_server_t *server, uint32_t peers_to_b
     return NULL;
   }
   
-  // Initialize all the locks and virtual addresses for appropriate pagetable
-  if (manager) {
-    for (int i = 0; i < CDT_MAX_SHARED_PAGES; i++) {
-      if (pthread_mutex_init(&cdt_host.manager_pagetable[i].lock, NULL) != 0) { 
-        debug_print("Failed to init lock for manager PTE index %d\n", i);
-        return NULL;
-      } 
-      cdt_host.manager_pagetable[i].shared_va = i * PAGESIZE + CDT_SHARED_VA_START;
+  // Initialize all the locks and virtual addresses for both pagetables, since every machine is the home for some pages
+  for (int i = 0; i < CDT_MAX_SHARED_PAGES; i++) {
+    if (pthread_mutex_init(&cdt_host.manager_pagetable[i].lock, NULL) != 0 ||
+        pthread_mutex_init(&cdt_host.shared_pagetable[i].lock, NULL) != 0 ||
+        pthread_mutex_init(&cdt_host.shared_pagetable[i].fetch_lock, NULL) != 0) { 
+      debug_print("Failed to init locks for PTE index %d\n", i);
+      return NULL;
+    } 
+    cdt_host.manager_pagetable[i].shared_va = i * PAGESIZE + CDT_SHARED_VA_START;
+    cdt_host.shared_pagetable[i].shared_va = i * PAGESIZE + CDT_SHARED_VA_START;
+    cdt_host.homes[i] = -1;
+  }
+
+  for (int i = 0; i < CDT_MAX_OBJECTS; i++) {
+    if (pthread_mutex_init(&cdt_host.manager_objects[i].lock, NULL) != 0 ||
+        pthread_mutex_init(&cdt_host.objects[i].lock, NULL) != 0) {
+      debug_print("Failed to init locks for object %d\n", i);
+      return NULL;
     }
-  } else {
-    for (int i = 0; i < CDT_MAX_SHARED_PAGES; i++) {
-      if (pthread_mutex_init(&cdt_host.shared_pagetable[i].lock, NULL) != 0) { 
-        debug_print("Failed to init lock for manager PTE index %d\n", i);
+  }
+
+  for (int i = 0; i < CDT_MAX_MACHINES; i++) {
+    if (pthread_mutex_init(&cdt_host.halo_inboxes[i].lock, NULL) != 0 ||
+        pthread_cond_init(&cdt_host.halo_inboxes[i].cond, NULL) != 0) {
+      debug_print("Failed to init halo inbox for machine %d\n", i);
+      return NULL;
+    }
+
+    if (pthread_mutex_init(&cdt_host.write_notices[i].lock, NULL) != 0) {
+      debug_print("Failed to init write notices for machine %d\n", i);
+      return NULL;
+    }
+  }
+
+  if (pthread_mutex_init(&cdt_host.release_pages.lock, NULL) != 0) {
+    debug_print("Failed to init release list\n");
+    return NULL;
+  }
+
+  // The lease thread sleeps until leases run out as timed by cdt_host_now
+  pthread_condattr_t lease_cond_attr;
+  if (pthread_mutex_init(&cdt_host.leased_pages.lock, NULL) != 0 ||
+      pthread_mutex_init(&cdt_host.lease_lock, NULL) != 0 ||
+      pthread_condattr_init(&lease_cond_attr) != 0 ||
+      pthread_condattr_setclock(&lease_cond_attr, CLOCK_MONOTONIC) != 0 ||
+      pthread_cond_init(&cdt_host.lease_cond, &lease_cond_attr) != 0) {
+    debug_print("Failed to init leases\n");
+    return NULL;
+  }
+
+  if (manager) {
+    for (int i = 0; i < CDT_MAX_LOCKS; i++) {
+      if (pthread_mutex_init(&cdt_host.manager_locks[i].lock, NULL) != 0) {
+        debug_print("Failed to init lock for manager lock table index %d\n", i);
         return NULL;
-      } 
-      cdt_host.shared_pagetable[i].shared_va = i * PAGESIZE + CDT_SHARED_VA_START;
+      }
     }
   }
 
@@ -192,10 +361,155 @@ cdt_host_t* cdt_host_init(int manager, cdt_server_t *server, uint32_t peers_to_b
   return &cdt_host;
 }
 
+uint64_t cdt_host_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint32_t cdt_host_home(const cdt_host_t *host, int idx) {
+  int home = __atomic_load_n(&host->homes[idx], __ATOMIC_ACQUIRE);
+  if (home >= 0)
+    return home;
+
+  return host->num_machines ? idx % host->num_machines : 0;
+}
+
+void cdt_host_block(const cdt_host_t *host, int idx, int *start, int *num_pages) {
+  *num_pages = 1 << host->block_shifts[idx];
+  *start = idx & ~(*num_pages - 1);
+}
+
+void cdt_host_list_page(cdt_host_page_list_t *list, uint32_t idx) {
+  pthread_mutex_lock(&list->lock);
+  if (!list->listed[idx]) {
+    list->listed[idx] = 1;
+    list->pages[list->num_pages++] = idx;
+  }
+  pthread_mutex_unlock(&list->lock);
+}
+
+uint32_t cdt_host_take_pages(cdt_host_page_list_t *list, uint32_t *pages, const cdt_page_range_t *ranges,
+                             uint32_t num_ranges) {
+  pthread_mutex_lock(&list->lock);
+
+  // Pages outside the ranges keep their order at the front of the list
+  uint32_t num_taken = 0, num_kept = 0;
+  for (uint32_t i = 0; i < list->num_pages; i++) {
+    uint32_t idx = list->pages[i];
+    int taken = !ranges;
+    for (uint32_t r = 0; r < num_ranges && !taken; r++)
+      taken = idx >= ranges[r].start && idx - ranges[r].start < ranges[r].num_pages;
+
+    if (taken) {
+      list->listed[idx] = 0;
+      pages[num_taken++] = idx;
+    } else {
+      list->pages[num_kept++] = idx;
+    }
+  }
+  list->num_pages = num_kept;
+
+  pthread_mutex_unlock(&list->lock);
+  return num_taken;
+}
+
+pthread_mutex_t* cdt_host_page_lock(cdt_host_t *host, int idx) {
+  if (cdt_host_home(host, idx) == host->self_id)
+    return &host->manager_pagetable[idx].lock;
+
+  return &host->shared_pagetable[idx].lock;
+}
+
+pthread_mutex_t* cdt_host_lock_page(cdt_host_t *host, int idx) {
+  while (1) {
+    pthread_mutex_t *lock = cdt_host_page_lock(host, idx);
+    pthread_mutex_lock(lock);
+
+    // The home only moves while the PTE it is moving from is locked
+    if (lock == cdt_host_page_lock(host, idx))
+      return lock;
+
+    pthread_mutex_unlock(lock);
+  }
+}
+
+mqd_t cdt_host_response_queue(cdt_host_t *host, uint32_t requester_id) {
+  if (requester_id == host->self_id && pthread_equal(pthread_self(), host->fault_thread))
+    return host->fault_queue;
+
+  return host->peers[requester_id].task_queue;
+}
+
+void* cdt_host_map_page(uint64_t shared_va, const void *contents, int access) {
+  void *page = (void*)shared_va;
+
+  // A copy that is already in place only needs its protection changed
+  if (contents == page)
+    return cdt_host_protect_page(shared_va, access) == 0 ? page : NULL;
+
+  // The new copy is filled in a private page and moved into place already protected, so other threads
+  // on this machine never see it half filled or writable when it should not be
+  void *staging = mmap(NULL, PAGESIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (staging == MAP_FAILED) {
+    debug_print("Failed to map a staging page for %p\n", page);
+    return NULL;
+  }
+
+  if (contents)
+    memcpy(staging, contents, PAGESIZE);
+
+  if (access != READ_WRITE_PAGE && cdt_host_protect_page((uint64_t)staging, access) != 0) {
+    munmap(staging, PAGESIZE);
+    return NULL;
+  }
+
+  if (mremap(staging, PAGESIZE, PAGESIZE, MREMAP_MAYMOVE | MREMAP_FIXED, page) == MAP_FAILED) {
+    debug_print("Failed to move the staging page into place at %p\n", page);
+    munmap(staging, PAGESIZE);
+    return NULL;
+  }
+
+  return page;
+}
+
+void* cdt_host_patch_page(uint64_t shared_va, const void *diff, size_t size, int access) {
+  // Our copy must stay readable while it is copied, but it is never made writable
+  uint8_t contents[PAGESIZE];
+  if (cdt_host_protect_page(shared_va, READ_ONLY_PAGE) != 0)
+    return NULL;
+
+  memcpy(contents, (void*)shared_va, PAGESIZE);
+  if (cdt_diff_apply(contents, diff, size) != 0) {
+    cdt_host_protect_page(shared_va, access);
+    return NULL;
+  }
+
+  return cdt_host_map_page(shared_va, contents, access);
+}
+
+int cdt_host_protect_page(uint64_t shared_va, int access) {
+  int prot = PROT_NONE;
+  if (access == READ_ONLY_PAGE)
+    prot = PROT_READ;
+  else if (access == READ_WRITE_PAGE)
+    prot = PROT_READ | PROT_WRITE;
+
+  if (mprotect((void*)shared_va, PAGESIZE, prot) != 0) {
+    debug_print("Failed to protect shared page %p\n", (void*)shared_va);
+    return -1;
+  }
+
+  return 0;
+}
+
 int cdt_host_start() {
   if (cdt_host.manager == -1)
     return -1;
 
+  if (pthread_create(&cdt_host.lease_thread, NULL, cdt_host_lease_thread, NULL) != 0)
+    return -1;
+
   return pthread_create(&cdt_host.server_thread, NULL, cdt_host_thread, NULL);
 }
 
@@ -9,6 +9,7 @@
 #include "packet.h"
 #include "host.h"
 #include "init.h"
+#include "fault.h"
 
 int cdt_init_get_args(char ***_argv) {
   int header[3];
@@ -79,7 +80,7 @@ int cdt_init_get_args(char ***_argv) {
 
 int cdt_main(int argc, char **argv) {
   if (argc < 2) {
-    fprintf(stderr, "Usage: %s --host IP:PORT [--cores CORES --connect IP:PORT] COMMAND [COMMAND_ARGS]\n", argv[0]);
+    fprintf(stderr, "Usage: %s --host IP:PORT [--cores CORES [--compress lz|none] --connect IP:PORT] COMMAND [COMMAND_ARGS]\n", argv[0]);
     return -1;
   }
 
@@ -107,6 +108,14 @@ int cdt_main(int argc, char **argv) {
     }
   }
 
+  int compress_index = 0;
+  for (int i = 1; i < argc - 1; i++) {
+    if (strcmp(argv[i], "--compress") == 0) {
+      compress_index = i + 1;
+      break;
+    }
+  }
+
   if (!host_index) {
     fprintf(stderr, "Missing --host option\n");
     return -1;
@@ -150,6 +159,21 @@ int cdt_main(int argc, char **argv) {
     }
   }
 
+  // Peers are told which compression mode to use by the manager when they join
+  if (compress_index) {
+    if (connection_index) {
+      fprintf(stderr, "Only the manager can be given the --compress option\n");
+      return -1;
+    }
+
+    if (strcmp(argv[compress_index], "lz") == 0) {
+      cdt_connection_set_compression(CDT_CONNECTION_COMPRESS_LZ);
+    } else if (strcmp(argv[compress_index], "none") != 0) {
+      fprintf(stderr, "Invalid value for compress: %s\n", argv[compress_index]);
+      return -1;
+    }
+  }
+
   cdt_server_t server;
   if (cdt_server_create(&server, host_address, host_port) == -1) {
     fprintf(stderr, "Cannot create server\n");
@@ -164,6 +188,15 @@ int cdt_main(int argc, char **argv) {
   
   uint32_t core_set = (1 << cores) - 2; // create a set where each bit from 1 to cores is 1, and the 0th bit is 0
   cdt_host_t *host = cdt_host_init(connection_index == 0, &server, core_set);
+  if (!host) {
+    fprintf(stderr, "Cannot initialize host\n");
+    return -1;
+  }
+
+  if (cdt_fault_init() != 0) {
+    fprintf(stderr, "Cannot install shared memory fault handler\n");
+    return -1;
+  }
 
   if (connection_index) {
     cdt_connection_t *manager_connection = &host->peers[0].connection;
@@ -190,7 +223,9 @@ int cdt_main(int argc, char **argv) {
       return -1;
     }
 
-    cdt_packet_peer_id_assign_parse(&packet, &host->self_id);
+    uint32_t compression;
+    cdt_packet_peer_id_assign_parse(&packet, &host->self_id, &host->num_machines, &compression);
+    cdt_connection_set_compression(compression);
 
     printf("Assigned machine id %d\n", host->self_id);
 
@@ -200,7 +235,7 @@ int cdt_main(int argc, char **argv) {
       return -1;
     }
 
-    host->peers_to_be_connected &= ((1 << host->self_id) - 1); // initialize to 1s between 0 (exclusive) and host.self_id (exclusive)
+    host->peers_to_be_connected &= ((1 << host->self_id) - 2); // initialize to 1s between 0 (exclusive) and host.self_id (exclusive)
     host->peers[host->self_id].id = host->self_id;
 
     cdt_peer_start(&host->peers[0]);
@@ -220,6 +255,14 @@ int cdt_main(int argc, char **argv) {
   printf("Peers done connecting\n");
 
   if (!host->manager) {
+    // Every machine with a lower id has connected to us, and we connect to those with higher ids as they join
+    cdt_packet_t packet;
+    cdt_packet_peer_ready_create(&packet);
+    if (cdt_connection_send(&host->peers[0].connection, &packet) != 0) {
+      fprintf(stderr, "Failed to send peer ready packet\n");
+      return -1;
+    }
+
     for (int i = 0; i < host->num_peers; i++) {
       cdt_peer_t *peer = &host->peers[i];
       if (peer->id == host->self_id) continue;
@@ -232,6 +275,15 @@ int cdt_main(int argc, char **argv) {
     exit(0);
   }
 
+  // Pages are requested from their homes directly, so wait until every pair of machines is connected
+  for (int i = 1; i < host->num_machines; i++) {
+    cdt_packet_t packet;
+    if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1 || packet.type != CDT_PACKET_PEER_READY) {
+      fprintf(stderr, "Failed to wait for peers to connect to each other\n");
+      return -1;
+    }
+  }
+
   return 0;
 }
 
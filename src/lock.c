@@ -0,0 +1,205 @@
+#include <mqueue.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "host.h"
+#include "packet.h"
+#include "worker.h"
+#include "fault.h"
+#include "coordinate.h"
+
+int cdt_lock_init(cdt_lock_t *lock) {
+#ifdef COORDINATE_LOCAL
+  return pthread_mutex_init(&lock->local_lock, NULL) == 0 ? 0 : -1;
+#else
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet started\n");
+    return -1;
+  }
+
+  if (host->manager) {
+    int lock_id = cdt_worker_do_lock_create(host);
+    if (lock_id == -1)
+      return -1;
+
+    lock->remote_id = lock_id;
+    return 0;
+  }
+
+  cdt_packet_t packet;
+  cdt_packet_lock_create_req_create(&packet);
+  if (cdt_connection_send(&host->peers[0].connection, &packet) != 0) {
+    debug_print("Failed to send lock create request\n");
+    return -1;
+  }
+
+  if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1) {
+    debug_print("Failed to receive lock create response\n");
+    return -1;
+  }
+
+  uint32_t requester_id, lock_id;
+  cdt_packet_lock_create_resp_parse(&packet, &requester_id, &lock_id);
+  assert(requester_id == host->self_id);
+
+  if (lock_id >= CDT_MAX_LOCKS)
+    return -1;
+
+  lock->remote_id = lock_id;
+  return 0;
+#endif
+}
+
+int cdt_lock_bind(cdt_lock_t *lock, void *addr, size_t size) {
+#ifdef COORDINATE_LOCAL
+  return 0;
+#else
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet started\n");
+    return -1;
+  }
+
+  if (size == 0 || !IS_SHARED_VA(addr) || !IS_SHARED_VA((char*)addr + size - 1)) {
+    debug_print("Can only bind shared memory to a lock\n");
+    return -1;
+  }
+
+  uint32_t start = SHARED_VA_TO_IDX(addr);
+  uint32_t num_pages = SHARED_VA_TO_IDX((char*)addr + size - 1) - start + 1;
+
+  if (host->manager)
+    return cdt_worker_do_lock_bind(host, lock->remote_id, start, num_pages);
+
+  cdt_packet_t packet;
+  cdt_packet_lock_bind_req_create(&packet, lock->remote_id, start, num_pages);
+  if (cdt_connection_send(&host->peers[0].connection, &packet) != 0) {
+    debug_print("Failed to send lock bind request\n");
+    return -1;
+  }
+
+  if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1) {
+    debug_print("Failed to receive lock bind response\n");
+    return -1;
+  }
+
+  uint32_t requester_id, status;
+  cdt_packet_lock_bind_resp_parse(&packet, &requester_id, &status);
+  assert(requester_id == host->self_id);
+
+  return status == 0 ? 0 : -1;
+#endif
+}
+
+int cdt_lock_acquire(cdt_lock_t *lock) {
+#ifdef COORDINATE_LOCAL
+  return pthread_mutex_lock(&lock->local_lock) == 0 ? 0 : -1;
+#else
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet started\n");
+    return -1;
+  }
+
+  uint32_t lock_id = lock->remote_id;
+  if (lock_id >= CDT_MAX_LOCKS)
+    return -1;
+
+  cdt_packet_t packet;
+  if (host->manager) {
+    if (cdt_worker_do_lock_acquire(host, lock_id, host->self_id) != 0)
+      return -1;
+  } else {
+    cdt_packet_lock_acquire_req_create(&packet, lock_id);
+    if (cdt_connection_send(&host->peers[0].connection, &packet) != 0) {
+      debug_print("Failed to send lock acquire request\n");
+      return -1;
+    }
+  }
+
+  // Wait until the lock is granted to us
+  if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1) {
+    debug_print("Failed to receive lock acquire response\n");
+    return -1;
+  }
+
+  cdt_host_lock_t *held = &host->locks[lock_id];
+  uint32_t requester_id, status, num_ranges;
+  cdt_packet_lock_acquire_resp_parse(&packet, &requester_id, &status, held->ranges, &num_ranges);
+  assert(requester_id == host->self_id);
+
+  if (status != 0)
+    return -1;
+
+  held->num_ranges = num_ranges;
+
+  // Discard the copies of the lock's pages that were made stale by other machines' releases
+  cdt_fault_lock(host);
+  if (cdt_fault_acquire(host, held->ranges, held->num_ranges) != 0)
+    debug_print("Failed to discard stale pages guarded by lock %d\n", lock_id);
+
+  // Bring every page guarded by the lock up to date now
+  for (int r = 0; r < held->num_ranges; r++) {
+    for (uint32_t i = held->ranges[r].start; i < held->ranges[r].start + held->ranges[r].num_pages; i++) {
+      pthread_mutex_t *pte_lock = cdt_host_lock_page(host, i);
+      if (cdt_fault_read(host, i) != 0)
+        debug_print("Failed to fetch shared page %d guarded by lock %d\n", i, lock_id);
+      pthread_mutex_unlock(pte_lock);
+    }
+  }
+  cdt_fault_unlock(host);
+
+  return 0;
+#endif
+}
+
+int cdt_lock_release(cdt_lock_t *lock) {
+#ifdef COORDINATE_LOCAL
+  return pthread_mutex_unlock(&lock->local_lock) == 0 ? 0 : -1;
+#else
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet started\n");
+    return -1;
+  }
+
+  uint32_t lock_id = lock->remote_id;
+  if (lock_id >= CDT_MAX_LOCKS)
+    return -1;
+
+  // Publish only the writes made to pages guarded by the lock
+  cdt_host_lock_t *held = &host->locks[lock_id];
+  cdt_fault_lock(host);
+  for (int r = 0; r < held->num_ranges; r++) {
+    for (uint32_t i = held->ranges[r].start; i < held->ranges[r].start + held->ranges[r].num_pages; i++) {
+      pthread_mutex_t *pte_lock = cdt_host_lock_page(host, i);
+      if (cdt_fault_release(host, i) != 0)
+        debug_print("Failed to release shared page %d guarded by lock %d\n", i, lock_id);
+      pthread_mutex_unlock(pte_lock);
+    }
+  }
+  cdt_fault_unlock(host);
+  held->num_ranges = 0;
+
+  if (host->manager)
+    return cdt_worker_do_lock_release(host, lock_id, host->self_id);
+
+  cdt_packet_t packet;
+  cdt_packet_lock_release_req_create(&packet, lock_id);
+  if (cdt_connection_send(&host->peers[0].connection, &packet) != 0) {
+    debug_print("Failed to send lock release request\n");
+    return -1;
+  }
+
+  if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1) {
+    debug_print("Failed to receive lock release response\n");
+    return -1;
+  }
+
+  uint32_t requester_id, status;
+  cdt_packet_lock_release_resp_parse(&packet, &requester_id, &status);
+  assert(requester_id == host->self_id);
+
+  return status == 0 ? 0 : -1;
+#endif
+}
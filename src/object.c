@@ -0,0 +1,316 @@
+#include <mqueue.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "host.h"
+#include "packet.h"
+#include "worker.h"
+#include "coordinate.h"
+
+#ifdef COORDINATE_LOCAL
+static pthread_mutex_t cdt_object_local_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Broadcast whenever an object changes, for the threads in cdt_object_wait */
+static pthread_cond_t cdt_object_local_changed = PTHREAD_COND_INITIALIZER;
+#endif
+
+int cdt_object_init(cdt_object_t *object, uint32_t size) {
+  if (size == 0 || size > CDT_MAX_OBJECT_SIZE) {
+    debug_print("Objects must be between 1 and %d bytes\n", CDT_MAX_OBJECT_SIZE);
+    return -1;
+  }
+
+  object->size = size;
+
+#ifdef COORDINATE_LOCAL
+  object->local_data = calloc(1, size);
+  return object->local_data ? 0 : -1;
+#else
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet started\n");
+    return -1;
+  }
+
+  // Objects are homed where they are created, so no other machine needs to hear about a new one
+  uint32_t object_id = __atomic_fetch_add(&host->object_counter, 1, __ATOMIC_RELAXED) * host->num_machines + host->self_id;
+  if (object_id >= CDT_MAX_OBJECTS) {
+    debug_print("Maximum number of objects exceeded\n");
+    return -1;
+  }
+
+  cdt_manager_object_t *home_object = &host->manager_objects[object_id];
+  pthread_mutex_lock(&home_object->lock);
+  home_object->in_use = 1;
+  home_object->size = size;
+  memset(home_object->data, 0, sizeof(home_object->data));
+  memset(home_object->read_set, 0, sizeof(home_object->read_set));
+  memset(home_object->wait_set, 0, sizeof(home_object->wait_set));
+  pthread_mutex_unlock(&home_object->lock);
+
+  object->local_data = NULL;
+  object->remote_id = object_id;
+  return 0;
+#endif
+}
+
+int cdt_object_read(const cdt_object_t *object, void *dest) {
+#ifdef COORDINATE_LOCAL
+  pthread_mutex_lock(&cdt_object_local_lock);
+  memmove(dest, object->local_data, object->size);
+  pthread_mutex_unlock(&cdt_object_local_lock);
+  return 0;
+#else
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet started\n");
+    return -1;
+  }
+
+  uint32_t object_id = object->remote_id;
+  if (object_id >= CDT_MAX_OBJECTS || object->size > CDT_MAX_OBJECT_SIZE)
+    return -1;
+
+  uint32_t home = object_id % host->num_machines;
+  if (home == host->self_id) {
+    cdt_manager_object_t *home_object = &host->manager_objects[object_id];
+    pthread_mutex_lock(&home_object->lock);
+    memmove(dest, home_object->data, object->size);
+    pthread_mutex_unlock(&home_object->lock);
+    return 0;
+  }
+
+  cdt_host_object_t *cached = &host->objects[object_id];
+  pthread_mutex_lock(&cached->lock);
+  if (cached->valid) {
+    memmove(dest, cached->data, object->size);
+    pthread_mutex_unlock(&cached->lock);
+    return 0;
+  }
+
+  // The entry is not held while waiting, since the home may need to invalidate it to answer another machine
+  cached->fetching = 1;
+  cached->fetch_invalidated = 0;
+  pthread_mutex_unlock(&cached->lock);
+
+  int res = -1;
+  cdt_packet_t packet;
+  cdt_packet_object_read_req_create(&packet, object_id);
+  if (cdt_connection_send(&host->peers[home].connection, &packet) != 0) {
+    debug_print("Failed to send object read request\n");
+    goto done;
+  }
+
+  if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1) {
+    debug_print("Failed to receive object read response\n");
+    goto done;
+  }
+
+  uint32_t requester_id, resp_object_id, status, size;
+  void *data;
+  cdt_packet_object_read_resp_parse(&packet, &requester_id, &resp_object_id, &status, &data, &size);
+  assert(requester_id == host->self_id);
+  assert(resp_object_id == object_id);
+
+  if (status != 0) {
+    res = status;
+    goto done;
+  }
+
+  if (size != object->size) {
+    res = CDT_OBJECT_WRONG_SIZE;
+    goto done;
+  }
+
+  memmove(dest, data, size);
+  res = 0;
+
+done:
+  // The fetch is over either way, so an invalidation that arrives from now on waits for the entry again
+  pthread_mutex_lock(&cached->lock);
+  if (res == 0 && !cached->fetch_invalidated) {
+    memmove(cached->data, data, size);
+    cached->valid = 1;
+  }
+  cached->fetching = 0;
+  pthread_mutex_unlock(&cached->lock);
+
+  return res;
+#endif
+}
+
+#ifndef COORDINATE_LOCAL
+/**
+ * Apply op to object at its home, storing the contents it held before in old.
+ */
+int cdt_object_update(const cdt_object_t *object, uint32_t op, const void *operand, void *old) {
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet started\n");
+    return -1;
+  }
+
+  uint32_t object_id = object->remote_id;
+  if (object_id >= CDT_MAX_OBJECTS || object->size > CDT_MAX_OBJECT_SIZE)
+    return -1;
+
+  uint32_t home = object_id % host->num_machines;
+  if (home == host->self_id)
+    return cdt_worker_do_object_update(host, object_id, host->self_id, op, operand, object->size, old);
+
+  cdt_host_object_t *cached = &host->objects[object_id];
+  pthread_mutex_lock(&cached->lock);
+  cached->valid = 0;
+  cached->fetching = 1;
+  cached->fetch_invalidated = 0;
+  pthread_mutex_unlock(&cached->lock);
+
+  int res = -1;
+  cdt_packet_t packet;
+  cdt_packet_object_update_req_create(&packet, object_id, op, operand, object->size);
+  if (cdt_connection_send(&host->peers[home].connection, &packet) != 0) {
+    debug_print("Failed to send object update request\n");
+    goto done;
+  }
+
+  if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1) {
+    debug_print("Failed to receive object update response\n");
+    goto done;
+  }
+
+  uint32_t requester_id, resp_object_id, status, size;
+  void *data;
+  cdt_packet_object_update_resp_parse(&packet, &requester_id, &resp_object_id, &status, &data, &size);
+  assert(requester_id == host->self_id);
+  assert(resp_object_id == object_id);
+
+  if (status != 0) {
+    res = status;
+    goto done;
+  }
+
+  if (size != object->size) {
+    res = CDT_OBJECT_WRONG_SIZE;
+    goto done;
+  }
+
+  memmove(old, data, size);
+  res = 0;
+
+done:
+  // The home now counts us as caching the result, which we can work out without asking for it
+  pthread_mutex_lock(&cached->lock);
+  if (res == 0 && !cached->fetch_invalidated) {
+    if (op == CDT_PACKET_OBJECT_ADD) {
+      int64_t value, addend;
+      memmove(&value, old, sizeof(value));
+      memmove(&addend, operand, sizeof(addend));
+      value += addend;
+      memmove(cached->data, &value, sizeof(value));
+    } else {
+      memmove(cached->data, operand, size);
+    }
+    cached->valid = 1;
+  }
+  cached->fetching = 0;
+  pthread_mutex_unlock(&cached->lock);
+
+  return res;
+}
+#endif
+
+int cdt_object_write(const cdt_object_t *object, const void *src) {
+#ifdef COORDINATE_LOCAL
+  pthread_mutex_lock(&cdt_object_local_lock);
+  memmove(object->local_data, src, object->size);
+  pthread_cond_broadcast(&cdt_object_local_changed);
+  pthread_mutex_unlock(&cdt_object_local_lock);
+  return 0;
+#else
+  uint8_t old[CDT_MAX_OBJECT_SIZE];
+  return cdt_object_update(object, CDT_PACKET_OBJECT_STORE, src, old);
+#endif
+}
+
+int cdt_object_fetch_add(const cdt_object_t *object, int64_t value, int64_t *old) {
+  if (object->size != sizeof(int64_t)) {
+    debug_print("Can only add to objects the size of an int64_t\n");
+    return CDT_OBJECT_WRONG_SIZE;
+  }
+
+#ifdef COORDINATE_LOCAL
+  int64_t current;
+  pthread_mutex_lock(&cdt_object_local_lock);
+  memmove(&current, object->local_data, sizeof(current));
+  if (old)
+    *old = current;
+  current += value;
+  memmove(object->local_data, &current, sizeof(current));
+  pthread_cond_broadcast(&cdt_object_local_changed);
+  pthread_mutex_unlock(&cdt_object_local_lock);
+  return 0;
+#else
+  int64_t previous;
+  int res = cdt_object_update(object, CDT_PACKET_OBJECT_ADD, &value, &previous);
+  if (res != 0)
+    return res;
+
+  if (old)
+    *old = previous;
+  return 0;
+#endif
+}
+
+int cdt_object_wait(const cdt_object_t *object, int64_t value) {
+  if (object->size != sizeof(int64_t)) {
+    debug_print("Can only wait on objects the size of an int64_t\n");
+    return CDT_OBJECT_WRONG_SIZE;
+  }
+
+#ifdef COORDINATE_LOCAL
+  int64_t current;
+  pthread_mutex_lock(&cdt_object_local_lock);
+  memmove(&current, object->local_data, sizeof(current));
+  while (current < value) {
+    pthread_cond_wait(&cdt_object_local_changed, &cdt_object_local_lock);
+    memmove(&current, object->local_data, sizeof(current));
+  }
+  pthread_mutex_unlock(&cdt_object_local_lock);
+  return 0;
+#else
+  cdt_host_t *host = cdt_get_host();
+  if (!host) {
+    debug_print("Host not yet started\n");
+    return -1;
+  }
+
+  uint32_t object_id = object->remote_id;
+  if (object_id >= CDT_MAX_OBJECTS)
+    return -1;
+
+  // The home answers once the object reaches value
+  cdt_packet_t packet;
+  uint32_t home = object_id % host->num_machines;
+  if (home == host->self_id) {
+    if (cdt_worker_do_object_wait(host, object_id, host->self_id, value) != 0)
+      return -1;
+  } else {
+    cdt_packet_object_wait_req_create(&packet, object_id, value);
+    if (cdt_connection_send(&host->peers[home].connection, &packet) != 0) {
+      debug_print("Failed to send object wait request\n");
+      return -1;
+    }
+  }
+
+  if (mq_receive(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1) {
+    debug_print("Failed to receive object wait response\n");
+    return -1;
+  }
+
+  uint32_t requester_id, resp_object_id, status;
+  cdt_packet_object_wait_resp_parse(&packet, &requester_id, &resp_object_id, &status);
+  assert(requester_id == host->self_id);
+  assert(resp_object_id == object_id);
+
+  return status;
+#endif
+}
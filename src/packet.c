@@ -2,8 +2,46 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include "thread.h"
+#include "host.h"
 #include "packet.h"
 #include "util.h"
+#include "diff.h"
+
+/* Set in the flags of a response whose page is all zeros, in which case the page itself is left out */
+#define CDT_PACKET_ZERO_PAGE 0x20000000
+
+/**
+ * Place page in packet at offset, or leave it out if it is all zeros, which is the case for every page
+ * that has not been written since it was allocated, or NULL. Sets the size of the packet.
+ *
+ * Returns flags, with CDT_PACKET_ZERO_PAGE set if the page was left out.
+ */
+static uint32_t cdt_packet_page_create(cdt_packet_t *packet, size_t offset, const void *page, uint32_t flags) {
+  const uint64_t *words = (const uint64_t*)page;
+  for (size_t i = 0; page && i < PAGESIZE / sizeof(uint64_t); i++) {
+    if (words[i] != 0) {
+      memmove(packet->data + offset, page, PAGESIZE);
+      packet->size = offset + PAGESIZE;
+      return flags;
+    }
+  }
+
+  packet->size = offset;
+  return flags | CDT_PACKET_ZERO_PAGE;
+}
+
+/**
+ * Get the page placed in packet at offset by cdt_packet_page_create, or NULL if it is all zeros, and clear
+ * CDT_PACKET_ZERO_PAGE from flags.
+ */
+static void* cdt_packet_page_parse(cdt_packet_t *packet, size_t offset, uint32_t *flags) {
+  if (*flags & CDT_PACKET_ZERO_PAGE) {
+    *flags &= ~CDT_PACKET_ZERO_PAGE;
+    return NULL;
+  }
+
+  return packet->data + offset;
+}
 
 uint32_t cdt_packet_response_get_requester(cdt_packet_t *packet) {
   assert(packet->type % 2 == 1);
@@ -37,19 +75,23 @@ void cdt_packet_self_identify_parse(cdt_packet_t *packet, char **address, char *
   *port = *address + strlen(*address) + 1;
 }
 
-void cdt_packet_peer_id_assign_create(cdt_packet_t *packet, uint32_t peer_id) {
+void cdt_packet_peer_id_assign_create(cdt_packet_t *packet, uint32_t peer_id, uint32_t num_machines, uint32_t compression) {
   packet->type = CDT_PACKET_PEER_ID_ASSIGN;
-  packet->size = sizeof(peer_id);
+  packet->size = sizeof(peer_id) + sizeof(num_machines) + sizeof(compression);
 
-  peer_id = htonl(peer_id);
-  memmove(packet->data, &peer_id, sizeof(peer_id));
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(peer_id);
+  data[1] = htonl(num_machines);
+  data[2] = htonl(compression);
 }
 
-void cdt_packet_peer_id_assign_parse(cdt_packet_t *packet, uint32_t *peer_id) {
+void cdt_packet_peer_id_assign_parse(cdt_packet_t *packet, uint32_t *peer_id, uint32_t *num_machines, uint32_t *compression) {
   assert(packet->type == CDT_PACKET_PEER_ID_ASSIGN);
 
-  memmove(peer_id, packet->data, sizeof(*peer_id));
-  *peer_id = ntohl(*peer_id);
+  uint32_t *data = (uint32_t*)packet->data;
+  *peer_id = ntohl(data[0]);
+  *num_machines = ntohl(data[1]);
+  *compression = ntohl(data[2]);
 }
 
 void cdt_packet_peer_id_confim_create(cdt_packet_t *packet) {
@@ -57,6 +99,11 @@ void cdt_packet_peer_id_confim_create(cdt_packet_t *packet) {
   packet->size = 0;
 }
 
+void cdt_packet_peer_ready_create(cdt_packet_t *packet) {
+  packet->type = CDT_PACKET_PEER_READY;
+  packet->size = 0;
+}
+
 int cdt_packet_new_peer_create(cdt_packet_t *packet, uint32_t peer_id, const char *address, const char *port) {
   int address_len = strlen(address) + 1; // + 1 to include null terminating character
   int port_len = strlen(port) + 1;
@@ -100,23 +147,27 @@ void cdt_packet_existing_peer_parse(cdt_packet_t *packet, uint32_t *peer_id) {
   *peer_id = ntohl(*peer_id);
 }
 
-void cdt_packet_alloc_req_create(cdt_packet_t *packet, uint32_t peer_id, uint32_t num_pages) {
+void cdt_packet_alloc_req_create(cdt_packet_t *packet, uint32_t peer_id, uint32_t num_pages, uint32_t flags) {
   packet->type = CDT_PACKET_ALLOC_REQ;
-  packet->size = sizeof(peer_id) + sizeof(num_pages);
+  packet->size = sizeof(peer_id) + sizeof(num_pages) + sizeof(flags);
 
   peer_id = htonl(peer_id);
   num_pages = htonl(num_pages);
+  flags = htonl(flags);
   memmove(packet->data, &peer_id, sizeof(peer_id));
   memmove(packet->data + sizeof(peer_id), &num_pages, sizeof(num_pages));
+  memmove(packet->data + sizeof(peer_id) + sizeof(num_pages), &flags, sizeof(flags));
 }
 
-void cdt_packet_alloc_req_parse(cdt_packet_t *packet, uint32_t *peer_id, uint32_t *num_pages) {
+void cdt_packet_alloc_req_parse(cdt_packet_t *packet, uint32_t *peer_id, uint32_t *num_pages, uint32_t *flags) {
   assert(packet->type == CDT_PACKET_ALLOC_REQ);
 
   memmove(peer_id, packet->data, sizeof(*peer_id));
   memmove(num_pages, packet->data + sizeof(*peer_id), sizeof(*num_pages));
+  memmove(flags, packet->data + sizeof(*peer_id) + sizeof(*num_pages), sizeof(*flags));
   *peer_id = ntohl(*peer_id);
   *num_pages = ntohl(*num_pages);
+  *flags = ntohl(*flags);
 }
 
 void cdt_packet_alloc_resp_create(cdt_packet_t *packet, uint64_t page, uint32_t num_pages) {
@@ -278,32 +329,210 @@ void cdt_packet_thread_join_resp_parse(cdt_packet_t *packet, uint32_t *status, u
   *return_value = ntohll(*return_value);
 }
 
-void cdt_packet_read_req_create(cdt_packet_t *packet, uint64_t page_addr) {
+void cdt_packet_read_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t version) {
   packet->type = CDT_PACKET_READ_REQ;
-  packet->size = sizeof(page_addr);
+  packet->size = sizeof(page_addr) + sizeof(version);
 
   page_addr = htonll(page_addr);
+  version = htonl(version);
   memmove(packet->data, &page_addr, sizeof(page_addr));
+  memmove(packet->data + sizeof(page_addr), &version, sizeof(version));
 }
 
-void cdt_packet_read_req_parse(cdt_packet_t *packet, uint64_t *page_addr) {
+void cdt_packet_read_req_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *version) {
   assert(packet->type == CDT_PACKET_READ_REQ);
 
   memmove(page_addr, packet->data, sizeof(*page_addr));
+  memmove(version, packet->data + sizeof(*page_addr), sizeof(*version));
   *page_addr = ntohll(*page_addr);
+  *version = ntohl(*version);
 }
 
-void cdt_packet_read_resp_create(cdt_packet_t *packet, void *page) {
+void cdt_packet_read_resp_create(cdt_packet_t *packet, void *page, uint32_t flags, uint32_t held, uint32_t version) {
   packet->type = CDT_PACKET_READ_RESP;
-  packet->size = PAGESIZE;
-
-  memmove(packet->data, page, PAGESIZE);
+  flags = cdt_packet_page_create(packet, sizeof(flags) + sizeof(held) + sizeof(version), page, flags);
+
+  flags = htonl(flags);
+  held = htonl(held);
+  version = htonl(version);
+  memmove(packet->data, &flags, sizeof(flags));
+  memmove(packet->data + sizeof(flags), &held, sizeof(held));
+  memmove(packet->data + sizeof(flags) + sizeof(held), &version, sizeof(version));
 }
 
-void cdt_packet_read_resp_parse(cdt_packet_t *packet, void **page) {
+void cdt_packet_read_resp_parse(cdt_packet_t *packet, void **page, uint32_t *flags, uint32_t *held, uint32_t *version) {
   assert(packet->type == CDT_PACKET_READ_RESP);
 
-  *page = packet->data;
+  memmove(flags, packet->data, sizeof(*flags));
+  *flags = ntohl(*flags);
+  memmove(held, packet->data + sizeof(*flags), sizeof(*held));
+  *held = ntohl(*held);
+  memmove(version, packet->data + sizeof(*flags) + sizeof(*held), sizeof(*version));
+  *version = ntohl(*version);
+
+  *page = cdt_packet_page_parse(packet, sizeof(*flags) + sizeof(*held) + sizeof(*version), flags);
+}
+
+void cdt_packet_read_current_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t held) {
+  packet->type = CDT_PACKET_READ_CURRENT;
+  packet->size = sizeof(page_addr) + sizeof(held);
+
+  page_addr = htonll(page_addr);
+  held = htonl(held);
+  memmove(packet->data, &page_addr, sizeof(page_addr));
+  memmove(packet->data + sizeof(page_addr), &held, sizeof(held));
+}
+
+void cdt_packet_read_current_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *held) {
+  assert(packet->type == CDT_PACKET_READ_CURRENT);
+
+  memmove(page_addr, packet->data, sizeof(*page_addr));
+  memmove(held, packet->data + sizeof(*page_addr), sizeof(*held));
+  *page_addr = ntohll(*page_addr);
+  *held = ntohl(*held);
+}
+
+void cdt_packet_freeze_req_create(cdt_packet_t *packet, uint32_t start, uint32_t num_pages, uint32_t copies) {
+  packet->type = CDT_PACKET_FREEZE_REQ;
+  packet->size = sizeof(start) + sizeof(num_pages) + sizeof(copies);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(start);
+  data[1] = htonl(num_pages);
+  data[2] = htonl(copies);
+}
+
+void cdt_packet_freeze_req_parse(cdt_packet_t *packet, uint32_t *start, uint32_t *num_pages, uint32_t *copies) {
+  assert(packet->type == CDT_PACKET_FREEZE_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *start = ntohl(data[0]);
+  *num_pages = ntohl(data[1]);
+  *copies = ntohl(data[2]);
+}
+
+void cdt_packet_freeze_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t status) {
+  packet->type = CDT_PACKET_FREEZE_RESP;
+  packet->size = sizeof(requester_id) + sizeof(status);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(status);
+}
+
+void cdt_packet_freeze_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *status) {
+  assert(packet->type == CDT_PACKET_FREEZE_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *status = ntohl(data[1]);
+}
+
+void cdt_packet_broadcast_req_create(cdt_packet_t *packet, uint32_t start, uint32_t num_pages) {
+  packet->type = CDT_PACKET_BROADCAST_REQ;
+  packet->size = sizeof(start) + sizeof(num_pages);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(start);
+  data[1] = htonl(num_pages);
+}
+
+void cdt_packet_broadcast_req_parse(cdt_packet_t *packet, uint32_t *start, uint32_t *num_pages) {
+  assert(packet->type == CDT_PACKET_BROADCAST_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *start = ntohl(data[0]);
+  *num_pages = ntohl(data[1]);
+}
+
+void cdt_packet_broadcast_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t status) {
+  packet->type = CDT_PACKET_BROADCAST_RESP;
+  packet->size = sizeof(requester_id) + sizeof(status);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(status);
+}
+
+void cdt_packet_broadcast_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *status) {
+  assert(packet->type == CDT_PACKET_BROADCAST_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *status = ntohl(data[1]);
+}
+
+void cdt_packet_replica_push_req_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t root, uint32_t idx, void *page,
+                                        uint32_t flags, uint32_t version) {
+  packet->type = CDT_PACKET_REPLICA_PUSH_REQ;
+  packet->size = 4 * sizeof(uint32_t);
+
+  if (idx != CDT_PACKET_RANGE_DONE)
+    flags = cdt_packet_page_create(packet, 4 * sizeof(uint32_t), page, flags);
+
+  // There is only room for four words next to a page, so both machine IDs share the first
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id << 16 | root);
+  data[1] = htonl(idx);
+  data[2] = htonl(flags);
+  data[3] = htonl(version);
+}
+
+void cdt_packet_replica_push_req_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *root, uint32_t *idx, void **page,
+                                       uint32_t *flags, uint32_t *version) {
+  assert(packet->type == CDT_PACKET_REPLICA_PUSH_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]) >> 16;
+  *root = ntohl(data[0]) & 0xffff;
+  *idx = ntohl(data[1]);
+  *flags = ntohl(data[2]);
+  *version = ntohl(data[3]);
+  *page = *idx == CDT_PACKET_RANGE_DONE ? NULL : cdt_packet_page_parse(packet, 4 * sizeof(uint32_t), flags);
+}
+
+void cdt_packet_replica_push_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t root, uint32_t machine_id,
+                                         uint32_t idx) {
+  packet->type = CDT_PACKET_REPLICA_PUSH_RESP;
+  packet->size = sizeof(requester_id) + sizeof(root) + sizeof(machine_id) + sizeof(idx);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(root);
+  data[2] = htonl(machine_id);
+  data[3] = htonl(idx);
+}
+
+void cdt_packet_replica_push_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *root, uint32_t *machine_id,
+                                        uint32_t *idx) {
+  assert(packet->type == CDT_PACKET_REPLICA_PUSH_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *root = ntohl(data[1]);
+  *machine_id = ntohl(data[2]);
+  *idx = ntohl(data[3]);
+}
+
+void cdt_packet_halo_push_req_create(cdt_packet_t *packet, uint32_t offset, uint32_t total, const void *halo_data, uint32_t size) {
+  assert(size <= CDT_PACKET_HALO_MAX_SIZE);
+  packet->type = CDT_PACKET_HALO_PUSH_REQ;
+  packet->size = 2 * sizeof(uint32_t) + size;
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(offset);
+  data[1] = htonl(total);
+  memmove(packet->data + 2 * sizeof(uint32_t), halo_data, size);
+}
+
+void cdt_packet_halo_push_req_parse(cdt_packet_t *packet, uint32_t *offset, uint32_t *total, void **halo_data, uint32_t *size) {
+  assert(packet->type == CDT_PACKET_HALO_PUSH_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *offset = ntohl(data[0]);
+  *total = ntohl(data[1]);
+  *halo_data = packet->data + 2 * sizeof(uint32_t);
+  *size = packet->size - 2 * sizeof(uint32_t);
 }
 
 void cdt_packet_read_invalidate_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id) {
@@ -344,6 +573,49 @@ void cdt_packet_read_invalidate_resp_parse(cdt_packet_t *packet, uint64_t *page_
   *page_addr = ntohll(*page_addr);
 }
 
+void cdt_packet_read_invalidate_range_req_create(cdt_packet_t *packet, uint32_t start, uint32_t num_pages, const uint8_t *wanted,
+                                                 uint32_t requester_id) {
+  assert(num_pages <= CDT_PACKET_RANGE_MAX_PAGES);
+  packet->type = CDT_PACKET_READ_INVALIDATE_RANGE_REQ;
+  packet->size = 3 * sizeof(uint32_t) + (num_pages + 7) / 8;
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(start);
+  data[2] = htonl(num_pages);
+  memmove(packet->data + 3 * sizeof(uint32_t), wanted, (num_pages + 7) / 8);
+}
+
+void cdt_packet_read_invalidate_range_req_parse(cdt_packet_t *packet, uint32_t *start, uint32_t *num_pages, uint8_t **wanted,
+                                                uint32_t *requester_id) {
+  assert(packet->type == CDT_PACKET_READ_INVALIDATE_RANGE_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *start = ntohl(data[1]);
+  *num_pages = ntohl(data[2]);
+  if (*num_pages > CDT_PACKET_RANGE_MAX_PAGES)
+    *num_pages = CDT_PACKET_RANGE_MAX_PAGES;
+  *wanted = (uint8_t*)packet->data + 3 * sizeof(uint32_t);
+}
+
+void cdt_packet_read_invalidate_range_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t start) {
+  packet->type = CDT_PACKET_READ_INVALIDATE_RANGE_RESP;
+  packet->size = sizeof(requester_id) + sizeof(start);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(start);
+}
+
+void cdt_packet_read_invalidate_range_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *start) {
+  assert(packet->type == CDT_PACKET_READ_INVALIDATE_RANGE_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *start = ntohl(data[1]);
+}
+
 void cdt_packet_write_req_create(cdt_packet_t *packet, uint64_t page_addr) {
   packet->type = CDT_PACKET_WRITE_REQ;
   packet->size = sizeof(page_addr);
@@ -359,17 +631,71 @@ void cdt_packet_write_req_parse(cdt_packet_t *packet, uint64_t *page_addr) {
   *page_addr = ntohll(*page_addr);
 }
 
-void cdt_packet_write_resp_create(cdt_packet_t *packet, void *page) {
+// The page fills the rest of the packet, so a moving home is marked with a bit cdt_malloc never uses
+#define CDT_PACKET_WRITE_RESP_HOME 0x80000000
+#define CDT_PACKET_WRITE_RESP_BASE 0x40000000
+
+void cdt_packet_write_resp_create(cdt_packet_t *packet, void *page, uint32_t flags, uint32_t home, uint32_t base) {
   packet->type = CDT_PACKET_WRITE_RESP;
-  packet->size = PAGESIZE;
+  flags = cdt_packet_page_create(packet, sizeof(flags), page, flags);
 
-  memmove(packet->data, page, PAGESIZE);
+  if (home)
+    flags |= CDT_PACKET_WRITE_RESP_HOME;
+  if (base)
+    flags |= CDT_PACKET_WRITE_RESP_BASE;
+
+  flags = htonl(flags);
+  memmove(packet->data, &flags, sizeof(flags));
 }
 
-void cdt_packet_write_resp_parse(cdt_packet_t *packet, void **page) {
+void cdt_packet_write_resp_parse(cdt_packet_t *packet, void **page, uint32_t *flags, uint32_t *home, uint32_t *base) {
   assert(packet->type == CDT_PACKET_WRITE_RESP);
 
-  *page = packet->data;
+  memmove(flags, packet->data, sizeof(*flags));
+  *flags = ntohl(*flags);
+  *home = (*flags & CDT_PACKET_WRITE_RESP_HOME) != 0;
+  *base = (*flags & CDT_PACKET_WRITE_RESP_BASE) != 0;
+  *flags &= ~(CDT_PACKET_WRITE_RESP_HOME | CDT_PACKET_WRITE_RESP_BASE);
+
+  *page = cdt_packet_page_parse(packet, sizeof(*flags), flags);
+}
+
+void cdt_packet_upgrade_req_create(cdt_packet_t *packet, uint64_t page_addr) {
+  packet->type = CDT_PACKET_UPGRADE_REQ;
+  packet->size = sizeof(page_addr);
+
+  page_addr = htonll(page_addr);
+  memmove(packet->data, &page_addr, sizeof(page_addr));
+}
+
+void cdt_packet_upgrade_req_parse(cdt_packet_t *packet, uint64_t *page_addr) {
+  assert(packet->type == CDT_PACKET_UPGRADE_REQ);
+
+  memmove(page_addr, packet->data, sizeof(*page_addr));
+  *page_addr = ntohll(*page_addr);
+}
+
+void cdt_packet_upgrade_resp_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t home, uint32_t base) {
+  packet->type = CDT_PACKET_UPGRADE_RESP;
+  packet->size = sizeof(page_addr) + sizeof(home) + sizeof(base);
+
+  page_addr = htonll(page_addr);
+  home = htonl(home);
+  base = htonl(base);
+  memmove(packet->data, &page_addr, sizeof(page_addr));
+  memmove(packet->data + sizeof(page_addr), &home, sizeof(home));
+  memmove(packet->data + sizeof(page_addr) + sizeof(home), &base, sizeof(base));
+}
+
+void cdt_packet_upgrade_resp_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *home, uint32_t *base) {
+  assert(packet->type == CDT_PACKET_UPGRADE_RESP);
+
+  memmove(page_addr, packet->data, sizeof(*page_addr));
+  memmove(home, packet->data + sizeof(*page_addr), sizeof(*home));
+  memmove(base, packet->data + sizeof(*page_addr) + sizeof(*home), sizeof(*base));
+  *page_addr = ntohll(*page_addr);
+  *home = ntohl(*home);
+  *base = ntohl(*base);
 }
 
 void cdt_packet_write_demote_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id) {
@@ -391,22 +717,43 @@ void cdt_packet_write_demote_req_parse(cdt_packet_t *packet, uint64_t *page_addr
   *page_addr = ntohll(*page_addr);
 }
 
-void cdt_packet_write_demote_resp_create(cdt_packet_t *packet, void *page, uint32_t requester_id) {
-  packet->type = CDT_PACKET_WRITE_DEMOTE_RESP;
-  packet->size = sizeof(requester_id) + PAGESIZE;
-
+/**
+ * Write the page, or its diff against base if that is smaller, after a requester id.
+ */
+static void cdt_packet_write_back_create(cdt_packet_t *packet, void *page, const void *base, uint32_t requester_id) {
   requester_id = htonl(requester_id);
   memmove(packet->data, &requester_id, sizeof(requester_id));
-  memmove(packet->data + sizeof(requester_id), page, PAGESIZE);
-}
 
-void cdt_packet_write_demote_resp_parse(cdt_packet_t *packet, void **page, uint32_t *requester_id) {
-  assert(packet->type == CDT_PACKET_WRITE_DEMOTE_RESP);
+  // A diff is only sent if all of it fits in less than a page, so the size tells the two apart
+  uint32_t word = 0;
+  size_t diff_size = 0;
+  if (base)
+    diff_size = cdt_diff_encode(page, base, packet->data + sizeof(requester_id), PAGESIZE - 1, &word);
+
+  if (base && word == CDT_DIFF_PAGE_WORDS) {
+    packet->size = sizeof(requester_id) + diff_size;
+  } else {
+    memmove(packet->data + sizeof(requester_id), page, PAGESIZE);
+    packet->size = sizeof(requester_id) + PAGESIZE;
+  }
+}
 
+static void cdt_packet_write_back_parse(cdt_packet_t *packet, void **data, uint32_t *size, uint32_t *requester_id) {
   memmove(requester_id, packet->data, sizeof(*requester_id));
   *requester_id = ntohl(*requester_id);
 
-  *page = packet->data + sizeof(*requester_id);
+  *data = packet->data + sizeof(*requester_id);
+  *size = packet->size - sizeof(*requester_id);
+}
+
+void cdt_packet_write_demote_resp_create(cdt_packet_t *packet, void *page, const void *base, uint32_t requester_id) {
+  packet->type = CDT_PACKET_WRITE_DEMOTE_RESP;
+  cdt_packet_write_back_create(packet, page, base, requester_id);
+}
+
+void cdt_packet_write_demote_resp_parse(cdt_packet_t *packet, void **data, uint32_t *size, uint32_t *requester_id) {
+  assert(packet->type == CDT_PACKET_WRITE_DEMOTE_RESP);
+  cdt_packet_write_back_parse(packet, data, size, requester_id);
 }
 
 void cdt_packet_write_invalidate_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id) {
@@ -429,21 +776,675 @@ void cdt_packet_write_invalidate_req_parse(cdt_packet_t *packet, uint64_t *page_
   *page_addr = ntohll(*page_addr);
 }
 
-void cdt_packet_write_invalidate_resp_create(cdt_packet_t *packet, void *page, uint32_t requester_id) {
+void cdt_packet_write_invalidate_resp_create(cdt_packet_t *packet, void *page, const void *base, uint32_t requester_id) {
   packet->type = CDT_PACKET_WRITE_INVALIDATE_RESP;
-  packet->size = sizeof(requester_id) + PAGESIZE;
- 
+  cdt_packet_write_back_create(packet, page, base, requester_id);
+}
+
+void cdt_packet_write_invalidate_resp_parse(cdt_packet_t *packet, void **data, uint32_t *size, uint32_t *requester_id) {
+  assert(packet->type == CDT_PACKET_WRITE_INVALIDATE_RESP);
+  cdt_packet_write_back_parse(packet, data, size, requester_id);
+}
+
+void cdt_packet_write_forward_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id, uint32_t home) {
+  packet->type = CDT_PACKET_WRITE_FORWARD_REQ;
+  packet->size = sizeof(requester_id) + sizeof(page_addr) + sizeof(home);
+
   requester_id = htonl(requester_id);
+  page_addr = htonll(page_addr);
+  home = htonl(home);
   memmove(packet->data, &requester_id, sizeof(requester_id));
-  memmove(packet->data + sizeof(requester_id), page, PAGESIZE);
+  memmove(packet->data + sizeof(requester_id), &page_addr, sizeof(page_addr));
+  memmove(packet->data + sizeof(requester_id) + sizeof(page_addr), &home, sizeof(home));
 }
 
-void cdt_packet_write_invalidate_resp_parse(cdt_packet_t *packet, void **page, uint32_t *requester_id) {
-  assert(packet->type == CDT_PACKET_WRITE_INVALIDATE_RESP);
+void cdt_packet_write_forward_req_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id, uint32_t *home) {
+  assert(packet->type == CDT_PACKET_WRITE_FORWARD_REQ);
+
+  memmove(requester_id, packet->data, sizeof(*requester_id));
+  memmove(page_addr, packet->data + sizeof(*requester_id), sizeof(*page_addr));
+  memmove(home, packet->data + sizeof(*requester_id) + sizeof(*page_addr), sizeof(*home));
+  *requester_id = ntohl(*requester_id);
+  *page_addr = ntohll(*page_addr);
+  *home = ntohl(*home);
+}
+
+void cdt_packet_write_forward_resp_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id, uint32_t clean) {
+  packet->type = CDT_PACKET_WRITE_FORWARD_RESP;
+  packet->size = sizeof(requester_id) + sizeof(page_addr) + sizeof(clean);
+
+  requester_id = htonl(requester_id);
+  page_addr = htonll(page_addr);
+  clean = htonl(clean);
+  memmove(packet->data, &requester_id, sizeof(requester_id));
+  memmove(packet->data + sizeof(requester_id), &page_addr, sizeof(page_addr));
+  memmove(packet->data + sizeof(requester_id) + sizeof(page_addr), &clean, sizeof(clean));
+}
+
+void cdt_packet_write_forward_resp_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id, uint32_t *clean) {
+  assert(packet->type == CDT_PACKET_WRITE_FORWARD_RESP);
+
+  memmove(requester_id, packet->data, sizeof(*requester_id));
+  memmove(page_addr, packet->data + sizeof(*requester_id), sizeof(*page_addr));
+  memmove(clean, packet->data + sizeof(*requester_id) + sizeof(*page_addr), sizeof(*clean));
+  *requester_id = ntohl(*requester_id);
+  *page_addr = ntohll(*page_addr);
+  *clean = ntohl(*clean);
+}
+
+void cdt_packet_read_forward_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id) {
+  packet->type = CDT_PACKET_READ_FORWARD_REQ;
+  packet->size = sizeof(requester_id) + sizeof(page_addr);
+
+  requester_id = htonl(requester_id);
+  page_addr = htonll(page_addr);
+  memmove(packet->data, &requester_id, sizeof(requester_id));
+  memmove(packet->data + sizeof(requester_id), &page_addr, sizeof(page_addr));
+}
+
+void cdt_packet_read_forward_req_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id) {
+  assert(packet->type == CDT_PACKET_READ_FORWARD_REQ);
+
+  memmove(requester_id, packet->data, sizeof(*requester_id));
+  memmove(page_addr, packet->data + sizeof(*requester_id), sizeof(*page_addr));
+  *requester_id = ntohl(*requester_id);
+  *page_addr = ntohll(*page_addr);
+}
+
+void cdt_packet_read_range_req_create(cdt_packet_t *packet, uint32_t start, uint32_t num_pages, const uint8_t *wanted) {
+  assert(num_pages <= CDT_PACKET_RANGE_MAX_PAGES);
+  packet->type = CDT_PACKET_READ_RANGE_REQ;
+  packet->size = 2 * sizeof(uint32_t) + (num_pages + 7) / 8;
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(start);
+  data[1] = htonl(num_pages);
+  memmove(packet->data + 2 * sizeof(uint32_t), wanted, (num_pages + 7) / 8);
+}
+
+void cdt_packet_read_range_req_parse(cdt_packet_t *packet, uint32_t *start, uint32_t *num_pages, uint8_t **wanted) {
+  assert(packet->type == CDT_PACKET_READ_RANGE_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *start = ntohl(data[0]);
+  *num_pages = ntohl(data[1]);
+  if (*num_pages > CDT_PACKET_RANGE_MAX_PAGES)
+    *num_pages = CDT_PACKET_RANGE_MAX_PAGES;
+  *wanted = (uint8_t*)packet->data + 2 * sizeof(uint32_t);
+}
+
+void cdt_packet_read_range_resp_create(cdt_packet_t *packet, uint32_t idx, void *page, uint32_t flags) {
+  packet->type = CDT_PACKET_READ_RANGE_RESP;
+  packet->size = 2 * sizeof(uint32_t);
+
+  if (idx != CDT_PACKET_RANGE_DONE)
+    flags = cdt_packet_page_create(packet, 2 * sizeof(uint32_t), page, flags);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(idx);
+  data[1] = htonl(flags);
+}
+
+void cdt_packet_read_range_resp_parse(cdt_packet_t *packet, uint32_t *idx, void **page, uint32_t *flags) {
+  assert(packet->type == CDT_PACKET_READ_RANGE_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *idx = ntohl(data[0]);
+  *flags = ntohl(data[1]);
+  *page = cdt_packet_page_parse(packet, 2 * sizeof(uint32_t), flags);
+}
+
+void cdt_packet_write_range_req_create(cdt_packet_t *packet, uint32_t start, uint32_t num_pages, const uint8_t *wanted,
+                                      uint32_t overwrite) {
+  assert(num_pages <= CDT_PACKET_RANGE_MAX_PAGES);
+  packet->type = CDT_PACKET_WRITE_RANGE_REQ;
+  packet->size = 3 * sizeof(uint32_t) + (num_pages + 7) / 8;
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(start);
+  data[1] = htonl(num_pages);
+  data[2] = htonl(overwrite);
+  memmove(packet->data + 3 * sizeof(uint32_t), wanted, (num_pages + 7) / 8);
+}
+
+void cdt_packet_write_range_req_parse(cdt_packet_t *packet, uint32_t *start, uint32_t *num_pages, uint8_t **wanted,
+                                     uint32_t *overwrite) {
+  assert(packet->type == CDT_PACKET_WRITE_RANGE_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *start = ntohl(data[0]);
+  *num_pages = ntohl(data[1]);
+  *overwrite = ntohl(data[2]);
+  if (*num_pages > CDT_PACKET_RANGE_MAX_PAGES)
+    *num_pages = CDT_PACKET_RANGE_MAX_PAGES;
+  *wanted = (uint8_t*)packet->data + 3 * sizeof(uint32_t);
+}
+
+void cdt_packet_write_range_resp_create(cdt_packet_t *packet, uint32_t idx, void *page, uint32_t flags) {
+  packet->type = CDT_PACKET_WRITE_RANGE_RESP;
+  packet->size = 2 * sizeof(uint32_t);
+
+  if (idx != CDT_PACKET_RANGE_DONE)
+    flags = cdt_packet_page_create(packet, 2 * sizeof(uint32_t), page, flags);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(idx);
+  data[1] = htonl(flags);
+}
+
+void cdt_packet_write_range_resp_parse(cdt_packet_t *packet, uint32_t *idx, void **page, uint32_t *flags) {
+  assert(packet->type == CDT_PACKET_WRITE_RANGE_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *idx = ntohl(data[0]);
+  *flags = ntohl(data[1]);
+  *page = cdt_packet_page_parse(packet, 2 * sizeof(uint32_t), flags);
+}
+
+void cdt_packet_diff_req_create(cdt_packet_t *packet, uint64_t page_addr, const void *page, const void *twin, uint32_t *word) {
+  packet->type = CDT_PACKET_DIFF_REQ;
+
+  page_addr = htonll(page_addr);
+  memmove(packet->data, &page_addr, sizeof(page_addr));
+
+  // Leave room for the home to push the same diff on to readers of write-update pages
+  size_t diff_size = cdt_diff_encode(page, twin, packet->data + sizeof(page_addr), CDT_PACKET_DIFF_MAX_SIZE, word);
+  packet->size = sizeof(page_addr) + diff_size;
+}
+
+void cdt_packet_diff_req_parse(cdt_packet_t *packet, uint64_t *page_addr, void **diff, uint32_t *diff_size) {
+  assert(packet->type == CDT_PACKET_DIFF_REQ);
+
+  memmove(page_addr, packet->data, sizeof(*page_addr));
+  *page_addr = ntohll(*page_addr);
+
+  *diff = packet->data + sizeof(*page_addr);
+  *diff_size = packet->size - sizeof(*page_addr);
+}
+
+void cdt_packet_diff_resp_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id, uint32_t status) {
+  packet->type = CDT_PACKET_DIFF_RESP;
+  packet->size = sizeof(requester_id) + sizeof(page_addr) + sizeof(status);
+
+  requester_id = htonl(requester_id);
+  page_addr = htonll(page_addr);
+  status = htonl(status);
+  memmove(packet->data, &requester_id, sizeof(requester_id));
+  memmove(packet->data + sizeof(requester_id), &page_addr, sizeof(page_addr));
+  memmove(packet->data + sizeof(requester_id) + sizeof(page_addr), &status, sizeof(status));
+}
+
+void cdt_packet_diff_resp_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id, uint32_t *status) {
+  assert(packet->type == CDT_PACKET_DIFF_RESP);
 
   memmove(requester_id, packet->data, sizeof(*requester_id));
+  memmove(page_addr, packet->data + sizeof(*requester_id), sizeof(*page_addr));
+  memmove(status, packet->data + sizeof(*requester_id) + sizeof(*page_addr), sizeof(*status));
+  *requester_id = ntohl(*requester_id);
+  *page_addr = ntohll(*page_addr);
+  *status = ntohl(*status);
+}
+
+void cdt_packet_write_update_req_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id, const void *diff, uint32_t diff_size) {
+  assert(diff_size <= CDT_PACKET_DIFF_MAX_SIZE);
+  packet->type = CDT_PACKET_WRITE_UPDATE_REQ;
+  packet->size = sizeof(page_addr) + sizeof(requester_id) + diff_size;
+
+  page_addr = htonll(page_addr);
+  requester_id = htonl(requester_id);
+  memmove(packet->data, &page_addr, sizeof(page_addr));
+  memmove(packet->data + sizeof(page_addr), &requester_id, sizeof(requester_id));
+  memmove(packet->data + sizeof(page_addr) + sizeof(requester_id), diff, diff_size);
+}
+
+void cdt_packet_write_update_req_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id, void **diff, uint32_t *diff_size) {
+  assert(packet->type == CDT_PACKET_WRITE_UPDATE_REQ);
+
+  memmove(page_addr, packet->data, sizeof(*page_addr));
+  memmove(requester_id, packet->data + sizeof(*page_addr), sizeof(*requester_id));
+  *page_addr = ntohll(*page_addr);
+  *requester_id = ntohl(*requester_id);
+
+  *diff = packet->data + sizeof(*page_addr) + sizeof(*requester_id);
+  *diff_size = packet->size - sizeof(*page_addr) - sizeof(*requester_id);
+}
+
+void cdt_packet_write_update_resp_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t requester_id) {
+  packet->type = CDT_PACKET_WRITE_UPDATE_RESP;
+  packet->size = sizeof(requester_id) + sizeof(page_addr);
+
+  requester_id = htonl(requester_id);
+  page_addr = htonll(page_addr);
+  memmove(packet->data, &requester_id, sizeof(requester_id));
+  memmove(packet->data + sizeof(requester_id), &page_addr, sizeof(page_addr));
+}
 
+void cdt_packet_write_update_resp_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *requester_id) {
+  assert(packet->type == CDT_PACKET_WRITE_UPDATE_RESP);
 
+  memmove(requester_id, packet->data, sizeof(*requester_id));
+  memmove(page_addr, packet->data + sizeof(*requester_id), sizeof(*page_addr));
   *requester_id = ntohl(*requester_id);
-  *page = packet->data + sizeof(*requester_id);
+  *page_addr = ntohll(*page_addr);
+}
+
+void cdt_packet_acquire_req_create(cdt_packet_t *packet, const cdt_page_range_t *ranges, uint32_t num_ranges) {
+  assert(num_ranges <= CDT_MAX_LOCK_RANGES);
+
+  packet->type = CDT_PACKET_ACQUIRE_REQ;
+  packet->size = (1 + 2 * num_ranges) * sizeof(uint32_t);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *data++ = htonl(num_ranges);
+  for (uint32_t i = 0; i < num_ranges; i++) {
+    *data++ = htonl(ranges[i].start);
+    *data++ = htonl(ranges[i].num_pages);
+  }
+}
+
+void cdt_packet_acquire_req_parse(cdt_packet_t *packet, cdt_page_range_t *ranges, uint32_t *num_ranges) {
+  assert(packet->type == CDT_PACKET_ACQUIRE_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *num_ranges = ntohl(*data++);
+  if (*num_ranges > CDT_MAX_LOCK_RANGES)
+    *num_ranges = CDT_MAX_LOCK_RANGES;
+
+  for (uint32_t i = 0; i < *num_ranges; i++) {
+    ranges[i].start = ntohl(*data++);
+    ranges[i].num_pages = ntohl(*data++);
+  }
+}
+
+void cdt_packet_acquire_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t more, const uint32_t *pages, uint32_t num_pages) {
+  assert(num_pages <= CDT_PACKET_ACQUIRE_MAX_PAGES);
+
+  packet->type = CDT_PACKET_ACQUIRE_RESP;
+  packet->size = sizeof(requester_id) + sizeof(more) + sizeof(num_pages) + num_pages * sizeof(uint32_t);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(more);
+  data[2] = htonl(num_pages);
+  for (uint32_t i = 0; i < num_pages; i++)
+    data[3 + i] = htonl(pages[i]);
+}
+
+void cdt_packet_acquire_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *more, uint32_t **pages, uint32_t *num_pages) {
+  assert(packet->type == CDT_PACKET_ACQUIRE_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *more = ntohl(data[1]);
+  *num_pages = ntohl(data[2]);
+
+  // The indices are converted in place
+  *pages = data + 3;
+  for (uint32_t i = 0; i < *num_pages; i++)
+    (*pages)[i] = ntohl((*pages)[i]);
+}
+
+void cdt_packet_lock_create_req_create(cdt_packet_t *packet) {
+  packet->type = CDT_PACKET_LOCK_CREATE_REQ;
+  packet->size = 0;
+}
+
+void cdt_packet_lock_create_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t lock_id) {
+  packet->type = CDT_PACKET_LOCK_CREATE_RESP;
+  packet->size = sizeof(requester_id) + sizeof(lock_id);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(lock_id);
+}
+
+void cdt_packet_lock_create_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *lock_id) {
+  assert(packet->type == CDT_PACKET_LOCK_CREATE_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *lock_id = ntohl(data[1]);
+}
+
+void cdt_packet_lock_bind_req_create(cdt_packet_t *packet, uint32_t lock_id, uint32_t start, uint32_t num_pages) {
+  packet->type = CDT_PACKET_LOCK_BIND_REQ;
+  packet->size = sizeof(lock_id) + sizeof(start) + sizeof(num_pages);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(lock_id);
+  data[1] = htonl(start);
+  data[2] = htonl(num_pages);
+}
+
+void cdt_packet_lock_bind_req_parse(cdt_packet_t *packet, uint32_t *lock_id, uint32_t *start, uint32_t *num_pages) {
+  assert(packet->type == CDT_PACKET_LOCK_BIND_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *lock_id = ntohl(data[0]);
+  *start = ntohl(data[1]);
+  *num_pages = ntohl(data[2]);
+}
+
+void cdt_packet_lock_bind_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t status) {
+  packet->type = CDT_PACKET_LOCK_BIND_RESP;
+  packet->size = sizeof(requester_id) + sizeof(status);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(status);
+}
+
+void cdt_packet_lock_bind_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *status) {
+  assert(packet->type == CDT_PACKET_LOCK_BIND_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *status = ntohl(data[1]);
+}
+
+void cdt_packet_lock_acquire_req_create(cdt_packet_t *packet, uint32_t lock_id) {
+  packet->type = CDT_PACKET_LOCK_ACQUIRE_REQ;
+  packet->size = sizeof(lock_id);
+
+  lock_id = htonl(lock_id);
+  memmove(packet->data, &lock_id, sizeof(lock_id));
+}
+
+void cdt_packet_lock_acquire_req_parse(cdt_packet_t *packet, uint32_t *lock_id) {
+  assert(packet->type == CDT_PACKET_LOCK_ACQUIRE_REQ);
+
+  memmove(lock_id, packet->data, sizeof(*lock_id));
+  *lock_id = ntohl(*lock_id);
+}
+
+void cdt_packet_lock_acquire_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t status,
+                                         const cdt_page_range_t *ranges, uint32_t num_ranges) {
+  assert(num_ranges <= CDT_MAX_LOCK_RANGES);
+
+  packet->type = CDT_PACKET_LOCK_ACQUIRE_RESP;
+  packet->size = (3 + 2 * num_ranges) * sizeof(uint32_t);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *data++ = htonl(requester_id);
+  *data++ = htonl(status);
+  *data++ = htonl(num_ranges);
+  for (uint32_t i = 0; i < num_ranges; i++) {
+    *data++ = htonl(ranges[i].start);
+    *data++ = htonl(ranges[i].num_pages);
+  }
+}
+
+void cdt_packet_lock_acquire_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *status,
+                                        cdt_page_range_t *ranges, uint32_t *num_ranges) {
+  assert(packet->type == CDT_PACKET_LOCK_ACQUIRE_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(*data++);
+  *status = ntohl(*data++);
+  *num_ranges = ntohl(*data++);
+  assert(*num_ranges <= CDT_MAX_LOCK_RANGES);
+  for (uint32_t i = 0; i < *num_ranges; i++) {
+    ranges[i].start = ntohl(*data++);
+    ranges[i].num_pages = ntohl(*data++);
+  }
+}
+
+void cdt_packet_lock_release_req_create(cdt_packet_t *packet, uint32_t lock_id) {
+  packet->type = CDT_PACKET_LOCK_RELEASE_REQ;
+  packet->size = sizeof(lock_id);
+
+  lock_id = htonl(lock_id);
+  memmove(packet->data, &lock_id, sizeof(lock_id));
+}
+
+void cdt_packet_lock_release_req_parse(cdt_packet_t *packet, uint32_t *lock_id) {
+  assert(packet->type == CDT_PACKET_LOCK_RELEASE_REQ);
+
+  memmove(lock_id, packet->data, sizeof(*lock_id));
+  *lock_id = ntohl(*lock_id);
+}
+
+void cdt_packet_lock_release_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t status) {
+  packet->type = CDT_PACKET_LOCK_RELEASE_RESP;
+  packet->size = sizeof(requester_id) + sizeof(status);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(status);
+}
+
+void cdt_packet_lock_release_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *status) {
+  assert(packet->type == CDT_PACKET_LOCK_RELEASE_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *status = ntohl(data[1]);
+}
+
+void cdt_packet_home_alloc_req_create(cdt_packet_t *packet, uint32_t allocator_id, uint32_t start, uint32_t num_pages, uint32_t flags) {
+  packet->type = CDT_PACKET_HOME_ALLOC_REQ;
+  packet->size = sizeof(allocator_id) + sizeof(start) + sizeof(num_pages) + sizeof(flags);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(allocator_id);
+  data[1] = htonl(start);
+  data[2] = htonl(num_pages);
+  data[3] = htonl(flags);
+}
+
+void cdt_packet_home_alloc_req_parse(cdt_packet_t *packet, uint32_t *allocator_id, uint32_t *start, uint32_t *num_pages, uint32_t *flags) {
+  assert(packet->type == CDT_PACKET_HOME_ALLOC_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *allocator_id = ntohl(data[0]);
+  *start = ntohl(data[1]);
+  *num_pages = ntohl(data[2]);
+  *flags = ntohl(data[3]);
+}
+
+void cdt_packet_home_alloc_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t status) {
+  packet->type = CDT_PACKET_HOME_ALLOC_RESP;
+  packet->size = sizeof(requester_id) + sizeof(status);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(status);
+}
+
+void cdt_packet_home_alloc_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *status) {
+  assert(packet->type == CDT_PACKET_HOME_ALLOC_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *status = ntohl(data[1]);
+}
+
+void cdt_packet_home_moved_create(cdt_packet_t *packet, uint64_t page_addr, uint32_t home) {
+  packet->type = CDT_PACKET_HOME_MOVED;
+  packet->size = sizeof(page_addr) + sizeof(home);
+
+  page_addr = htonll(page_addr);
+  home = htonl(home);
+  memmove(packet->data, &page_addr, sizeof(page_addr));
+  memmove(packet->data + sizeof(page_addr), &home, sizeof(home));
+}
+
+void cdt_packet_home_moved_parse(cdt_packet_t *packet, uint64_t *page_addr, uint32_t *home) {
+  assert(packet->type == CDT_PACKET_HOME_MOVED);
+
+  memmove(page_addr, packet->data, sizeof(*page_addr));
+  memmove(home, packet->data + sizeof(*page_addr), sizeof(*home));
+  *page_addr = ntohll(*page_addr);
+  *home = ntohl(*home);
+}
+
+void cdt_packet_object_read_req_create(cdt_packet_t *packet, uint32_t object_id) {
+  packet->type = CDT_PACKET_OBJECT_READ_REQ;
+  packet->size = sizeof(object_id);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(object_id);
+}
+
+void cdt_packet_object_read_req_parse(cdt_packet_t *packet, uint32_t *object_id) {
+  assert(packet->type == CDT_PACKET_OBJECT_READ_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *object_id = ntohl(data[0]);
+}
+
+void cdt_packet_object_read_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t object_id, uint32_t status,
+                                        const void *object_data, uint32_t size) {
+  assert(size <= CDT_MAX_OBJECT_SIZE);
+  packet->type = CDT_PACKET_OBJECT_READ_RESP;
+  packet->size = 4 * sizeof(uint32_t) + size;
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(object_id);
+  data[2] = htonl(status);
+  data[3] = htonl(size);
+  if (size > 0)
+    memmove(packet->data + 4 * sizeof(uint32_t), object_data, size);
+}
+
+void cdt_packet_object_read_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *object_id, uint32_t *status,
+                                       void **object_data, uint32_t *size) {
+  assert(packet->type == CDT_PACKET_OBJECT_READ_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *object_id = ntohl(data[1]);
+  *status = ntohl(data[2]);
+  *size = ntohl(data[3]);
+  if (*size > CDT_MAX_OBJECT_SIZE)
+    *size = CDT_MAX_OBJECT_SIZE;
+  *object_data = packet->data + 4 * sizeof(uint32_t);
+}
+
+void cdt_packet_object_update_req_create(cdt_packet_t *packet, uint32_t object_id, uint32_t op, const void *object_data, uint32_t size) {
+  assert(size <= CDT_MAX_OBJECT_SIZE);
+  packet->type = CDT_PACKET_OBJECT_UPDATE_REQ;
+  packet->size = 3 * sizeof(uint32_t) + size;
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(object_id);
+  data[1] = htonl(op);
+  data[2] = htonl(size);
+  memmove(packet->data + 3 * sizeof(uint32_t), object_data, size);
+}
+
+void cdt_packet_object_update_req_parse(cdt_packet_t *packet, uint32_t *object_id, uint32_t *op, void **object_data, uint32_t *size) {
+  assert(packet->type == CDT_PACKET_OBJECT_UPDATE_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *object_id = ntohl(data[0]);
+  *op = ntohl(data[1]);
+  *size = ntohl(data[2]);
+  if (*size > CDT_MAX_OBJECT_SIZE)
+    *size = CDT_MAX_OBJECT_SIZE;
+  *object_data = packet->data + 3 * sizeof(uint32_t);
+}
+
+void cdt_packet_object_update_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t object_id, uint32_t status,
+                                          const void *object_data, uint32_t size) {
+  assert(size <= CDT_MAX_OBJECT_SIZE);
+  packet->type = CDT_PACKET_OBJECT_UPDATE_RESP;
+  packet->size = 4 * sizeof(uint32_t) + size;
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(object_id);
+  data[2] = htonl(status);
+  data[3] = htonl(size);
+  if (size > 0)
+    memmove(packet->data + 4 * sizeof(uint32_t), object_data, size);
+}
+
+void cdt_packet_object_update_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *object_id, uint32_t *status,
+                                         void **object_data, uint32_t *size) {
+  assert(packet->type == CDT_PACKET_OBJECT_UPDATE_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *object_id = ntohl(data[1]);
+  *status = ntohl(data[2]);
+  *size = ntohl(data[3]);
+  if (*size > CDT_MAX_OBJECT_SIZE)
+    *size = CDT_MAX_OBJECT_SIZE;
+  *object_data = packet->data + 4 * sizeof(uint32_t);
+}
+
+void cdt_packet_object_invalidate_req_create(cdt_packet_t *packet, uint32_t object_id, uint32_t requester_id) {
+  packet->type = CDT_PACKET_OBJECT_INVALIDATE_REQ;
+  packet->size = sizeof(object_id) + sizeof(requester_id);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(object_id);
+  data[1] = htonl(requester_id);
+}
+
+void cdt_packet_object_invalidate_req_parse(cdt_packet_t *packet, uint32_t *object_id, uint32_t *requester_id) {
+  assert(packet->type == CDT_PACKET_OBJECT_INVALIDATE_REQ);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *object_id = ntohl(data[0]);
+  *requester_id = ntohl(data[1]);
+}
+
+void cdt_packet_object_invalidate_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t object_id) {
+  packet->type = CDT_PACKET_OBJECT_INVALIDATE_RESP;
+  packet->size = sizeof(requester_id) + sizeof(object_id);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(object_id);
+}
+
+void cdt_packet_object_invalidate_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *object_id) {
+  assert(packet->type == CDT_PACKET_OBJECT_INVALIDATE_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *object_id = ntohl(data[1]);
+}
+
+void cdt_packet_object_wait_req_create(cdt_packet_t *packet, uint32_t object_id, int64_t value) {
+  packet->type = CDT_PACKET_OBJECT_WAIT_REQ;
+  packet->size = sizeof(object_id) + sizeof(value);
+
+  object_id = htonl(object_id);
+  uint64_t target = htonll((uint64_t)value);
+  memmove(packet->data, &object_id, sizeof(object_id));
+  memmove(packet->data + sizeof(object_id), &target, sizeof(target));
+}
+
+void cdt_packet_object_wait_req_parse(cdt_packet_t *packet, uint32_t *object_id, int64_t *value) {
+  assert(packet->type == CDT_PACKET_OBJECT_WAIT_REQ);
+
+  uint64_t target;
+  memmove(object_id, packet->data, sizeof(*object_id));
+  memmove(&target, packet->data + sizeof(*object_id), sizeof(target));
+
+  *object_id = ntohl(*object_id);
+  *value = (int64_t)ntohll(target);
+}
+
+void cdt_packet_object_wait_resp_create(cdt_packet_t *packet, uint32_t requester_id, uint32_t object_id, uint32_t status) {
+  packet->type = CDT_PACKET_OBJECT_WAIT_RESP;
+  packet->size = sizeof(requester_id) + sizeof(object_id) + sizeof(status);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  data[0] = htonl(requester_id);
+  data[1] = htonl(object_id);
+  data[2] = htonl(status);
+}
+
+void cdt_packet_object_wait_resp_parse(cdt_packet_t *packet, uint32_t *requester_id, uint32_t *object_id, uint32_t *status) {
+  assert(packet->type == CDT_PACKET_OBJECT_WAIT_RESP);
+
+  uint32_t *data = (uint32_t*)packet->data;
+  *requester_id = ntohl(data[0]);
+  *object_id = ntohl(data[1]);
+  *status = ntohl(data[2]);
 }
@@ -68,6 +68,35 @@ int cdt_peer_setup_task_queue(cdt_peer_t *peer) {
   return 0;
 }
 
+/**
+ * Get the queue for a response to a request sent on behalf of requester_id. While the fault thread
+ * resolves a fault, the responses for pages sent to this machine are for it, since every other thread
+ * must hold the fault lock to ask for pages.
+ */
+mqd_t cdt_peer_response_queue(cdt_host_t *host, cdt_packet_t *packet, uint32_t requester_id) {
+  if (requester_id != host->self_id || !__atomic_load_n(&host->faulting, __ATOMIC_ACQUIRE))
+    return host->peers[requester_id].task_queue;
+
+  switch (packet->type) {
+  case CDT_PACKET_READ_RESP:
+  case CDT_PACKET_READ_CURRENT:
+  case CDT_PACKET_WRITE_RESP:
+  case CDT_PACKET_UPGRADE_RESP:
+  case CDT_PACKET_HOME_MOVED:
+  case CDT_PACKET_READ_RANGE_RESP:
+  case CDT_PACKET_WRITE_RANGE_RESP:
+  case CDT_PACKET_READ_INVALIDATE_RESP:
+  case CDT_PACKET_READ_INVALIDATE_RANGE_RESP:
+  case CDT_PACKET_WRITE_DEMOTE_RESP:
+  case CDT_PACKET_WRITE_INVALIDATE_RESP:
+  case CDT_PACKET_DIFF_RESP:
+  case CDT_PACKET_WRITE_UPDATE_RESP:
+    return host->fault_queue;
+  default:
+    return host->peers[requester_id].task_queue;
+  }
+}
+
 void* cdt_peer_thread(void *arg) {
   cdt_peer_t *peer = (cdt_peer_t*)arg;
   cdt_host_t *host = cdt_get_host();
@@ -102,21 +131,45 @@ void* cdt_peer_thread(void *arg) {
       if (mq_send(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), 0) == -1) {
         debug_print("Failed to send thread create response message to worker thread: %s\n", strerror(errno));
       }
-    } else if (packet.type == CDT_PACKET_WRITE_RESP && peer->id == 0) { // only the manager (peer 0) can respond to write reqs
+    } else if (packet.type == CDT_PACKET_PEER_READY && host->manager) { // only the manager waits for peers to connect to each other
       if (mq_send(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), 0) == -1) {
+        debug_print("Failed to send peer ready message to main thread: %s\n", strerror(errno));
+      }
+    } else if (packet.type == CDT_PACKET_WRITE_RESP) { // write reqs are only sent to the home of a page by the user thread
+      if (mq_send(cdt_peer_response_queue(host, &packet, host->self_id), (char*)&packet, sizeof(packet), 0) == -1) {
         debug_print("Failed to send write response message to worker thread: %s\n", strerror(errno));
       }
-    } else if (packet.type == CDT_PACKET_READ_RESP && peer->id == 0) { // only the manager (peer 0) can respond to read reqs
-      if (mq_send(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), 0) == -1) {
+    } else if (packet.type == CDT_PACKET_UPGRADE_RESP) { // upgrade reqs are only sent to the home of a page by the user thread
+      if (mq_send(cdt_peer_response_queue(host, &packet, host->self_id), (char*)&packet, sizeof(packet), 0) == -1) {
+        debug_print("Failed to send upgrade response message to worker thread: %s\n", strerror(errno));
+      }
+    } else if (packet.type == CDT_PACKET_READ_CURRENT) { // sent in place of a read response
+      if (mq_send(cdt_peer_response_queue(host, &packet, host->self_id), (char*)&packet, sizeof(packet), 0) == -1) {
+        debug_print("Failed to send read current message to worker thread: %s\n", strerror(errno));
+      }
+    } else if (packet.type == CDT_PACKET_READ_RESP) { // read reqs are only sent to the home of a page by the user thread
+      if (mq_send(cdt_peer_response_queue(host, &packet, host->self_id), (char*)&packet, sizeof(packet), 0) == -1) {
         debug_print("Failed to send read response message to worker thread: %s\n", strerror(errno));
       }
+    } else if (packet.type == CDT_PACKET_READ_RANGE_RESP) { // range reqs are only sent by the user thread
+      if (mq_send(cdt_peer_response_queue(host, &packet, host->self_id), (char*)&packet, sizeof(packet), 0) == -1) {
+        debug_print("Failed to send read range response message to worker thread: %s\n", strerror(errno));
+      }
+    } else if (packet.type == CDT_PACKET_WRITE_RANGE_RESP) {
+      if (mq_send(cdt_peer_response_queue(host, &packet, host->self_id), (char*)&packet, sizeof(packet), 0) == -1) {
+        debug_print("Failed to send write range response message to worker thread: %s\n", strerror(errno));
+      }
+    } else if (packet.type == CDT_PACKET_HOME_MOVED) { // sent in place of a read or write response
+      if (mq_send(cdt_peer_response_queue(host, &packet, host->self_id), (char*)&packet, sizeof(packet), 0) == -1) {
+        debug_print("Failed to send home moved message to worker thread: %s\n", strerror(errno));
+      }
     } else if (packet.type == CDT_PACKET_THREAD_JOIN_RESP) {
       if (mq_send(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), 0) == -1) {
         debug_print("Failed to send thread join response packet to worker thread: %s\n", strerror(errno));
       }
     } else if (packet.type % 2 == 1) {
       uint32_t requester_id = cdt_packet_response_get_requester(&packet);
-      if (mq_send(host->peers[requester_id].task_queue, (char*)&packet, sizeof(packet), 0) == -1) {
+      if (mq_send(cdt_peer_response_queue(host, &packet, requester_id), (char*)&packet, sizeof(packet), 0) == -1) {
         debug_print("Failed to send response packet to worker thread %d: %s\n", requester_id, strerror(errno));
       }
     } else {
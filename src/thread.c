@@ -2,6 +2,7 @@
 #include "host.h"
 #include "packet.h"
 #include "worker.h"
+#include "coordinate.h"
 
 cdt_thread_t cdt_thread_self() {
 #ifdef COORDINATE_LOCAL
@@ -93,10 +94,14 @@ int cdt_thread_create(cdt_thread_t *thread, void *(*start_routine) (void *), voi
     return -1;
   }
 
+  // Creating a thread is a synchronization point, so the new thread sees every write made before it
+  cdt_release();
+
   pthread_mutex_lock(&host->thread_lock);
 
   if (host->num_threads >= host->num_peers) {
     debug_print("Maximum number of threads exceeded\n");
+    pthread_mutex_unlock(&host->thread_lock);
     return -1;
   }
 
@@ -155,6 +160,9 @@ int cdt_thread_join_remote(cdt_thread_t *thread, void **return_value) {
   if (status != 0)
     return -1;
 
+  // Joining a thread is a synchronization point, so every write made by the thread is now visible
+  cdt_acquire();
+
   if (return_value)
     *return_value = (void*)return_value_resp;
 
@@ -1,15 +1,51 @@
 #include "host.h"
 #include "packet.h"
+#include "diff.h"
+#include "fault.h"
 #include "worker.h"
+#include "coordinate.h"
 #include <assert.h>
+#include <errno.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+int cdt_worker_next_task(cdt_peer_t *peer, cdt_packet_t *packet) {
+  if (peer->num_deferred > 0) {
+    *packet = peer->deferred[0];
+    peer->num_deferred--;
+    memmove(peer->deferred, peer->deferred + 1, peer->num_deferred * sizeof(*peer->deferred));
+    return 0;
+  }
+
+  return mq_receive(peer->task_queue, (char*)packet, sizeof(*packet), NULL) == -1 ? -1 : 0;
+}
+
+int cdt_worker_receive_response(cdt_peer_t *peer, cdt_packet_t *packet) {
+  mqd_t queue = cdt_host_response_queue(cdt_get_host(), peer->id);
+  while (1) {
+    if (mq_receive(queue, (char*)packet, sizeof(*packet), NULL) == -1)
+      return -1;
+
+    if (packet->type % 2 == 1)
+      return 0;
+
+    // The peer can move on before we hear back from a third machine, so its next request may come first
+    cdt_packet_t *deferred = realloc(peer->deferred, (peer->num_deferred + 1) * sizeof(*deferred));
+    if (!deferred)
+      return -1;
+
+    deferred[peer->num_deferred++] = *packet;
+    peer->deferred = deferred;
+  }
+}
 
 void* cdt_worker_thread_start(void *arg) {
   cdt_peer_t *peer = (cdt_peer_t*)arg;
   cdt_packet_t packet;
 
-  while (mq_receive(peer->task_queue, (char*)&packet, sizeof(packet), NULL) != -1) {
+  while (cdt_worker_next_task(peer, &packet) != -1) {
     int res;
 
     switch (packet.type) {
@@ -28,18 +64,84 @@ void* cdt_worker_thread_start(void *arg) {
     case CDT_PACKET_WRITE_REQ:
       res = cdt_worker_write_req(peer, &packet);
       break;
+    case CDT_PACKET_UPGRADE_REQ:
+      res = cdt_worker_upgrade_req(peer, &packet);
+      break;
     case CDT_PACKET_WRITE_INVALIDATE_REQ:
       res = cdt_worker_write_invalidate_req(peer, &packet);
       break;
+    case CDT_PACKET_WRITE_FORWARD_REQ:
+      res = cdt_worker_write_forward_req(peer, &packet);
+      break;
+    case CDT_PACKET_READ_FORWARD_REQ:
+      res = cdt_worker_read_forward_req(peer, &packet);
+      break;
+    case CDT_PACKET_READ_RANGE_REQ:
+      res = cdt_worker_read_range_req(peer, &packet);
+      break;
+    case CDT_PACKET_WRITE_RANGE_REQ:
+      res = cdt_worker_write_range_req(peer, &packet);
+      break;
     case CDT_PACKET_READ_INVALIDATE_REQ:
       res = cdt_worker_read_invalidate_req(peer, &packet);
       break;
+    case CDT_PACKET_READ_INVALIDATE_RANGE_REQ:
+      res = cdt_worker_read_invalidate_range_req(peer, &packet);
+      break;
     case CDT_PACKET_THREAD_JOIN_REQ:
       res = cdt_worker_thread_join(peer, &packet);
       break;
     case CDT_PACKET_ALLOC_REQ:
       res = cdt_allocate_shared_page(peer, &packet);
       break;
+    case CDT_PACKET_DIFF_REQ:
+      res = cdt_worker_diff_req(peer, &packet);
+      break;
+    case CDT_PACKET_WRITE_UPDATE_REQ:
+      res = cdt_worker_write_update_req(peer, &packet);
+      break;
+    case CDT_PACKET_ACQUIRE_REQ:
+      res = cdt_worker_acquire_req(peer, &packet);
+      break;
+    case CDT_PACKET_FREEZE_REQ:
+      res = cdt_worker_freeze_req(peer, &packet);
+      break;
+    case CDT_PACKET_BROADCAST_REQ:
+      res = cdt_worker_broadcast_req(peer, &packet);
+      break;
+    case CDT_PACKET_REPLICA_PUSH_REQ:
+      res = cdt_worker_replica_push_req(peer, &packet);
+      break;
+    case CDT_PACKET_HALO_PUSH_REQ:
+      res = cdt_worker_halo_push_req(peer, &packet);
+      break;
+    case CDT_PACKET_LOCK_CREATE_REQ:
+      res = cdt_worker_lock_create(peer, &packet);
+      break;
+    case CDT_PACKET_LOCK_BIND_REQ:
+      res = cdt_worker_lock_bind(peer, &packet);
+      break;
+    case CDT_PACKET_LOCK_ACQUIRE_REQ:
+      res = cdt_worker_lock_acquire(peer, &packet);
+      break;
+    case CDT_PACKET_LOCK_RELEASE_REQ:
+      res = cdt_worker_lock_release(peer, &packet);
+      break;
+    case CDT_PACKET_HOME_ALLOC_REQ:
+      res = cdt_worker_home_alloc(peer, &packet);
+      break;
+    case CDT_PACKET_OBJECT_READ_REQ:
+      res = cdt_worker_object_read_req(peer, &packet);
+      break;
+    case CDT_PACKET_OBJECT_UPDATE_REQ:
+      res = cdt_worker_object_update_req(peer, &packet);
+      break;
+    case CDT_PACKET_OBJECT_INVALIDATE_REQ:
+      res = cdt_worker_object_invalidate_req(peer, &packet);
+      break;
+    case CDT_PACKET_OBJECT_WAIT_REQ:
+      res = cdt_worker_object_wait_req(peer, &packet);
+      break;
     // more cases...
     default:
       debug_print("Unexpected packet type: %d\n", packet.type);
@@ -54,64 +156,270 @@ void* cdt_worker_thread_start(void *arg) {
   return NULL;
 }
 
+void cdt_worker_invalidate_copy(cdt_host_t *host, int idx) {
+  cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+
+  // The PTE may be locked by a thread waiting for the home to send it the page, while the home
+  // waits for our response, so in that case the page is invalidated without waiting for the lock
+  while (pthread_mutex_trylock(&pte->lock) != 0) {
+    pthread_mutex_lock(&pte->fetch_lock);
+    if (pte->fetching) {
+      pte->fetch_invalidated = 1;
+      cdt_host_protect_page(pte->shared_va, INVALID_PAGE);
+      pthread_mutex_unlock(&pte->fetch_lock);
+      return;
+    }
+    pthread_mutex_unlock(&pte->fetch_lock);
+    sched_yield();
+  }
+
+  assert(cdt_host_home(host, idx) != host->self_id); // The home should never receive invalidation requests
+  assert(pte->in_use);
+  assert(pte->access == READ_ONLY_PAGE);
+
+  pte->access = INVALID_PAGE;
+  cdt_host_protect_page(pte->shared_va, INVALID_PAGE);
+  pte->page = NULL;
+  pthread_mutex_unlock(&pte->lock);
+}
+
 int cdt_worker_read_invalidate_req(cdt_peer_t *sender, cdt_packet_t *packet) {
   uint64_t page_addr;
   uint32_t requester_id;
   cdt_packet_read_invalidate_req_parse(packet, &page_addr, &requester_id);
+  assert(page_addr - PGROUNDDOWN(page_addr) == 0);
+
+  cdt_worker_invalidate_copy(cdt_get_host(), SHARED_VA_TO_IDX(page_addr));
+
+  cdt_packet_read_invalidate_resp_create(packet, page_addr, requester_id);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send read invalidate response packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return 0;
+}
+
+int cdt_worker_read_invalidate_range_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t start, num_pages, requester_id;
+  uint8_t *wanted;
+  cdt_packet_read_invalidate_range_req_parse(packet, &start, &num_pages, &wanted, &requester_id);
+
+  cdt_host_t *host = cdt_get_host();
+  for (uint32_t i = 0; i < num_pages && start + i < CDT_MAX_SHARED_PAGES; i++) {
+    if (wanted[i / 8] & (1 << (i % 8)))
+      cdt_worker_invalidate_copy(host, start + i);
+  }
+
+  cdt_packet_read_invalidate_range_resp_create(packet, requester_id, start);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send read invalidate range response packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return 0;
+}
+
+int cdt_worker_write_invalidate_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint64_t page_addr;
+  uint32_t requester_id;
+  cdt_packet_write_invalidate_req_parse(packet, &page_addr, &requester_id);
 
   cdt_host_t * host = cdt_get_host();
   int va_idx = SHARED_VA_TO_IDX(page_addr);
   pthread_mutex_lock(&host->shared_pagetable[va_idx].lock);
 
   assert(page_addr - PGROUNDDOWN(page_addr) == 0);
-  assert(!host->manager); // The mngr should never receive invalidation requests
+  assert(cdt_host_home(host, va_idx) != host->self_id); // The home should never receive invalidation requests
   assert(host->shared_pagetable[va_idx].in_use);
-  assert(host->shared_pagetable[va_idx].access == READ_ONLY_PAGE);
+  assert(host->shared_pagetable[va_idx].access == READ_WRITE_PAGE || host->shared_pagetable[va_idx].exclusive);
+
+  // Stop local writes before the page is copied out
+  cdt_host_protect_page(page_addr, READ_ONLY_PAGE);
 
   cdt_packet_t resp_pkt;
-  cdt_packet_read_invalidate_resp_create(&resp_pkt, page_addr, requester_id);
+  cdt_packet_write_invalidate_resp_create(&resp_pkt, host->shared_pagetable[va_idx].page, host->shared_pagetable[va_idx].base, requester_id);
 
   if (cdt_connection_send(&sender->connection, &resp_pkt) != 0) {
-    debug_print("Failed to send read invalidate response packet to peer %d\n", sender->id);
+    debug_print("Failed to send write invalidate response packet to peer %d\n", sender->id);
     pthread_mutex_unlock(&host->shared_pagetable[va_idx].lock);
     return -1;
   }
 
   host->shared_pagetable[va_idx].access = INVALID_PAGE;
-  free(host->shared_pagetable[va_idx].page);
+  host->shared_pagetable[va_idx].exclusive = 0;
+  cdt_host_protect_page(page_addr, INVALID_PAGE);
   host->shared_pagetable[va_idx].page = NULL;
+  free(host->shared_pagetable[va_idx].base);
+  host->shared_pagetable[va_idx].base = NULL;
   pthread_mutex_unlock(&host->shared_pagetable[va_idx].lock);
   return 0;  
 }
 
-int cdt_worker_write_invalidate_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+int cdt_worker_write_forward_req(cdt_peer_t *sender, cdt_packet_t *packet) {
   uint64_t page_addr;
-  uint32_t requester_id;
-  cdt_packet_write_invalidate_req_parse(packet, &page_addr, &requester_id);
+  uint32_t requester_id, home;
+  cdt_packet_write_forward_req_parse(packet, &page_addr, &requester_id, &home);
 
   cdt_host_t * host = cdt_get_host();
   int va_idx = SHARED_VA_TO_IDX(page_addr);
-  pthread_mutex_lock(&host->shared_pagetable[va_idx].lock);
+  cdt_host_pte_t *pte = &host->shared_pagetable[va_idx];
+  pthread_mutex_lock(&pte->lock);
 
   assert(page_addr - PGROUNDDOWN(page_addr) == 0);
-  assert(!host->manager); // The mngr should never receive invalidation requests
-  assert(host->shared_pagetable[va_idx].in_use);
-  assert(host->shared_pagetable[va_idx].access == READ_WRITE_PAGE);
+  assert(cdt_host_home(host, va_idx) != host->self_id); // The home should never receive invalidation requests
+  assert(pte->in_use);
+  assert(pte->access == READ_WRITE_PAGE || pte->exclusive);
+
+  // Stop local writes before the page is copied out
+  cdt_host_protect_page(page_addr, READ_ONLY_PAGE);
 
   cdt_packet_t resp_pkt;
-  cdt_packet_write_invalidate_resp_create(&resp_pkt, host->shared_pagetable[va_idx].page, requester_id);
+  // The home's copy is older than ours, so the requester has to send back the whole page
+  cdt_packet_write_resp_create(&resp_pkt, pte->page, pte->flags, home, 0);
+  if (cdt_connection_send(&host->peers[requester_id].connection, &resp_pkt) != 0) {
+    debug_print("Failed to send write response packet to peer %d\n", requester_id);
+    pthread_mutex_unlock(&pte->lock);
+    return -1;
+  }
 
+  // The home stops handing out the page on reads if we were given it on one and never wrote to it
+  uint32_t clean = pte->exclusive;
+  pte->access = INVALID_PAGE;
+  pte->exclusive = 0;
+  cdt_host_protect_page(page_addr, INVALID_PAGE);
+  pte->page = NULL;
+  free(pte->base);
+  pte->base = NULL;
+  pthread_mutex_unlock(&pte->lock);
+
+  // Let the home know the page has changed hands
+  cdt_packet_write_forward_resp_create(&resp_pkt, page_addr, requester_id, clean);
   if (cdt_connection_send(&sender->connection, &resp_pkt) != 0) {
-    debug_print("Failed to send write invalidate response packet to peer %d\n", sender->id);
-    pthread_mutex_unlock(&host->shared_pagetable[va_idx].lock);
+    debug_print("Failed to send write forward response packet to peer %d\n", sender->id);
     return -1;
   }
 
-  host->shared_pagetable[va_idx].access = INVALID_PAGE;
-  free(host->shared_pagetable[va_idx].page);
-  host->shared_pagetable[va_idx].page = NULL;
-  pthread_mutex_unlock(&host->shared_pagetable[va_idx].lock);
-  return 0;  
+  return 0;
+}
+
+uint32_t cdt_worker_pick_replica(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t requester_id) {
+  // The copies of multiple-writer pages may differ from the home's, so only the home can send them,
+  // and a leased copy may have been dropped by the time the request reaches its reader
+  if (pte->flags & (CDT_MALLOC_MULTIPLE_WRITER | CDT_MALLOC_LEASE))
+    return host->self_id;
+
+  for (uint32_t j = 0; j < CDT_MAX_MACHINES; j++) {
+    uint32_t i = (pte->next_replica + j) % CDT_MAX_MACHINES;
+    if (i == host->self_id || (pte->read_set[i] && i != requester_id)) {
+      pte->next_replica = i + 1;
+      return i;
+    }
+  }
+
+  return host->self_id;
+}
+
+void* cdt_worker_map_write_back(uint64_t shared_va, const void *data, uint32_t size, int access) {
+  if (size == PAGESIZE)
+    return cdt_host_map_page(shared_va, data, access);
+
+  // Our copy is still the one the writer was granted, so only its changes need to be applied
+  void *page = cdt_host_patch_page(shared_va, data, size, access);
+  if (!page)
+    debug_print("Malformed write-back diff for page %p\n", (void*)shared_va);
+
+  return page;
+}
+
+void cdt_worker_grant_lease(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t reader_id) {
+  pte->read_set[reader_id] = 1;
+
+  // The reader started timing its lease when it asked for the page, so it gives the copy up before we stop waiting
+  if ((pte->flags & CDT_MALLOC_LEASE) && reader_id != host->self_id)
+    pte->lease_expiry[reader_id] = cdt_host_now() + CDT_LEASE_MS;
+}
+
+uint64_t cdt_worker_revoke_leases(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t requester_id) {
+  uint64_t expiry = 0;
+  for (int i = 0; i < CDT_MAX_MACHINES; i++) {
+    if (!pte->read_set[i] || i == host->self_id || i == requester_id)
+      continue;
+
+    if (pte->lease_expiry[i] > expiry)
+      expiry = pte->lease_expiry[i];
+    pte->read_set[i] = 0;
+    pte->lease_expiry[i] = 0;
+  }
+
+  if (expiry > pte->lease_wait)
+    pte->lease_wait = expiry;
+  return pte->lease_wait;
+}
+
+int cdt_worker_park_for_leases(cdt_host_t *host, cdt_peer_t *sender, cdt_manager_pte_t *pte, const cdt_packet_t *packet, int write) {
+  if (!(pte->flags & CDT_MALLOC_LEASE))
+    return 0;
+
+  // Reads wait behind the writer that took the leases away, so a steady stream of readers cannot starve it
+  uint64_t wait = write ? cdt_worker_revoke_leases(host, pte, sender->id) : pte->lease_wait;
+  if (wait <= cdt_host_now())
+    return 0;
+
+  if (cdt_host_park(host, sender->id, packet, wait) == 0)
+    return 1;
+
+  debug_print("Failed to park a request from peer %d, waiting out the leases instead\n", sender->id);
+  cdt_worker_wait_lease(wait);
+  return 0;
+}
+
+void cdt_worker_wait_lease(uint64_t expiry) {
+  uint64_t now = cdt_host_now();
+  if (expiry <= now)
+    return;
+
+  struct timespec wait = { .tv_sec = (expiry - now) / 1000, .tv_nsec = (expiry - now) % 1000 * 1000000L };
+  while (nanosleep(&wait, &wait) != 0 && errno == EINTR)
+    ;
+}
+
+int cdt_worker_read_forward_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint64_t page_addr;
+  uint32_t requester_id;
+  cdt_packet_read_forward_req_parse(packet, &page_addr, &requester_id);
+  assert(page_addr - PGROUNDDOWN(page_addr) == 0);
+
+  cdt_host_t * host = cdt_get_host();
+  int va_idx = SHARED_VA_TO_IDX(page_addr);
+  cdt_host_pte_t *pte = &host->shared_pagetable[va_idx];
+
+  // Our own copy may still be on its way here, in which case the requester is sent back to the home
+  int locked;
+  while (!(locked = pthread_mutex_trylock(&pte->lock) == 0)) {
+    pthread_mutex_lock(&pte->fetch_lock);
+    int fetching = pte->fetching;
+    pthread_mutex_unlock(&pte->fetch_lock);
+    if (fetching)
+      break;
+
+    sched_yield();
+  }
+
+  if (locked && pte->in_use && pte->access != INVALID_PAGE && cdt_host_home(host, va_idx) != host->self_id)
+    cdt_packet_read_resp_create(packet, pte->page, pte->flags, 0, pte->version);
+  else
+    cdt_packet_home_moved_create(packet, page_addr, sender->id);
+
+  if (locked)
+    pthread_mutex_unlock(&pte->lock);
+
+  if (cdt_connection_send(&host->peers[requester_id].connection, packet) != 0) {
+    debug_print("Failed to send read forward response to peer %d\n", requester_id);
+    return -1;
+  }
+
+  return 0;
 }
 
 int cdt_worker_write_req(cdt_peer_t *sender, cdt_packet_t *packet) {
@@ -123,64 +431,96 @@ int cdt_worker_write_req(cdt_peer_t *sender, cdt_packet_t *packet) {
   cdt_host_t * host = cdt_get_host();
   pthread_mutex_lock(&host->manager_pagetable[va_idx].lock);
 
+  if (cdt_host_home(host, va_idx) != host->self_id) {
+    pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+    return cdt_worker_home_moved(host, sender, page_addr, cdt_host_home(host, va_idx));
+  }
+
   if (!host->manager_pagetable[va_idx].in_use) {
-    debug_print("Got a write request for page %p with idx %d that is not in use in the manager page table\n", (void *)page_addr, va_idx);
+    debug_print("Got a write request for page %p with idx %d that is not in use in the home page table\n", (void *)page_addr, va_idx);
     pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+    cdt_worker_home_moved(host, sender, page_addr, CDT_PACKET_NO_HOME);
     return -1;
   }
+  if (host->manager_pagetable[va_idx].flags & CDT_MALLOC_MULTIPLE_WRITER) {
+    // Other copies are left alone, the requester sends back only its changes at its next synchronization point
+    host->manager_pagetable[va_idx].read_set[sender->id] = 1;
+    host->manager_pagetable[va_idx].write_set[sender->id] = 1;
+    host->manager_pagetable[va_idx].stale_set[sender->id] = 0;
+
+    cdt_packet_write_resp_create(packet, host->manager_pagetable[va_idx].page, host->manager_pagetable[va_idx].flags, 0, 0);
+    if (cdt_connection_send(&sender->connection, packet) != 0) {
+      debug_print("Failed to send write response packet to peer %d\n", sender->id);
+      pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+      return -1;
+    }
+
+    pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+    return 0;
+  }
+  if (cdt_worker_park_for_leases(host, sender, &host->manager_pagetable[va_idx], packet, 1)) {
+    pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+    return 0;
+  }
+  cdt_worker_detect_migratory(host, &host->manager_pagetable[va_idx], sender->id);
+  cdt_worker_next_version(host, &host->manager_pagetable[va_idx]);
   if (host->manager_pagetable[va_idx].writer >= 0) { // page currently has a writer
     // Request invalidation and a copy of the page from the writer
     if (host->manager_pagetable[va_idx].writer == host->self_id) { // mngr is owner, update PTE and send page
       host->manager_pagetable[va_idx].writer = sender->id;
+      cdt_host_protect_page(page_addr, READ_ONLY_PAGE);
+      uint32_t migrate = cdt_worker_count_write(host, &host->manager_pagetable[va_idx], sender->id);
       cdt_packet_t write_resp_packet;
-      cdt_packet_write_resp_create(&write_resp_packet, host->manager_pagetable[va_idx].page);
+      cdt_packet_write_resp_create(&write_resp_packet, host->manager_pagetable[va_idx].page, host->manager_pagetable[va_idx].flags, migrate, !migrate);
       
       if (cdt_connection_send(&sender->connection, &write_resp_packet) != 0) {
         debug_print("Failed to send write response packet to peer %d\n", sender->id);
         pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
         return -1;
       }
-      free(host->manager_pagetable[va_idx].page);
+      cdt_host_protect_page(page_addr, INVALID_PAGE);
       host->manager_pagetable[va_idx].page = NULL;
+      if (migrate)
+        cdt_worker_do_home_leave(host, va_idx, sender->id);
       pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
       return 0;
     } else {
-      // Request invalidation and page from writer
-      cdt_packet_t invalidation_pkt;
-      cdt_packet_write_invalidate_req_create(&invalidation_pkt, PGROUNDDOWN(page_addr), sender->id);
-      if (cdt_connection_send(&host->peers[host->manager_pagetable[va_idx].writer].connection, &invalidation_pkt) != 0) {
-        debug_print("Failed to send write-invalidate request packet\n");
+      // Have the writer hand the page straight to the requester and only tell us once it has
+      uint32_t migrate = cdt_worker_count_write(host, &host->manager_pagetable[va_idx], sender->id);
+      cdt_packet_t forward_pkt;
+      cdt_packet_write_forward_req_create(&forward_pkt, PGROUNDDOWN(page_addr), sender->id, migrate);
+      if (cdt_connection_send(&host->peers[host->manager_pagetable[va_idx].writer].connection, &forward_pkt) != 0) {
+        debug_print("Failed to send write forward request packet\n");
         pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
         return -1;
       }
       cdt_packet_t resp_packet;
-      if (mq_receive(sender->task_queue, (char*)&resp_packet, sizeof(resp_packet), NULL) == -1) {
-        debug_print("Failed to receive a write-invalidate response message from manager receiver-thread\n");
+      if (cdt_worker_receive_response(sender, &resp_packet) != 0) {
+        debug_print("Failed to receive a write forward response message from manager receiver-thread\n");
         pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
         return -1;
       }
-      void * page;
-      uint32_t requester_id;
-      cdt_packet_write_invalidate_resp_parse(&resp_packet, &page, &requester_id);
+      uint64_t resp_page_addr;
+      uint32_t requester_id, clean;
+      cdt_packet_write_forward_resp_parse(&resp_packet, &resp_page_addr, &requester_id, &clean);
       assert(requester_id == sender->id);
+      assert(resp_page_addr == PGROUNDDOWN(page_addr));
+      // The last machine to read the page did not go on to write it, so it is shared rather than migratory
+      if (clean)
+        host->manager_pagetable[va_idx].migratory = 0;
       // Update mngr PTE access and page
       host->manager_pagetable[va_idx].writer = sender->id;
       host->manager_pagetable[va_idx].in_use = 1;
       host->manager_pagetable[va_idx].page = NULL; // technically should already be null
 
-      cdt_packet_t write_resp;
-      cdt_packet_write_resp_create(&write_resp, page);
-      if (cdt_connection_send(&sender->connection, &write_resp) != 0) {
-        debug_print("Failed to send write response packet\n");
-        pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
-        return -1;
-      }
+      if (migrate)
+        cdt_worker_do_home_leave(host, va_idx, sender->id);
       pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
       return 0;
     }
 
   } else {
-    // Send invalidation requests to all readers and send the page back to the requester
+    // Send invalidation requests to all readers, whose leases have already run out, and send the page back to the requester
     int read_count = 0;
     cdt_packet_t packet;
     cdt_packet_read_invalidate_req_create(&packet, page_addr, sender->id);
@@ -196,7 +536,7 @@ int cdt_worker_write_req(cdt_peer_t *sender, cdt_packet_t *packet) {
     }
 
     for (int j = 0; j < read_count; j++) {
-      if (mq_receive(sender->task_queue, (char*)&packet, sizeof(packet), NULL) == -1) {
+      if (cdt_worker_receive_response(sender, &packet) != 0) {
         pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
         return -1;
       }
@@ -211,27 +551,84 @@ int cdt_worker_write_req(cdt_peer_t *sender, cdt_packet_t *packet) {
       host->manager_pagetable[va_idx].read_set[p] = 0;
     
     host->manager_pagetable[va_idx].writer = sender->id;
+    uint32_t migrate = cdt_worker_count_write(host, &host->manager_pagetable[va_idx], sender->id);
 
     // Send page to requester
-    cdt_packet_write_resp_create(&packet, host->manager_pagetable[va_idx].page);
+    cdt_packet_write_resp_create(&packet, host->manager_pagetable[va_idx].page, host->manager_pagetable[va_idx].flags, migrate, !migrate);
     if (cdt_connection_send(&sender->connection, &packet) != 0) {
       debug_print("Failed to send write response packet\n");
       pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
       return -1;
     }    
-    free(host->manager_pagetable[va_idx].page);
+    cdt_host_protect_page(page_addr, INVALID_PAGE);
     host->manager_pagetable[va_idx].page = NULL;
+    if (migrate)
+      cdt_worker_do_home_leave(host, va_idx, sender->id);
     pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
     return 0;
   }
   return -1;
 }
 
+int cdt_worker_upgrade_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint64_t page_addr;
+  cdt_packet_upgrade_req_parse(packet, &page_addr);
+  assert(page_addr - PGROUNDDOWN(page_addr) == 0);
+
+  int va_idx = SHARED_VA_TO_IDX(page_addr);
+  cdt_host_t * host = cdt_get_host();
+  cdt_manager_pte_t *pte = &host->manager_pagetable[va_idx];
+  pthread_mutex_lock(&pte->lock);
+
+  if (cdt_host_home(host, va_idx) != host->self_id) {
+    pthread_mutex_unlock(&pte->lock);
+    return cdt_worker_home_moved(host, sender, page_addr, cdt_host_home(host, va_idx));
+  }
+
+  // The requester's copy is only current while it is still one of the readers, otherwise it needs the page
+  if (!pte->in_use || (pte->flags & CDT_MALLOC_MULTIPLE_WRITER) || pte->writer >= 0 || !pte->read_set[sender->id]) {
+    pthread_mutex_unlock(&pte->lock);
+    cdt_packet_write_req_create(packet, page_addr);
+    return cdt_worker_write_req(sender, packet);
+  }
+
+  if (cdt_worker_park_for_leases(host, sender, pte, packet, 1)) {
+    pthread_mutex_unlock(&pte->lock);
+    return 0;
+  }
+
+  cdt_worker_detect_migratory(host, pte, sender->id);
+  cdt_worker_next_version(host, pte);
+
+  if (cdt_worker_invalidate_readers(host, pte, sender->id) != 0) {
+    pthread_mutex_unlock(&pte->lock);
+    return -1;
+  }
+
+  for (int p = 0; p < CDT_MAX_MACHINES; p++)
+    pte->read_set[p] = 0;
+
+  pte->writer = sender->id;
+  uint32_t migrate = cdt_worker_count_write(host, pte, sender->id);
+
+  cdt_packet_upgrade_resp_create(packet, page_addr, migrate, !migrate);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send upgrade response packet to peer %d\n", sender->id);
+    pthread_mutex_unlock(&pte->lock);
+    return -1;
+  }
+
+  cdt_host_protect_page(page_addr, INVALID_PAGE);
+  pte->page = NULL;
+  if (migrate)
+    cdt_worker_do_home_leave(host, va_idx, sender->id);
+  pthread_mutex_unlock(&pte->lock);
+  return 0;
+}
+
 int cdt_worker_write_demote(cdt_peer_t *sender, cdt_packet_t *packet) {
   cdt_host_t *host = cdt_get_host();
 
-  assert(!host->manager);
-
   uint64_t page_addr;
   uint32_t requester_id;
   cdt_packet_write_demote_req_parse(packet, &page_addr, &requester_id);
@@ -239,14 +636,37 @@ int cdt_worker_write_demote(cdt_peer_t *sender, cdt_packet_t *packet) {
 
   int va_idx = SHARED_VA_TO_IDX(page_addr);
   // TODO: verify va_idx is valid
+  assert(cdt_host_home(host, va_idx) != host->self_id);
 
   pthread_mutex_lock(&host->shared_pagetable[va_idx].lock);
 
-  if (host->shared_pagetable[va_idx].in_use && host->shared_pagetable[va_idx].access == READ_WRITE_PAGE) {
+  if (host->shared_pagetable[va_idx].in_use &&
+      (host->shared_pagetable[va_idx].access == READ_WRITE_PAGE || host->shared_pagetable[va_idx].exclusive)) {
     host->shared_pagetable[va_idx].access = READ_ONLY_PAGE;
+    host->shared_pagetable[va_idx].exclusive = 0;
+    cdt_host_protect_page(page_addr, READ_ONLY_PAGE);
+
+    // The home starts timing our lease once it has our response, which is after this
+    if (host->shared_pagetable[va_idx].flags & CDT_MALLOC_LEASE)
+      cdt_host_start_lease(host, va_idx, cdt_host_now() + CDT_LEASE_MS - CDT_LEASE_SLACK_MS);
+  }
+
+  if (requester_id != sender->id) {
+    // The home forwarded a read request, so the requester gets its copy from us rather than the home
+    cdt_packet_t read_resp;
+    cdt_packet_read_resp_create(&read_resp, host->shared_pagetable[va_idx].page, host->shared_pagetable[va_idx].flags, 0, 0);
+    if (cdt_connection_send(&host->peers[requester_id].connection, &read_resp) != 0) {
+      debug_print("Failed to send read response packet to peer %d\n", requester_id);
+      pthread_mutex_unlock(&host->shared_pagetable[va_idx].lock);
+      return -1;
+    }
   }
 
-  cdt_packet_write_demote_resp_create(packet, host->shared_pagetable[va_idx].page, requester_id);
+  cdt_packet_write_demote_resp_create(packet, host->shared_pagetable[va_idx].page, host->shared_pagetable[va_idx].base, requester_id);
+
+  // The home is brought up to date by the response, and will send the page again if we next write to it
+  free(host->shared_pagetable[va_idx].base);
+  host->shared_pagetable[va_idx].base = NULL;
 
   pthread_mutex_unlock(&host->shared_pagetable[va_idx].lock);
 
@@ -259,28 +679,58 @@ int cdt_worker_write_demote(cdt_peer_t *sender, cdt_packet_t *packet) {
 }
 
 int cdt_worker_read_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint64_t received = cdt_host_now();
   uint64_t page_addr;
-  cdt_packet_read_req_parse(packet, &page_addr);
+  uint32_t version;
+  cdt_packet_read_req_parse(packet, &page_addr, &version);
   assert(page_addr - PGROUNDDOWN(page_addr) == 0);
 
   int va_idx = SHARED_VA_TO_IDX(page_addr);
   // TODO: verify va_idx is valid
 
   cdt_host_t * host = cdt_get_host();
+  if (__atomic_load_n(&host->frozen[va_idx], __ATOMIC_ACQUIRE) && cdt_host_home(host, va_idx) == host->self_id) {
+    // Frozen pages never change or move, and their copies are never taken away, so nothing needs locking
+    cdt_packet_read_resp_create(packet, host->manager_pagetable[va_idx].page, host->manager_pagetable[va_idx].flags, 0, 0);
+    if (cdt_connection_send(&sender->connection, packet) != 0) {
+      debug_print("Failed to send read response packet to peer %d\n", sender->id);
+      return -1;
+    }
+
+    return 0;
+  }
+
   pthread_mutex_lock(&host->manager_pagetable[va_idx].lock);
+  if (cdt_host_home(host, va_idx) != host->self_id) {
+    pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+    return cdt_worker_home_moved(host, sender, page_addr, cdt_host_home(host, va_idx));
+  }
   if (!host->manager_pagetable[va_idx].in_use) {
-    debug_print("Got a read request for page %p with idx %d that is not in use in the manager page table\n", (void *)page_addr, va_idx);
+    debug_print("Got a read request for page %p with idx %d that is not in use in the home page table\n", (void *)page_addr, va_idx);
     pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+    cdt_worker_home_moved(host, sender, page_addr, CDT_PACKET_NO_HOME);
     return -1;
   }
+  if (cdt_worker_park_for_leases(host, sender, &host->manager_pagetable[va_idx], packet, 0)) {
+    pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+    return 0;
+  }
+  if (cdt_worker_take_migratory(host, &host->manager_pagetable[va_idx], sender->id)) {
+    // The reader is about to write the page too, so it is handled as a write request
+    pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+    cdt_packet_write_req_create(packet, page_addr);
+    return cdt_worker_write_req(sender, packet);
+  }
   if (host->manager_pagetable[va_idx].writer >= 0) { // page currently has a writer
     // Request demotion and a copy of the page from the writer
     uint32_t writer = host->manager_pagetable[va_idx].writer;
     if (writer == host->self_id) { // mngr is owner, update PTE and send page
       host->manager_pagetable[va_idx].writer = -1;
       host->manager_pagetable[va_idx].read_set[host->self_id] = 1;
-      host->manager_pagetable[va_idx].read_set[sender->id] = 1;
-      cdt_packet_read_resp_create(packet, host->manager_pagetable[va_idx].page);
+      cdt_worker_grant_lease(host, &host->manager_pagetable[va_idx], sender->id);
+      cdt_host_protect_page(page_addr, READ_ONLY_PAGE);
+      cdt_packet_read_resp_create(packet, host->manager_pagetable[va_idx].page, host->manager_pagetable[va_idx].flags, cdt_host_now() - received,
+                                  cdt_worker_copy_version(&host->manager_pagetable[va_idx]));
       
       if (cdt_connection_send(&sender->connection, packet) != 0) {
         debug_print("Failed to send read response packet to peer %d\n", sender->id);
@@ -291,7 +741,7 @@ int cdt_worker_read_req(cdt_peer_t *sender, cdt_packet_t *packet) {
       pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
       return 0;
     } else {
-      // Request demotion and page from writer
+      // Request demotion from the writer, which sends the page to both the requester and us
       cdt_packet_write_demote_req_create(packet, page_addr, sender->id);
 
       if (cdt_connection_send(&host->peers[writer].connection, packet) != 0) {
@@ -300,27 +750,41 @@ int cdt_worker_read_req(cdt_peer_t *sender, cdt_packet_t *packet) {
         return -1;
       }
 
-      if (mq_receive(sender->task_queue, (char*)packet, sizeof(*packet), NULL) == -1) {
+      if (cdt_worker_receive_response(sender, packet) != 0) {
         pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
         return -1;
       }
 
-      void *page;
-      uint32_t requester_id;
-      cdt_packet_write_demote_resp_parse(packet, &page, &requester_id);
+      void *data;
+      uint32_t size, requester_id;
+      cdt_packet_write_demote_resp_parse(packet, &data, &size, &requester_id);
+
+      void *local_page = host->manager_pagetable[va_idx].page = cdt_worker_map_write_back(page_addr, data, size, READ_ONLY_PAGE);
+      if (!local_page) {
+        pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+        return -1;
+      }
 
+      // The writer has already sent the requester its copy
       host->manager_pagetable[va_idx].writer = -1;
       host->manager_pagetable[va_idx].read_set[host->self_id] = 1;
-      host->manager_pagetable[va_idx].read_set[writer] = 1;
-      host->manager_pagetable[va_idx].read_set[sender->id] = 1;
+      cdt_worker_grant_lease(host, &host->manager_pagetable[va_idx], writer);
+      cdt_worker_grant_lease(host, &host->manager_pagetable[va_idx], sender->id);
+
+      pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+      return 0;
+    }
 
-      void *local_page = host->manager_pagetable[va_idx].page = calloc(1, PAGESIZE);
-      memmove(local_page, page, PAGESIZE);
+  } else { // Currently in R/O
+    // Send the page to the requester, which must be invalidated before the page is next written
+    cdt_worker_grant_lease(host, &host->manager_pagetable[va_idx], sender->id);
+    host->manager_pagetable[va_idx].stale_set[sender->id] = 0;
 
-      cdt_packet_read_resp_create(packet, local_page);
-      
+    if (version != 0 && version == cdt_worker_copy_version(&host->manager_pagetable[va_idx])) {
+      // Nobody has written the page since the requester's copy was invalidated, so it can keep using it
+      cdt_packet_read_current_create(packet, page_addr, cdt_host_now() - received);
       if (cdt_connection_send(&sender->connection, packet) != 0) {
-        debug_print("Failed to send read response packet to peer %d\n", sender->id);
+        debug_print("Failed to send read current packet to peer %d\n", sender->id);
         pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
         return -1;
       }
@@ -329,9 +793,22 @@ int cdt_worker_read_req(cdt_peer_t *sender, cdt_packet_t *packet) {
       return 0;
     }
 
-  } else { // Currently in R/O
-    // Send the page to the requester
-    cdt_packet_read_resp_create(packet, host->manager_pagetable[va_idx].page);
+    uint32_t replica = cdt_worker_pick_replica(host, &host->manager_pagetable[va_idx], sender->id);
+    if (replica != host->self_id) {
+      // Let another reader's copy serve the requester, so popular pages are not all sent from here
+      cdt_packet_read_forward_req_create(packet, page_addr, sender->id);
+      if (cdt_connection_send(&host->peers[replica].connection, packet) != 0) {
+        debug_print("Failed to send read forward request packet to peer %d\n", replica);
+        pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+        return -1;
+      }
+
+      pthread_mutex_unlock(&host->manager_pagetable[va_idx].lock);
+      return 0;
+    }
+
+    cdt_packet_read_resp_create(packet, host->manager_pagetable[va_idx].page, host->manager_pagetable[va_idx].flags, cdt_host_now() - received,
+                                cdt_worker_copy_version(&host->manager_pagetable[va_idx]));
     
     if (cdt_connection_send(&sender->connection, packet) != 0) {
       debug_print("Failed to send read response packet to peer %d\n", sender->id);
@@ -345,49 +822,185 @@ int cdt_worker_read_req(cdt_peer_t *sender, cdt_packet_t *packet) {
   }
 }
 
-int cdt_worker_thread_create(cdt_peer_t *sender, cdt_packet_t *packet) {
-  cdt_host_t *host = cdt_get_host();
-  if (!host) return -1;
-
-  pthread_mutex_lock(&host->thread_lock);
+int cdt_worker_read_range_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t start, num_pages;
+  uint8_t *packet_wanted;
+  cdt_packet_read_range_req_parse(packet, &start, &num_pages, &packet_wanted);
 
-  cdt_thread_t *new_thread = cdt_worker_do_thread_create(host, sender, packet);
+  // The packet is reused for the responses, so keep our own copy of which pages were asked for
+  uint8_t wanted[CDT_PACKET_RANGE_MAX_PAGES / 8];
+  memmove(wanted, packet_wanted, (num_pages + 7) / 8);
 
-  if (new_thread != NULL) {
-    host->thread_counter++;
-    cdt_packet_thread_create_resp_create(packet, new_thread);
-  } else {
-    cdt_thread_t invalid_thread = { .valid = 0 };
-    cdt_packet_thread_create_resp_create(packet, &invalid_thread);
-  }
+  cdt_host_t *host = cdt_get_host();
+  for (uint32_t i = 0; i < num_pages && start + i < CDT_MAX_SHARED_PAGES; i++) {
+    if (!(wanted[i / 8] & (1 << (i % 8))))
+      continue;
+
+    uint32_t idx = start + i;
+    cdt_manager_pte_t *pte = &host->manager_pagetable[idx];
+    pthread_mutex_lock(&pte->lock);
+
+    // Pages held by another writer, waiting for leases to run out, or whose home has moved, are left for
+    // the requester to fault in
+    if (cdt_host_home(host, idx) != host->self_id || !pte->in_use ||
+        (pte->writer >= 0 && pte->writer != host->self_id) ||
+        ((pte->flags & CDT_MALLOC_LEASE) && pte->lease_wait > cdt_host_now())) {
+      pthread_mutex_unlock(&pte->lock);
+      continue;
+    }
 
-  pthread_mutex_unlock(&host->thread_lock);
+    if (pte->writer == host->self_id) {
+      pte->writer = -1;
+      pte->read_set[host->self_id] = 1;
+      cdt_host_protect_page(pte->shared_va, READ_ONLY_PAGE);
+    }
+    cdt_worker_grant_lease(host, pte, sender->id);
+    pte->stale_set[sender->id] = 0;
 
-  if (new_thread == NULL) {
-    if (cdt_connection_send(&sender->connection, packet) != 0)
-      debug_print("Failed to send thread create response to peer %d\n", sender->id);
+    cdt_packet_read_range_resp_create(packet, idx, pte->page, pte->flags);
+    if (cdt_connection_send(&sender->connection, packet) != 0) {
+      debug_print("Failed to send read range response packet to peer %d\n", sender->id);
+      pthread_mutex_unlock(&pte->lock);
+      return -1;
+    }
 
-    return -1;
+    pthread_mutex_unlock(&pte->lock);
   }
 
+  cdt_packet_read_range_resp_create(packet, CDT_PACKET_RANGE_DONE, NULL, 0);
   if (cdt_connection_send(&sender->connection, packet) != 0) {
-    debug_print("Failed to send thread create response to peer %d\n", sender->id);
+    debug_print("Failed to send read range response packet to peer %d\n", sender->id);
     return -1;
   }
 
   return 0;
 }
 
-cdt_thread_t* cdt_worker_do_thread_create(cdt_host_t *host, cdt_peer_t *sender, cdt_packet_t *packet) {
-  uint64_t procedure, arg;
-  cdt_packet_thread_create_req_parse(packet, &procedure, &arg);
+int cdt_worker_write_range_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t start, num_pages, overwrite;
+  uint8_t *packet_wanted;
+  cdt_packet_write_range_req_parse(packet, &start, &num_pages, &packet_wanted, &overwrite);
 
-  if (host->num_threads >= host->num_peers) {
-    debug_print("Maximum number of threads exceeded\n");
-    return NULL;
-  }
+  uint8_t wanted[CDT_PACKET_RANGE_MAX_PAGES / 8];
+  memmove(wanted, packet_wanted, (num_pages + 7) / 8);
 
-  cdt_peer_t *idle_peer = NULL;
+  // Every page handed over stays locked until it is sent, so its readers and writers can all be recalled at once
+  cdt_host_t *host = cdt_get_host();
+  for (uint32_t i = 0; i < num_pages; i++) {
+    if (!(wanted[i / 8] & (1 << (i % 8))))
+      continue;
+
+    uint32_t idx = start + i;
+    if (idx >= CDT_MAX_SHARED_PAGES) {
+      wanted[i / 8] &= ~(1 << (i % 8));
+      continue;
+    }
+
+    cdt_manager_pte_t *pte = &host->manager_pagetable[idx];
+    pthread_mutex_lock(&pte->lock);
+
+    // Pages whose home has moved, that the requester somehow already owns, or whose readers' leases have
+    // yet to run out are left for it to fault in
+    if (cdt_host_home(host, idx) != host->self_id || !pte->in_use || pte->writer == (int)sender->id ||
+        ((pte->flags & CDT_MALLOC_LEASE) && pte->writer < 0 &&
+         cdt_worker_revoke_leases(host, pte, sender->id) > cdt_host_now())) {
+      wanted[i / 8] &= ~(1 << (i % 8));
+      pthread_mutex_unlock(&pte->lock);
+    }
+  }
+
+  int res = cdt_worker_recall_range(host, sender->id, start, num_pages, wanted, 1);
+
+  for (uint32_t i = 0; i < num_pages; i++) {
+    if (!(wanted[i / 8] & (1 << (i % 8))))
+      continue;
+
+    uint32_t idx = start + i;
+    cdt_manager_pte_t *pte = &host->manager_pagetable[idx];
+
+    if (res == 0 && (pte->flags & CDT_MALLOC_MULTIPLE_WRITER)) {
+      // Other copies are left alone, the requester sends back only its changes at its next synchronization point
+      pte->read_set[sender->id] = 1;
+      pte->write_set[sender->id] = 1;
+      pte->stale_set[sender->id] = 0;
+    } else if (res == 0) {
+      pte->read_set[host->self_id] = 0;
+      pte->writer = sender->id;
+      cdt_worker_next_version(host, pte);
+      cdt_host_protect_page(pte->shared_va, READ_ONLY_PAGE);
+    } else {
+      pthread_mutex_unlock(&pte->lock);
+      continue;
+    }
+
+    // A single-writer page the requester is about to overwrite is handed over without its contents.
+    // Multiple-writer pages are always sent, since the requester's twin has to match our copy.
+    int send_page = !overwrite || (pte->flags & CDT_MALLOC_MULTIPLE_WRITER);
+    cdt_packet_write_range_resp_create(packet, idx, send_page ? pte->page : NULL, pte->flags);
+    if (cdt_connection_send(&sender->connection, packet) != 0) {
+      debug_print("Failed to send write range response packet to peer %d\n", sender->id);
+      res = -1;
+    }
+
+    if (!(pte->flags & CDT_MALLOC_MULTIPLE_WRITER)) {
+      cdt_host_protect_page(pte->shared_va, INVALID_PAGE);
+      pte->page = NULL;
+    }
+    pthread_mutex_unlock(&pte->lock);
+  }
+
+  cdt_packet_write_range_resp_create(packet, CDT_PACKET_RANGE_DONE, NULL, 0);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send write range response packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return res;
+}
+
+int cdt_worker_thread_create(cdt_peer_t *sender, cdt_packet_t *packet) {
+  cdt_host_t *host = cdt_get_host();
+  if (!host) return -1;
+
+  pthread_mutex_lock(&host->thread_lock);
+
+  cdt_thread_t *new_thread = cdt_worker_do_thread_create(host, sender, packet);
+
+  if (new_thread != NULL) {
+    host->thread_counter++;
+    cdt_packet_thread_create_resp_create(packet, new_thread);
+  } else {
+    cdt_thread_t invalid_thread = { .valid = 0 };
+    cdt_packet_thread_create_resp_create(packet, &invalid_thread);
+  }
+
+  pthread_mutex_unlock(&host->thread_lock);
+
+  if (new_thread == NULL) {
+    if (cdt_connection_send(&sender->connection, packet) != 0)
+      debug_print("Failed to send thread create response to peer %d\n", sender->id);
+
+    return -1;
+  }
+
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send thread create response to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return 0;
+}
+
+cdt_thread_t* cdt_worker_do_thread_create(cdt_host_t *host, cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint64_t procedure, arg;
+  cdt_packet_thread_create_req_parse(packet, &procedure, &arg);
+
+  if (host->num_threads >= host->num_peers) {
+    debug_print("Maximum number of threads exceeded\n");
+    return NULL;
+  }
+
+  cdt_peer_t *idle_peer = NULL;
 
   for (uint32_t i = 0; i < host->num_peers; i++) {
     cdt_peer_t *peer = host->peers + i;
@@ -430,6 +1043,29 @@ cdt_thread_t* cdt_worker_do_thread_create(cdt_host_t *host, cdt_peer_t *sender,
   return &idle_peer->thread;
 }
 
+/**
+ * The procedure and argument of a thread assigned to this machine.
+ */
+typedef struct cdt_worker_thread_call_t {
+  void *(*procedure)(void *);
+  void *arg;
+} cdt_worker_thread_call_t;
+
+void* cdt_worker_thread_run(void *arg) {
+  cdt_worker_thread_call_t call = *(cdt_worker_thread_call_t*)arg;
+  free(arg);
+
+  // The thread must see every write released before it was created
+  cdt_acquire();
+
+  void *return_value = call.procedure(call.arg);
+
+  // The completion of a thread is a synchronization point, so its writes are published before it can be joined
+  cdt_release();
+
+  return return_value;
+}
+
 unsigned int cdt_worker_do_thread_assign(cdt_host_t *host, cdt_peer_t *sender,
                                 uint32_t parent_id, uint64_t procedure, uint64_t arg, uint32_t thread_id) {
   cdt_peer_t *self = &host->peers[host->self_id];
@@ -440,7 +1076,17 @@ unsigned int cdt_worker_do_thread_assign(cdt_host_t *host, cdt_peer_t *sender,
   self->thread.remote_thread_id = thread_id;
   self->thread.valid = 1;
 
-  if (pthread_create(&self->thread.local_id, NULL, (void*(*)(void*))procedure, (void*)arg) != 0) {
+  cdt_worker_thread_call_t *call = malloc(sizeof(cdt_worker_thread_call_t));
+  if (!call) {
+    self->thread.valid = 0;
+    return 1;
+  }
+
+  call->procedure = (void*(*)(void*))procedure;
+  call->arg = (void*)arg;
+
+  if (pthread_create(&self->thread.local_id, NULL, cdt_worker_thread_run, call) != 0) {
+    free(call);
     self->thread.valid = 0;
     return 1;
   }
@@ -482,6 +1128,29 @@ int cdt_worker_thread_assign(cdt_peer_t *sender, cdt_packet_t *packet) {
   return 0;
 }
 
+/**
+ * A join request waiting for the thread assigned to this machine to finish.
+ */
+typedef struct cdt_worker_thread_join_call_t {
+  cdt_peer_t *sender;
+  pthread_t local_id;
+} cdt_worker_thread_join_call_t;
+
+void* cdt_worker_thread_join_wait(void *arg) {
+  cdt_worker_thread_join_call_t call = *(cdt_worker_thread_join_call_t*)arg;
+  free(arg);
+
+  void *return_value = NULL;
+  int res = pthread_join(call.local_id, &return_value) != 0;
+
+  cdt_packet_t packet;
+  cdt_packet_thread_join_resp_create(&packet, res, (uint64_t)return_value);
+  if (cdt_connection_send(&call.sender->connection, &packet))
+    debug_print("Failed to sent thread join response\n");
+
+  return NULL;
+}
+
 int cdt_worker_thread_join(cdt_peer_t *sender, cdt_packet_t *packet) {
   cdt_host_t *host = cdt_get_host();
   if (!host) return -1;
@@ -491,16 +1160,24 @@ int cdt_worker_thread_join(cdt_peer_t *sender, cdt_packet_t *packet) {
 
   cdt_thread_t self_thread = cdt_thread_self();
 
-  void *return_value = NULL;
-  int res;
-
   if (cdt_thread_equal(&thread, &self_thread)) {
-    res = pthread_join(self_thread.local_id, &return_value) != 0;
-  } else {
-    res = 1;
+    // The thread may still need this worker to answer requests for pages it holds, so wait for it elsewhere
+    cdt_worker_thread_join_call_t *call = malloc(sizeof(cdt_worker_thread_join_call_t));
+    pthread_t waiter;
+    if (call) {
+      call->sender = sender;
+      call->local_id = self_thread.local_id;
+
+      if (pthread_create(&waiter, NULL, cdt_worker_thread_join_wait, call) == 0) {
+        pthread_detach(waiter);
+        return 0;
+      }
+
+      free(call);
+    }
   }
 
-  cdt_packet_thread_join_resp_create(packet, res, (uint64_t)return_value);
+  cdt_packet_thread_join_resp_create(packet, 1, 0);
   if (cdt_connection_send(&sender->connection, packet)) {
     debug_print("Failed to sent thread join response\n");
     return -1;
@@ -509,40 +1186,140 @@ int cdt_worker_thread_join(cdt_peer_t *sender, cdt_packet_t *packet) {
   return 0;
 }
 
-int cdt_find_unused_pte(uint32_t peer_id, uint32_t num_pages) {
+void cdt_worker_do_home_alloc(cdt_host_t *host, uint32_t allocator_id, uint32_t start, uint32_t num_pages, uint32_t flags) {
+  uint32_t shift = CDT_BLOCK_SHIFT(flags);
+  for (uint32_t i = start; i < start + num_pages; i++) {
+    host->block_shifts[i] = shift;
+    if (shift) // every page of a block shares the home of the block
+      __atomic_store_n(&host->homes[i], (i >> shift) % host->num_machines, __ATOMIC_RELEASE);
+    __atomic_store_n(&host->halo[i], (flags & CDT_MALLOC_HALO) != 0, __ATOMIC_RELEASE);
+  }
+
+  // Every machine keeps its own copy of halo pages, so their homes have nothing to keep track of
+  if (flags & CDT_MALLOC_HALO)
+    return;
+
+  for (uint32_t i = start; i < start + num_pages; i++) {
+    if (cdt_host_home(host, i) != host->self_id)
+      continue;
+
+    pthread_mutex_lock(&host->manager_pagetable[i].lock);
+    host->manager_pagetable[i].in_use = 1;
+    host->manager_pagetable[i].flags = flags;
+    host->manager_pagetable[i].last_writer = -1;
+    host->manager_pagetable[i].migratory = 0;
+
+    if (flags & CDT_MALLOC_MULTIPLE_WRITER) {
+      // The home always holds the merged copy of a multiple-writer page, and the allocator starts out as a writer
+      host->manager_pagetable[i].writer = -1;
+      host->manager_pagetable[i].page = cdt_host_map_page(host->manager_pagetable[i].shared_va, NULL, READ_ONLY_PAGE);
+      if (allocator_id != host->self_id) {
+        host->manager_pagetable[i].read_set[allocator_id] = 1;
+        host->manager_pagetable[i].write_set[allocator_id] = 1;
+      }
+    } else {
+      host->manager_pagetable[i].writer = allocator_id;
+      host->manager_pagetable[i].last_writer = allocator_id;
+      cdt_worker_next_version(host, &host->manager_pagetable[i]);
+      if (allocator_id == host->self_id)
+        host->manager_pagetable[i].page = cdt_host_map_page(host->manager_pagetable[i].shared_va, NULL, READ_WRITE_PAGE);
+    }
+
+    pthread_mutex_unlock(&host->manager_pagetable[i].lock);
+  }
+}
+
+int cdt_find_unused_pte(uint32_t peer_id, uint32_t num_pages, uint32_t flags) {
   cdt_host_t *host = cdt_get_host();
 
   assert(host->manager == 1);
 
-  unsigned int first_unalloc_page = __atomic_fetch_add(&host->manager_first_unallocated_pg_idx, num_pages, __ATOMIC_SEQ_CST);
+  // Allocations made of coherence blocks start on a block boundary
+  uint32_t block_pages = 1 << CDT_BLOCK_SHIFT(flags);
+  unsigned int first_unalloc_page = __atomic_load_n(&host->manager_first_unallocated_pg_idx, __ATOMIC_SEQ_CST);
+  unsigned int start;
+  do {
+    start = (first_unalloc_page + block_pages - 1) & ~(block_pages - 1);
+  } while (!__atomic_compare_exchange_n(&host->manager_first_unallocated_pg_idx, &first_unalloc_page, start + num_pages,
+                                        0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+  first_unalloc_page = start;
   if (first_unalloc_page + num_pages > CDT_MAX_SHARED_PAGES)
     return -1;
-  
-  for (unsigned int i = first_unalloc_page; i < first_unalloc_page + num_pages; i++) {
-    pthread_mutex_lock(&host->manager_pagetable[i].lock);
-    host->manager_pagetable[i].in_use = 1;
-    host->manager_pagetable[i].writer = peer_id;
+
+  // Tell every other home of a page in the range about the allocation, and wait until they have all
+  // set up their PTEs so the allocator can't request a page its home doesn't know about yet.
+  // Every machine needs to know the block size of blocked allocations and which pages are halo pages,
+  // so those are sent to everyone.
+  cdt_packet_t packet;
+  cdt_packet_home_alloc_req_create(&packet, peer_id, first_unalloc_page, num_pages, flags);
+  int everyone = block_pages > 1 || (flags & CDT_MALLOC_HALO);
+  uint32_t num_homes = everyone ? host->num_machines : num_pages;
+  int pending = 0;
+  for (uint32_t home = 0; home < host->num_machines && home < num_homes; home++) {
+    uint32_t home_id = everyone ? home : cdt_host_home(host, first_unalloc_page + home);
+    if (home_id == host->self_id)
+      continue;
+
+    if (cdt_connection_send(&host->peers[home_id].connection, &packet) != 0) {
+      debug_print("Failed to send home allocation request to peer %d\n", home_id);
+      return -1;
+    }
+    pending++;
+  }
+
+  cdt_worker_do_home_alloc(host, peer_id, first_unalloc_page, num_pages, flags);
+
+  int res = first_unalloc_page;
+  for (int j = 0; j < pending; j++) {
+    if (mq_receive(host->peers[peer_id].task_queue, (char*)&packet, sizeof(packet), NULL) == -1)
+      return -1;
+
+    uint32_t requester_id, status;
+    cdt_packet_home_alloc_resp_parse(&packet, &requester_id, &status);
+    assert(requester_id == peer_id);
+
+    if (status != 0)
+      res = -1;
+  }
+
+  return res;
+}
+
+int cdt_worker_home_alloc(cdt_peer_t *sender, cdt_packet_t *packet) {
+  cdt_host_t *host = cdt_get_host();
+
+  uint32_t allocator_id, start, num_pages, flags;
+  cdt_packet_home_alloc_req_parse(packet, &allocator_id, &start, &num_pages, &flags);
+
+  int res = 0;
+  if (sender->id != 0 || allocator_id >= host->num_machines || start + num_pages > CDT_MAX_SHARED_PAGES) {
+    debug_print("Got an invalid home allocation request from peer %d\n", sender->id);
+    res = -1;
+  } else {
+    cdt_worker_do_home_alloc(host, allocator_id, start, num_pages, flags);
+  }
+
+  cdt_packet_home_alloc_resp_create(packet, allocator_id, res == 0 ? 0 : 1);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send home allocation response to peer %d\n", sender->id);
+    return -1;
   }
 
-  return first_unalloc_page;
+  return res;
 }
 
 int cdt_allocate_shared_page(cdt_peer_t * sender, cdt_packet_t *packet) {
   cdt_host_t * host = cdt_get_host();
   uint32_t peer_id;
   uint32_t num_pages;
-  cdt_packet_alloc_req_parse(packet, &peer_id, &num_pages);
+  uint32_t flags;
+  cdt_packet_alloc_req_parse(packet, &peer_id, &num_pages, &flags);
   // Find the next not in-use PTE
-  int start_pte_idx = cdt_find_unused_pte(peer_id, num_pages);
+  int start_pte_idx = cdt_find_unused_pte(peer_id, num_pages, flags);
   uint64_t page_addr;
 
   if (start_pte_idx >= 0) {
     page_addr = host->manager_pagetable[start_pte_idx].shared_va;
-
-    // Release all held locks
-    for (int j = start_pte_idx; j < start_pte_idx + num_pages; j++) {
-      pthread_mutex_unlock(&host->manager_pagetable[j].lock);
-    }
   } else {
     page_addr = 0;
     num_pages = 0;
@@ -556,4 +1333,1183 @@ int cdt_allocate_shared_page(cdt_peer_t * sender, cdt_packet_t *packet) {
   }
 
   return 0;
-}
\ No newline at end of file
+}
+int cdt_worker_invalidate_readers(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t requester_id) {
+  int read_count = 0;
+  cdt_packet_t packet;
+  cdt_packet_read_invalidate_req_create(&packet, pte->shared_va, requester_id);
+  for (int i = 0; i < CDT_MAX_MACHINES; i++) {
+    if (pte->read_set[i] && !pte->write_set[i] && i != host->self_id && i != requester_id) {
+      read_count++;
+      if (cdt_connection_send(&host->peers[i].connection, &packet) != 0) {
+        debug_print("Failed to send read-invalidate request packet to peer %d\n", i);
+        return -1;
+      }
+      pte->read_set[i] = 0;
+    }
+  }
+
+  for (int j = 0; j < read_count; j++) {
+    if (cdt_worker_receive_response(&host->peers[requester_id], &packet) != 0)
+      return -1;
+
+    uint64_t resp_page_addr;
+    uint32_t resp_requester_id;
+    cdt_packet_read_invalidate_resp_parse(&packet, &resp_page_addr, &resp_requester_id);
+    assert(resp_requester_id == requester_id);
+    assert(resp_page_addr == pte->shared_va);
+  }
+
+  return 0;
+}
+
+int cdt_worker_recall_range(cdt_host_t *host, uint32_t requester_id, uint32_t start, uint32_t num_pages, const uint8_t *wanted, int write) {
+  cdt_peer_t *requester = &host->peers[requester_id];
+  cdt_packet_t packet;
+  int read_count = 0;
+  uint64_t lease_expiry = 0;
+
+  // Readers only lose their copies to a writer, and each is sent one request covering all of its pages
+  for (uint32_t chunk = 0; write && chunk < num_pages; chunk += CDT_PACKET_RANGE_MAX_PAGES) {
+    uint32_t chunk_pages = num_pages - chunk < CDT_PACKET_RANGE_MAX_PAGES ? num_pages - chunk : CDT_PACKET_RANGE_MAX_PAGES;
+    uint8_t copies[CDT_MAX_MACHINES][CDT_PACKET_RANGE_MAX_PAGES / 8];
+    int holding[CDT_MAX_MACHINES];
+    memset(copies, 0, sizeof(copies));
+    memset(holding, 0, sizeof(holding));
+
+    for (uint32_t i = chunk; i < chunk + chunk_pages; i++) {
+      cdt_manager_pte_t *pte = &host->manager_pagetable[start + i];
+      if (!(wanted[i / 8] & (1 << (i % 8))) || pte->writer >= 0 || (pte->flags & CDT_MALLOC_MULTIPLE_WRITER))
+        continue;
+
+      if (pte->flags & CDT_MALLOC_LEASE) {
+        uint64_t expiry = cdt_worker_revoke_leases(host, pte, requester_id);
+        if (expiry > lease_expiry)
+          lease_expiry = expiry;
+      }
+
+      for (int p = 0; p < CDT_MAX_MACHINES; p++) {
+        if (pte->read_set[p] && p != host->self_id && p != requester_id) {
+          copies[p][(i - chunk) / 8] |= 1 << ((i - chunk) % 8);
+          holding[p] = 1;
+        }
+        pte->read_set[p] = 0;
+      }
+    }
+
+    for (int p = 0; p < CDT_MAX_MACHINES; p++) {
+      if (!holding[p])
+        continue;
+
+      cdt_packet_read_invalidate_range_req_create(&packet, start + chunk, chunk_pages, copies[p], requester_id);
+      if (cdt_connection_send(&host->peers[p].connection, &packet) != 0) {
+        debug_print("Failed to send read-invalidate range request packet to peer %d\n", p);
+        return -1;
+      }
+      read_count++;
+    }
+  }
+
+  for (int j = 0; j < read_count; j++) {
+    if (cdt_worker_receive_response(requester, &packet) != 0)
+      return -1;
+
+    uint32_t resp_requester_id, resp_start;
+    cdt_packet_read_invalidate_range_resp_parse(&packet, &resp_requester_id, &resp_start);
+    assert(resp_requester_id == requester_id);
+  }
+
+  // The leases on every page run out together, so they are only waited for once. Worker threads have
+  // already left out the pages whose leases have yet to run out, so only a home's own fault waits here.
+  cdt_worker_wait_lease(lease_expiry);
+
+  // Responses from a writer carry no page address, but it answers our requests in the order they were sent.
+  // Only a few are kept in flight, since its responses queue up behind the requests we have yet to send.
+  for (uint32_t w = 0; w < host->num_machines; w++) {
+    if (w == host->self_id)
+      continue;
+
+    uint32_t next_send = 0, next_recv = 0;
+    int in_flight = 0;
+    while (1) {
+      for (; next_send < num_pages && in_flight < CDT_WORKER_RECALL_WINDOW; next_send++) {
+        cdt_manager_pte_t *pte = &host->manager_pagetable[start + next_send];
+        if (!(wanted[next_send / 8] & (1 << (next_send % 8))) || pte->writer != (int)w)
+          continue;
+
+        if (write)
+          cdt_packet_write_invalidate_req_create(&packet, pte->shared_va, requester_id);
+        else
+          cdt_packet_write_demote_req_create(&packet, pte->shared_va, requester_id);
+
+        if (cdt_connection_send(&host->peers[w].connection, &packet) != 0) {
+          debug_print("Failed to send recall request packet to peer %d\n", w);
+          return -1;
+        }
+        in_flight++;
+      }
+
+      if (in_flight == 0)
+        break;
+
+      while (!(wanted[next_recv / 8] & (1 << (next_recv % 8))) || host->manager_pagetable[start + next_recv].writer != (int)w)
+        next_recv++;
+
+      if (cdt_worker_receive_response(requester, &packet) != 0)
+        return -1;
+
+      void *data;
+      uint32_t size, resp_requester_id;
+      if (write)
+        cdt_packet_write_invalidate_resp_parse(&packet, &data, &size, &resp_requester_id);
+      else
+        cdt_packet_write_demote_resp_parse(&packet, &data, &size, &resp_requester_id);
+      assert(resp_requester_id == requester_id);
+
+      cdt_manager_pte_t *pte = &host->manager_pagetable[start + next_recv];
+      pte->page = cdt_worker_map_write_back(pte->shared_va, data, size, READ_ONLY_PAGE);
+      if (!pte->page)
+        return -1;
+
+      // A demoted writer keeps its copy, an invalidated one does not
+      pte->read_set[w] = 0;
+      if (!write)
+        cdt_worker_grant_lease(host, pte, w);
+      pte->read_set[host->self_id] = 1;
+      pte->writer = -1;
+      in_flight--;
+    }
+  }
+
+  return 0;
+}
+
+int cdt_worker_push_update(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t requester_id, const void *diff, uint32_t diff_size) {
+  int read_count = 0;
+  cdt_packet_t packet;
+  cdt_packet_write_update_req_create(&packet, pte->shared_va, requester_id, diff, diff_size);
+  for (int i = 0; i < CDT_MAX_MACHINES; i++) {
+    if (pte->read_set[i] && i != host->self_id && i != requester_id) {
+      read_count++;
+      if (cdt_connection_send(&host->peers[i].connection, &packet) != 0) {
+        debug_print("Failed to send write update request packet to peer %d\n", i);
+        return -1;
+      }
+    }
+  }
+
+  for (int j = 0; j < read_count; j++) {
+    if (cdt_worker_receive_response(&host->peers[requester_id], &packet) != 0)
+      return -1;
+
+    uint64_t resp_page_addr;
+    uint32_t resp_requester_id;
+    cdt_packet_write_update_resp_parse(&packet, &resp_page_addr, &resp_requester_id);
+    assert(resp_requester_id == requester_id);
+    assert(resp_page_addr == pte->shared_va);
+  }
+
+  return 0;
+}
+
+int cdt_worker_write_update_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint64_t page_addr;
+  uint32_t requester_id, diff_size;
+  void *diff;
+  cdt_packet_write_update_req_parse(packet, &page_addr, &requester_id, &diff, &diff_size);
+
+  cdt_host_t *host = cdt_get_host();
+  int va_idx = SHARED_VA_TO_IDX(page_addr);
+  cdt_host_pte_t *pte = &host->shared_pagetable[va_idx];
+
+  // As with invalidations, a copy that is still being fetched is dropped rather than waiting for the lock
+  int locked = 0;
+  while (!(locked = pthread_mutex_trylock(&pte->lock) == 0)) {
+    pthread_mutex_lock(&pte->fetch_lock);
+    if (pte->fetching) {
+      pte->fetch_invalidated = 1;
+      pthread_mutex_unlock(&pte->fetch_lock);
+      break;
+    }
+    pthread_mutex_unlock(&pte->fetch_lock);
+    sched_yield();
+  }
+
+  int res = 0;
+  if (locked && pte->in_use && pte->access != INVALID_PAGE) {
+    // Patch the twin as well, so the changes are not sent back as our own at our next release. A page
+    // we are writing ourselves is patched in place, since our own writes to it must not be lost.
+    if (pte->access == READ_ONLY_PAGE)
+      res = cdt_host_patch_page(page_addr, diff, diff_size, READ_ONLY_PAGE) ? 0 : -1;
+    else
+      res = cdt_diff_apply(pte->page, diff, diff_size);
+    if (res == 0 && pte->twin)
+      res = cdt_diff_apply(pte->twin, diff, diff_size);
+  }
+
+  if (locked)
+    pthread_mutex_unlock(&pte->lock);
+
+  if (res != 0)
+    debug_print("Got a malformed write update for page %p from peer %d\n", (void *)page_addr, sender->id);
+
+  cdt_packet_write_update_resp_create(packet, page_addr, requester_id);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send write update response packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return res;
+}
+
+int cdt_worker_diff_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint64_t page_addr;
+  void *diff;
+  uint32_t diff_size;
+  cdt_packet_diff_req_parse(packet, &page_addr, &diff, &diff_size);
+  assert(page_addr - PGROUNDDOWN(page_addr) == 0);
+
+  cdt_host_t *host = cdt_get_host();
+  int va_idx = SHARED_VA_TO_IDX(page_addr);
+  cdt_manager_pte_t *pte = &host->manager_pagetable[va_idx];
+  pthread_mutex_lock(&pte->lock);
+
+  // The writer waits for our answer even if its diff cannot be merged
+  int res = 0;
+  if (!pte->in_use || !(pte->flags & CDT_MALLOC_MULTIPLE_WRITER)) {
+    debug_print("Got a diff for page %p with idx %d that is not a multiple-writer page\n", (void *)page_addr, va_idx);
+    res = -1;
+  }
+
+  // Merge the writer's changes into the home's copy, and its twin so they are not taken for the home's own
+  if (res == 0) {
+    if (pte->dirty)
+      res = cdt_diff_apply(pte->page, diff, diff_size);
+    else
+      res = cdt_host_patch_page(page_addr, diff, diff_size, READ_ONLY_PAGE) ? 0 : -1;
+    if (res == 0 && pte->twin)
+      res = cdt_diff_apply(pte->twin, diff, diff_size);
+
+    if (res != 0)
+      debug_print("Got a malformed diff for page %p from peer %d\n", (void *)page_addr, sender->id);
+  }
+
+  if (res == 0) {
+    pte->write_set[sender->id] = 0;
+
+    if (pte->flags & CDT_MALLOC_WRITE_UPDATE) {
+      // Every other copy is patched with the same changes, so the writer and readers all keep theirs
+      res = cdt_worker_push_update(host, pte, sender->id, diff, diff_size);
+    } else if (pte->flags & CDT_MALLOC_RELEASE_CONSISTENT) {
+      // The writer keeps its copy, and readers learn their copies are stale at their next acquire
+      cdt_worker_record_write_notice(host, pte, sender->id);
+    } else {
+      // The writer discards its copy once its changes are merged, and readers' copies are now stale
+      pte->read_set[sender->id] = 0;
+      res = cdt_worker_invalidate_readers(host, pte, sender->id);
+    }
+  }
+
+  cdt_packet_diff_resp_create(packet, page_addr, sender->id, res == 0 ? 0 : 1);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send diff response packet to peer %d\n", sender->id);
+    res = -1;
+  }
+
+  pthread_mutex_unlock(&pte->lock);
+  return res;
+}
+
+void cdt_worker_record_write_notice(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t writer_id) {
+  for (int i = 0; i < CDT_MAX_MACHINES; i++) {
+    if (pte->read_set[i] && i != host->self_id && i != writer_id && !pte->stale_set[i]) {
+      pte->stale_set[i] = 1;
+      cdt_host_list_page(&host->write_notices[i], SHARED_VA_TO_IDX(pte->shared_va));
+    }
+  }
+}
+
+uint32_t cdt_worker_count_write(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t writer_id) {
+  uint32_t count = ++pte->write_counts[writer_id];
+  if (writer_id == host->self_id || count < CDT_HOME_MIGRATE_WRITES)
+    return 0;
+
+  // The pages of a coherence block keep sharing a home
+  if (host->block_shifts[SHARED_VA_TO_IDX(pte->shared_va)])
+    return 0;
+
+  // Only move the home to a machine that clearly writes the page more than anyone else, including us
+  for (int i = 0; i < CDT_MAX_MACHINES; i++) {
+    if (i != writer_id && pte->write_counts[i] >= count)
+      return 0;
+  }
+
+  return 1;
+}
+
+void cdt_worker_detect_migratory(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t writer_id) {
+  if (pte->flags & CDT_MALLOC_LEASE)
+    return;
+
+  if (pte->writer < 0) {
+    // The page is migratory if the writer read it from the last writer and nobody else has a copy
+    int shared = 0;
+    for (int i = 0; i < CDT_MAX_MACHINES; i++) {
+      if (pte->read_set[i] && i != host->self_id && i != writer_id && i != pte->last_writer)
+        shared = 1;
+    }
+
+    if (shared)
+      pte->migratory = 0;
+    else if (pte->last_writer >= 0 && pte->last_writer != writer_id && pte->read_set[writer_id])
+      pte->migratory = 1;
+  }
+
+  pte->last_writer = writer_id;
+}
+
+int cdt_worker_take_migratory(cdt_host_t *host, cdt_manager_pte_t *pte, uint32_t reader_id) {
+  if (!pte->migratory || (pte->flags & (CDT_MALLOC_MULTIPLE_WRITER | CDT_MALLOC_LEASE)) || pte->writer == reader_id)
+    return 0;
+
+  if (pte->writer >= 0)
+    return 1;
+
+  // Several machines are reading the page at once, so it is no longer migratory
+  for (int i = 0; i < CDT_MAX_MACHINES; i++) {
+    if (pte->read_set[i] && i != host->self_id && i != reader_id) {
+      pte->migratory = 0;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+void cdt_worker_next_version(cdt_host_t *host, cdt_manager_pte_t *pte) {
+  pte->version = (pte->version / CDT_MAX_MACHINES + 1) * CDT_MAX_MACHINES + host->self_id;
+}
+
+uint32_t cdt_worker_copy_version(cdt_manager_pte_t *pte) {
+  // Copies of multiple-writer pages are changed by merging diffs, which is not tracked by versions
+  return (pte->flags & CDT_MALLOC_MULTIPLE_WRITER) ? 0 : pte->version;
+}
+
+void cdt_worker_do_home_leave(cdt_host_t *host, int idx, uint32_t new_home) {
+  cdt_manager_pte_t *pte = &host->manager_pagetable[idx];
+
+  pte->in_use = 0;
+  pte->writer = -1;
+  pte->page = NULL;
+  pte->last_writer = -1;
+  pte->migratory = 0;
+  for (int i = 0; i < CDT_MAX_MACHINES; i++)
+    pte->write_counts[i] = 0;
+
+  // Our own accesses now go through shared_pagetable like any other machine's
+  cdt_host_pte_t *shared_pte = &host->shared_pagetable[idx];
+  shared_pte->in_use = 0;
+  shared_pte->access = INVALID_PAGE;
+  shared_pte->exclusive = 0;
+  shared_pte->version = 0;
+  shared_pte->page = NULL;
+  shared_pte->flags = pte->flags;
+
+  // Left behind as a forwarding pointer for machines that still think we are the home
+  __atomic_store_n(&host->homes[idx], new_home, __ATOMIC_RELEASE);
+}
+
+int cdt_worker_home_moved(cdt_host_t *host, cdt_peer_t *sender, uint64_t page_addr, uint32_t home) {
+  cdt_packet_t packet;
+  cdt_packet_home_moved_create(&packet, page_addr, home);
+  if (cdt_connection_send(&sender->connection, &packet) != 0) {
+    debug_print("Failed to send home moved packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return 0;
+}
+
+int cdt_worker_acquire_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  cdt_host_t *host = cdt_get_host();
+  cdt_page_range_t ranges[CDT_MAX_LOCK_RANGES];
+  uint32_t num_ranges;
+  cdt_packet_acquire_req_parse(packet, ranges, &num_ranges);
+
+  // Only the pages the sender was left a stale copy of are looked at, it no longer holds a copy once it is told
+  uint32_t noticed[CDT_MAX_SHARED_PAGES];
+  uint32_t num_noticed = cdt_host_take_pages(&host->write_notices[sender->id], noticed, ranges, num_ranges);
+
+  uint32_t pages[CDT_PACKET_ACQUIRE_MAX_PAGES];
+  uint32_t num_pages = 0;
+
+  for (uint32_t n = 0; n < num_noticed; n++) {
+    uint32_t i = noticed[n];
+    if (cdt_host_home(host, i) != host->self_id)
+      continue;
+
+    cdt_manager_pte_t *pte = &host->manager_pagetable[i];
+    pthread_mutex_lock(&pte->lock);
+
+    if (pte->in_use && pte->stale_set[sender->id]) {
+      pte->stale_set[sender->id] = 0;
+      pte->read_set[sender->id] = 0;
+      pages[num_pages++] = i;
+    }
+
+    pthread_mutex_unlock(&pte->lock);
+
+    if (num_pages == CDT_PACKET_ACQUIRE_MAX_PAGES) {
+      cdt_packet_acquire_resp_create(packet, sender->id, 1, pages, num_pages);
+      if (cdt_connection_send(&sender->connection, packet) != 0) {
+        debug_print("Failed to send acquire response packet to peer %d\n", sender->id);
+        return -1;
+      }
+      num_pages = 0;
+    }
+  }
+
+  cdt_packet_acquire_resp_create(packet, sender->id, 0, pages, num_pages);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send acquire response packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return 0;
+}
+
+int cdt_worker_do_freeze(cdt_host_t *host, uint32_t requester_id, uint32_t start, uint32_t num_pages) {
+  if (num_pages == 0 || start + num_pages > CDT_MAX_SHARED_PAGES)
+    return -1;
+
+  pthread_mutex_t **locks = malloc(num_pages * sizeof(*locks));
+  uint8_t *wanted = calloc((num_pages + 7) / 8, 1);
+  if (!locks || !wanted) {
+    free(locks);
+    free(wanted);
+    return -1;
+  }
+
+  // The pages we are the home for stay locked until they are frozen, so all of their writers are recalled at once
+  int res = 0;
+  for (uint32_t i = 0; i < num_pages; i++) {
+    locks[i] = cdt_host_lock_page(host, start + i);
+    if (cdt_host_home(host, start + i) != host->self_id) {
+      pthread_mutex_unlock(locks[i]);
+      locks[i] = NULL;
+      continue;
+    }
+
+    cdt_manager_pte_t *pte = &host->manager_pagetable[start + i];
+    if (!pte->in_use || (pte->flags & CDT_MALLOC_MULTIPLE_WRITER)) {
+      debug_print("Only single-writer memory can be frozen, which page %d is not\n", start + i);
+      res = -1;
+    } else if (pte->writer >= 0 && pte->writer != host->self_id) {
+      wanted[i / 8] |= 1 << (i % 8);
+    }
+  }
+
+  if (res == 0)
+    res = cdt_worker_recall_range(host, requester_id, start, num_pages, wanted, 1);
+
+  for (uint32_t i = 0; i < num_pages; i++) {
+    if (!locks[i])
+      continue;
+
+    cdt_manager_pte_t *pte = &host->manager_pagetable[start + i];
+    if (res == 0 && pte->writer == host->self_id) {
+      cdt_host_protect_page(pte->shared_va, READ_ONLY_PAGE);
+      pte->read_set[host->self_id] = 1;
+      pte->writer = -1;
+    }
+
+    if (res == 0) {
+      pte->migratory = 0;
+      __atomic_store_n(&host->frozen[start + i], 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(locks[i]);
+  }
+
+  free(locks);
+  free(wanted);
+  return res;
+}
+
+void cdt_worker_freeze_copies(cdt_host_t *host, uint32_t start, uint32_t num_pages) {
+  // Every home has already taken away any copies that could be written
+  uint64_t now = cdt_host_now();
+  for (uint32_t i = start; i < start + num_pages && i < CDT_MAX_SHARED_PAGES; i++) {
+    pthread_mutex_t *lock = cdt_host_lock_page(host, i);
+    if (cdt_host_home(host, i) == host->self_id) {
+      pthread_mutex_unlock(lock);
+      continue;
+    }
+
+    cdt_host_pte_t *pte = &host->shared_pagetable[i];
+    if (pte->in_use && pte->access == READ_ONLY_PAGE && pte->lease_expiry && pte->lease_expiry <= now) {
+      // The lease ran out before the lease thread got to it, so the copy may already be stale
+      if (cdt_fault_invalidate(host, i) != 0)
+        debug_print("Failed to drop the leased copy of shared page %d\n", i);
+    }
+    __atomic_store_n(&pte->lease_expiry, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&host->frozen[i], 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(lock);
+  }
+}
+
+int cdt_worker_freeze_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t start, num_pages, copies;
+  cdt_packet_freeze_req_parse(packet, &start, &num_pages, &copies);
+
+  int res = 0;
+  if (copies)
+    cdt_worker_freeze_copies(cdt_get_host(), start, num_pages);
+  else
+    res = cdt_worker_do_freeze(cdt_get_host(), sender->id, start, num_pages);
+
+  cdt_packet_freeze_resp_create(packet, sender->id, res == 0 ? 0 : 1);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send freeze response packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return res;
+}
+
+int cdt_worker_forward_push(cdt_host_t *host, uint32_t root, cdt_packet_t *packet) {
+  // Machines are numbered from the root, and each one passes pages on to the next level of the tree
+  uint32_t rank = (host->self_id + host->num_machines - root) % host->num_machines;
+  for (uint32_t i = 1; i <= CDT_WORKER_BROADCAST_FANOUT; i++) {
+    uint32_t child = rank * CDT_WORKER_BROADCAST_FANOUT + i;
+    if (child >= host->num_machines)
+      break;
+
+    uint32_t child_id = (child + root) % host->num_machines;
+    if (cdt_connection_send(&host->peers[child_id].connection, packet) != 0) {
+      debug_print("Failed to send replica push packet to peer %d\n", child_id);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int cdt_worker_do_broadcast(cdt_host_t *host, uint32_t requester_id, uint32_t start, uint32_t num_pages) {
+  if (num_pages == 0 || start + num_pages > CDT_MAX_SHARED_PAGES)
+    return -1;
+
+  pthread_mutex_t **locks = malloc(num_pages * sizeof(*locks));
+  uint8_t *wanted = calloc((num_pages + 7) / 8, 1);
+  uint32_t *readers = calloc(num_pages, sizeof(*readers));
+  if (!locks || !wanted || !readers) {
+    free(locks);
+    free(wanted);
+    free(readers);
+    return -1;
+  }
+
+  // The pages we are the home for stay locked until every machine has its copy, so none of them can be
+  // written in between. Multiple-writer and leased pages are left for the readers to fault in.
+  uint32_t num_pushed = 0;
+  for (uint32_t i = 0; i < num_pages; i++) {
+    locks[i] = cdt_host_lock_page(host, start + i);
+    cdt_manager_pte_t *pte = &host->manager_pagetable[start + i];
+    if (cdt_host_home(host, start + i) != host->self_id || !pte->in_use ||
+        (pte->flags & (CDT_MALLOC_MULTIPLE_WRITER | CDT_MALLOC_LEASE))) {
+      pthread_mutex_unlock(locks[i]);
+      locks[i] = NULL;
+      continue;
+    }
+
+    if (pte->writer >= 0 && pte->writer != host->self_id)
+      wanted[i / 8] |= 1 << (i % 8);
+    num_pushed++;
+  }
+
+  // Writers give up their copies altogether, and are sent them back along with everyone else
+  int res = cdt_worker_recall_range(host, requester_id, start, num_pages, wanted, 1);
+
+  // Each page goes out as soon as it is ready, and is passed on down the tree while the next is on its way
+  cdt_packet_t packet;
+  for (uint32_t i = 0; res == 0 && i < num_pages; i++) {
+    if (!locks[i])
+      continue;
+
+    cdt_manager_pte_t *pte = &host->manager_pagetable[start + i];
+    if (pte->writer == host->self_id) {
+      cdt_host_protect_page(pte->shared_va, READ_ONLY_PAGE);
+      pte->read_set[host->self_id] = 1;
+      pte->writer = -1;
+    }
+
+    cdt_packet_replica_push_req_create(&packet, requester_id, host->self_id, start + i, pte->page, pte->flags, pte->version);
+    res = cdt_worker_forward_push(host, host->self_id, &packet);
+
+    // Every machine counts as a reader until it reports it did not take its copy, so none is missed if
+    // the push fails part of the way down the tree
+    for (uint32_t p = 0; p < host->num_machines; p++) {
+      if (pte->read_set[p])
+        readers[i] |= 1u << p;
+      pte->read_set[p] = 1;
+      pte->stale_set[p] = 0;
+    }
+    pte->migratory = 0;
+  }
+
+  // The end of the pages reaches each machine after all of them, and is answered once they are in place
+  if (res == 0 && num_pushed > 0) {
+    cdt_packet_replica_push_req_create(&packet, requester_id, host->self_id, CDT_PACKET_RANGE_DONE, NULL, 0, 0);
+    res = cdt_worker_forward_push(host, host->self_id, &packet);
+
+    for (uint32_t j = 1; res == 0 && j < host->num_machines;) {
+      if (cdt_worker_receive_response(&host->peers[requester_id], &packet) != 0) {
+        res = -1;
+        break;
+      }
+
+      uint32_t resp_requester_id, root, machine_id, idx;
+      cdt_packet_replica_push_resp_parse(&packet, &resp_requester_id, &root, &machine_id, &idx);
+      assert(resp_requester_id == requester_id);
+      assert(root == host->self_id);
+      if (idx == CDT_PACKET_RANGE_DONE) {
+        j++;
+        continue;
+      }
+
+      // A machine that did not take its copy is only still a reader if it already held one
+      if (idx >= start && idx - start < num_pages && locks[idx - start] && machine_id < CDT_MAX_MACHINES)
+        host->manager_pagetable[idx].read_set[machine_id] = (readers[idx - start] >> machine_id) & 1;
+    }
+  }
+
+  for (uint32_t i = 0; i < num_pages; i++) {
+    if (locks[i])
+      pthread_mutex_unlock(locks[i]);
+  }
+
+  free(locks);
+  free(wanted);
+  free(readers);
+  return res;
+}
+
+int cdt_worker_broadcast_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t start, num_pages;
+  cdt_packet_broadcast_req_parse(packet, &start, &num_pages);
+
+  int res = cdt_worker_do_broadcast(cdt_get_host(), sender->id, start, num_pages);
+
+  cdt_packet_broadcast_resp_create(packet, sender->id, res == 0 ? 0 : 1);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send broadcast response packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return res;
+}
+
+int cdt_worker_replica_push_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t requester_id, root, idx, flags, version;
+  void *page;
+  cdt_packet_replica_push_req_parse(packet, &requester_id, &root, &idx, &page, &flags, &version);
+
+  cdt_host_t *host = cdt_get_host();
+  if (idx != CDT_PACKET_RANGE_DONE && idx < CDT_MAX_SHARED_PAGES && cdt_host_home(host, idx) != host->self_id) {
+    cdt_host_pte_t *pte = &host->shared_pagetable[idx];
+
+    // A page our own thread is busy with is left for it to fault in, since the root is holding on to it
+    // until we answer. A copy we already hold is still current, as the root counts us as a reader.
+    int taken = 0;
+    if (pthread_mutex_trylock(&pte->lock) == 0) {
+      if (pte->in_use && pte->access != INVALID_PAGE) {
+        taken = 1;
+      } else {
+        pte->page = cdt_host_map_page(pte->shared_va, page, READ_ONLY_PAGE);
+        if (pte->page) {
+          pte->access = READ_ONLY_PAGE;
+          pte->in_use = 1;
+          pte->flags = flags;
+          pte->version = version;
+          taken = 1;
+        }
+      }
+      pthread_mutex_unlock(&pte->lock);
+    }
+
+    // The root counts every machine as a reader until it hears otherwise
+    if (!taken) {
+      cdt_packet_t skipped;
+      cdt_packet_replica_push_resp_create(&skipped, requester_id, root, host->self_id, idx);
+      if (cdt_connection_send(&host->peers[root].connection, &skipped) != 0) {
+        debug_print("Failed to send replica push response packet to peer %d\n", root);
+        return -1;
+      }
+    }
+  }
+
+  if (cdt_worker_forward_push(host, root, packet) != 0)
+    return -1;
+
+  if (idx != CDT_PACKET_RANGE_DONE)
+    return 0;
+
+  cdt_packet_replica_push_resp_create(packet, requester_id, root, host->self_id, CDT_PACKET_RANGE_DONE);
+  if (cdt_connection_send(&host->peers[root].connection, packet) != 0) {
+    debug_print("Failed to send replica push response packet to peer %d\n", root);
+    return -1;
+  }
+
+  return 0;
+}
+
+int cdt_worker_halo_push_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t offset, total, size;
+  void *data;
+  cdt_packet_halo_push_req_parse(packet, &offset, &total, &data, &size);
+
+  if (offset > total || size > total - offset) {
+    debug_print("Got an invalid halo push from peer %d\n", sender->id);
+    return -1;
+  }
+
+  cdt_host_halo_inbox_t *inbox = &cdt_get_host()->halo_inboxes[sender->id];
+  pthread_mutex_lock(&inbox->lock);
+
+  // The sender may be exchanges ahead of us, in which case this one is queued behind those we have not
+  // copied into place yet, since we must never wait for our own thread here
+  cdt_host_halo_exchange_t *exchange = inbox->tail;
+  if (!exchange || exchange->received == exchange->total) {
+    exchange = inbox->spare ? inbox->spare : calloc(1, sizeof(cdt_host_halo_exchange_t));
+    if (!exchange) {
+      pthread_mutex_unlock(&inbox->lock);
+      return -1;
+    }
+    inbox->spare = NULL;
+
+    if (exchange->capacity < total) {
+      uint8_t *grown = realloc(exchange->data, total);
+      if (!grown) {
+        free(exchange->data);
+        free(exchange);
+        pthread_mutex_unlock(&inbox->lock);
+        return -1;
+      }
+      exchange->data = grown;
+      exchange->capacity = total;
+    }
+
+    exchange->total = total;
+    exchange->received = 0;
+    exchange->next = NULL;
+    if (inbox->tail)
+      inbox->tail->next = exchange;
+    else
+      inbox->head = exchange;
+    inbox->tail = exchange;
+  }
+
+  if (total != exchange->total || size > exchange->total - exchange->received) {
+    debug_print("Got a halo push from peer %d that does not match its exchange\n", sender->id);
+    pthread_mutex_unlock(&inbox->lock);
+    return -1;
+  }
+
+  memmove(exchange->data + offset, data, size);
+  exchange->received += size;
+  if (exchange->received == exchange->total)
+    pthread_cond_broadcast(&inbox->cond);
+
+  pthread_mutex_unlock(&inbox->lock);
+  return 0;
+}
+
+int cdt_worker_do_lock_create(cdt_host_t *host) {
+  for (int i = 0; i < CDT_MAX_LOCKS; i++) {
+    cdt_manager_lock_t *lock = &host->manager_locks[i];
+    pthread_mutex_lock(&lock->lock);
+
+    if (!lock->in_use) {
+      lock->in_use = 1;
+      lock->holder = -1;
+      lock->num_waiters = 0;
+      lock->num_ranges = 0;
+      pthread_mutex_unlock(&lock->lock);
+      return i;
+    }
+
+    pthread_mutex_unlock(&lock->lock);
+  }
+
+  debug_print("Maximum number of locks exceeded\n");
+  return -1;
+}
+
+int cdt_worker_do_lock_bind(cdt_host_t *host, uint32_t lock_id, uint32_t start, uint32_t num_pages) {
+  if (lock_id >= CDT_MAX_LOCKS || num_pages == 0 || start + num_pages > CDT_MAX_SHARED_PAGES)
+    return -1;
+
+  cdt_manager_lock_t *lock = &host->manager_locks[lock_id];
+  pthread_mutex_lock(&lock->lock);
+
+  if (!lock->in_use || lock->num_ranges >= CDT_MAX_LOCK_RANGES) {
+    debug_print("Cannot bind another range to lock %d\n", lock_id);
+    pthread_mutex_unlock(&lock->lock);
+    return -1;
+  }
+
+  lock->ranges[lock->num_ranges].start = start;
+  lock->ranges[lock->num_ranges].num_pages = num_pages;
+  lock->num_ranges++;
+
+  pthread_mutex_unlock(&lock->lock);
+  return 0;
+}
+
+/**
+ * Grant lock to requester_id, telling it which ranges are bound to the lock.
+ * 
+ * The lock table entry MUST be locked before calling this.
+ */
+int cdt_worker_lock_grant(cdt_host_t *host, cdt_manager_lock_t *lock, uint32_t requester_id) {
+  cdt_packet_t packet;
+  cdt_packet_lock_acquire_resp_create(&packet, requester_id, 0, lock->ranges, lock->num_ranges);
+
+  if (requester_id == host->self_id) {
+    if (mq_send(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), 0) == -1) {
+      debug_print("Failed to send lock acquire response to main thread\n");
+      return -1;
+    }
+    return 0;
+  }
+
+  if (cdt_connection_send(&host->peers[requester_id].connection, &packet) != 0) {
+    debug_print("Failed to send lock acquire response packet to peer %d\n", requester_id);
+    return -1;
+  }
+
+  return 0;
+}
+
+int cdt_worker_do_lock_acquire(cdt_host_t *host, uint32_t lock_id, uint32_t requester_id) {
+  if (lock_id >= CDT_MAX_LOCKS)
+    return -1;
+
+  cdt_manager_lock_t *lock = &host->manager_locks[lock_id];
+  pthread_mutex_lock(&lock->lock);
+
+  if (!lock->in_use) {
+    debug_print("Trying to acquire invalid lock %d\n", lock_id);
+    pthread_mutex_unlock(&lock->lock);
+    return -1;
+  }
+
+  int res = 0;
+  if (lock->holder == -1) {
+    lock->holder = requester_id;
+    res = cdt_worker_lock_grant(host, lock, requester_id);
+  } else if (lock->num_waiters < CDT_MAX_MACHINES) {
+    // The requester is granted the lock when it is released
+    lock->waiters[lock->num_waiters++] = requester_id;
+  } else {
+    res = -1;
+  }
+
+  pthread_mutex_unlock(&lock->lock);
+  return res;
+}
+
+int cdt_worker_do_lock_release(cdt_host_t *host, uint32_t lock_id, uint32_t releaser_id) {
+  if (lock_id >= CDT_MAX_LOCKS)
+    return -1;
+
+  cdt_manager_lock_t *lock = &host->manager_locks[lock_id];
+  pthread_mutex_lock(&lock->lock);
+
+  if (!lock->in_use || lock->holder != releaser_id) {
+    debug_print("Machine %d is trying to release lock %d it does not hold\n", releaser_id, lock_id);
+    pthread_mutex_unlock(&lock->lock);
+    return -1;
+  }
+
+  int res = 0;
+  if (lock->num_waiters > 0) {
+    lock->holder = lock->waiters[0];
+    lock->num_waiters--;
+    memmove(lock->waiters, lock->waiters + 1, lock->num_waiters * sizeof(lock->waiters[0]));
+    res = cdt_worker_lock_grant(host, lock, lock->holder);
+  } else {
+    lock->holder = -1;
+  }
+
+  pthread_mutex_unlock(&lock->lock);
+  return res;
+}
+
+int cdt_worker_lock_create(cdt_peer_t *sender, cdt_packet_t *packet) {
+  int lock_id = cdt_worker_do_lock_create(cdt_get_host());
+
+  cdt_packet_lock_create_resp_create(packet, sender->id, lock_id == -1 ? CDT_MAX_LOCKS : lock_id);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send lock create response packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return lock_id == -1 ? -1 : 0;
+}
+
+int cdt_worker_lock_bind(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t lock_id, start, num_pages;
+  cdt_packet_lock_bind_req_parse(packet, &lock_id, &start, &num_pages);
+
+  int res = cdt_worker_do_lock_bind(cdt_get_host(), lock_id, start, num_pages);
+
+  cdt_packet_lock_bind_resp_create(packet, sender->id, res == 0 ? 0 : 1);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send lock bind response packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return res;
+}
+
+int cdt_worker_lock_acquire(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t lock_id;
+  cdt_packet_lock_acquire_req_parse(packet, &lock_id);
+
+  if (cdt_worker_do_lock_acquire(cdt_get_host(), lock_id, sender->id) == 0)
+    return 0;
+
+  cdt_packet_lock_acquire_resp_create(packet, sender->id, 1, NULL, 0);
+  if (cdt_connection_send(&sender->connection, packet) != 0)
+    debug_print("Failed to send lock acquire response packet to peer %d\n", sender->id);
+
+  return -1;
+}
+
+int cdt_worker_lock_release(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t lock_id;
+  cdt_packet_lock_release_req_parse(packet, &lock_id);
+
+  int res = cdt_worker_do_lock_release(cdt_get_host(), lock_id, sender->id);
+
+  cdt_packet_lock_release_resp_create(packet, sender->id, res == 0 ? 0 : 1);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send lock release response packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return res;
+}
+
+/**
+ * Tell requester_id that the object it is waiting on has reached the value it was waiting for, or why it
+ * cannot wait on the object if status is nonzero.
+ */
+int cdt_worker_object_wake(cdt_host_t *host, uint32_t object_id, uint32_t requester_id, uint32_t status) {
+  cdt_packet_t packet;
+  cdt_packet_object_wait_resp_create(&packet, requester_id, object_id, status);
+
+  if (requester_id == host->self_id) {
+    if (mq_send(host->peers[host->self_id].task_queue, (char*)&packet, sizeof(packet), 0) == -1) {
+      debug_print("Failed to send object wait response to main thread\n");
+      return -1;
+    }
+    return 0;
+  }
+
+  if (cdt_connection_send(&host->peers[requester_id].connection, &packet) != 0) {
+    debug_print("Failed to send object wait response packet to peer %d\n", requester_id);
+    return -1;
+  }
+
+  return 0;
+}
+
+int cdt_worker_do_object_update(cdt_host_t *host, uint32_t object_id, uint32_t requester_id, uint32_t op,
+                                const void *data, uint32_t size, void *old) {
+  if (object_id >= CDT_MAX_OBJECTS || object_id % host->num_machines != host->self_id)
+    return CDT_OBJECT_UNKNOWN;
+
+  cdt_manager_object_t *object = &host->manager_objects[object_id];
+  pthread_mutex_lock(&object->lock);
+
+  if (!object->in_use) {
+    debug_print("Got an update for unknown object %d from peer %d\n", object_id, requester_id);
+    pthread_mutex_unlock(&object->lock);
+    return CDT_OBJECT_UNKNOWN;
+  }
+
+  if (size != object->size || (op == CDT_PACKET_OBJECT_ADD && size != sizeof(int64_t))) {
+    debug_print("Got an update of the wrong size for object %d from peer %d\n", object_id, requester_id);
+    pthread_mutex_unlock(&object->lock);
+    return CDT_OBJECT_WRONG_SIZE;
+  }
+
+  // Every other cached copy is invalidated before the update becomes visible
+  int read_count = 0;
+  cdt_packet_t packet;
+  cdt_packet_object_invalidate_req_create(&packet, object_id, requester_id);
+  for (int i = 0; i < CDT_MAX_MACHINES; i++) {
+    if (object->read_set[i] && i != requester_id) {
+      if (cdt_connection_send(&host->peers[i].connection, &packet) != 0) {
+        debug_print("Failed to send object invalidate request packet to peer %d\n", i);
+        pthread_mutex_unlock(&object->lock);
+        return -1;
+      }
+      object->read_set[i] = 0;
+      read_count++;
+    }
+  }
+
+  for (int j = 0; j < read_count; j++) {
+    if (cdt_worker_receive_response(&host->peers[requester_id], &packet) != 0) {
+      pthread_mutex_unlock(&object->lock);
+      return -1;
+    }
+
+    uint32_t resp_requester_id, resp_object_id;
+    cdt_packet_object_invalidate_resp_parse(&packet, &resp_requester_id, &resp_object_id);
+    assert(resp_requester_id == requester_id);
+  }
+
+  memmove(old, object->data, size);
+  if (op == CDT_PACKET_OBJECT_ADD) {
+    int64_t value, operand;
+    memmove(&value, object->data, sizeof(value));
+    memmove(&operand, data, sizeof(operand));
+    value += operand;
+    memmove(object->data, &value, sizeof(value));
+  } else {
+    memmove(object->data, data, size);
+  }
+
+  if (requester_id != host->self_id)
+    object->read_set[requester_id] = 1;
+
+  // Wake the machines waiting for the object to reach a value it has now reached
+  int res = 0;
+  if (size == sizeof(int64_t)) {
+    int64_t value;
+    memmove(&value, object->data, sizeof(value));
+    for (int i = 0; i < CDT_MAX_MACHINES; i++) {
+      if (object->wait_set[i] && value >= object->wait_targets[i]) {
+        object->wait_set[i] = 0;
+        if (cdt_worker_object_wake(host, object_id, i, 0) != 0)
+          res = -1;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&object->lock);
+  return res;
+}
+
+int cdt_worker_do_object_wait(cdt_host_t *host, uint32_t object_id, uint32_t requester_id, int64_t value) {
+  if (object_id >= CDT_MAX_OBJECTS || object_id % host->num_machines != host->self_id)
+    return cdt_worker_object_wake(host, object_id, requester_id, CDT_OBJECT_UNKNOWN);
+
+  cdt_manager_object_t *object = &host->manager_objects[object_id];
+  pthread_mutex_lock(&object->lock);
+
+  int res;
+  int64_t current;
+  memmove(&current, object->data, sizeof(current));
+  if (!object->in_use) {
+    res = cdt_worker_object_wake(host, object_id, requester_id, CDT_OBJECT_UNKNOWN);
+  } else if (object->size != sizeof(int64_t)) {
+    res = cdt_worker_object_wake(host, object_id, requester_id, CDT_OBJECT_WRONG_SIZE);
+  } else if (current >= value) {
+    res = cdt_worker_object_wake(host, object_id, requester_id, 0);
+  } else {
+    // The requester is woken by the update that brings the object to value
+    object->wait_set[requester_id] = 1;
+    object->wait_targets[requester_id] = value;
+    res = 0;
+  }
+
+  pthread_mutex_unlock(&object->lock);
+  return res;
+}
+
+int cdt_worker_object_wait_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t object_id;
+  int64_t value;
+  cdt_packet_object_wait_req_parse(packet, &object_id, &value);
+
+  return cdt_worker_do_object_wait(cdt_get_host(), object_id, sender->id, value);
+}
+
+int cdt_worker_object_read_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t object_id;
+  cdt_packet_object_read_req_parse(packet, &object_id);
+
+  cdt_host_t *host = cdt_get_host();
+  if (object_id >= CDT_MAX_OBJECTS || object_id % host->num_machines != host->self_id) {
+    cdt_packet_object_read_resp_create(packet, sender->id, object_id, CDT_OBJECT_UNKNOWN, NULL, 0);
+    cdt_connection_send(&sender->connection, packet);
+    return -1;
+  }
+
+  cdt_manager_object_t *object = &host->manager_objects[object_id];
+  pthread_mutex_lock(&object->lock);
+
+  if (object->in_use) {
+    object->read_set[sender->id] = 1;
+    cdt_packet_object_read_resp_create(packet, sender->id, object_id, 0, object->data, object->size);
+  } else {
+    cdt_packet_object_read_resp_create(packet, sender->id, object_id, CDT_OBJECT_UNKNOWN, NULL, 0);
+  }
+
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send object read response packet to peer %d\n", sender->id);
+    pthread_mutex_unlock(&object->lock);
+    return -1;
+  }
+
+  pthread_mutex_unlock(&object->lock);
+  return 0;
+}
+
+int cdt_worker_object_update_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t object_id, op, size;
+  void *data;
+  cdt_packet_object_update_req_parse(packet, &object_id, &op, &data, &size);
+
+  uint8_t operand[CDT_MAX_OBJECT_SIZE], old[CDT_MAX_OBJECT_SIZE];
+  memmove(operand, data, size);
+
+  int res = cdt_worker_do_object_update(cdt_get_host(), object_id, sender->id, op, operand, size, old);
+
+  uint32_t status = res < 0 ? CDT_OBJECT_FAILED : res;
+  cdt_packet_object_update_resp_create(packet, sender->id, object_id, status, old, res == 0 ? size : 0);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send object update response packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return res;
+}
+
+int cdt_worker_object_invalidate_req(cdt_peer_t *sender, cdt_packet_t *packet) {
+  uint32_t object_id, requester_id;
+  cdt_packet_object_invalidate_req_parse(packet, &object_id, &requester_id);
+
+  cdt_host_t *host = cdt_get_host();
+  if (object_id < CDT_MAX_OBJECTS) {
+    // A copy that is still on its way here was sent before the update, so it must not be kept either
+    cdt_host_object_t *object = &host->objects[object_id];
+    pthread_mutex_lock(&object->lock);
+    object->valid = 0;
+    if (object->fetching)
+      object->fetch_invalidated = 1;
+    pthread_mutex_unlock(&object->lock);
+  }
+
+  cdt_packet_object_invalidate_resp_create(packet, requester_id, object_id);
+  if (cdt_connection_send(&sender->connection, packet) != 0) {
+    debug_print("Failed to send object invalidate response packet to peer %d\n", sender->id);
+    return -1;
+  }
+
+  return 0;
+}